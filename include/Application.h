@@ -18,25 +18,36 @@
 
 #include "ASCIIFile.h"
 #include "Arguments.h"
+#include "Catalogue.h"
 #include "CloudAnalyser.h"
 #include "ColumnFile.h"
 #include "CoolingMap.h"
 #include "Definitions.h"
+#include "DerivedCache.h"
 #include "DiscAnalyser.h"
 #include "DragonFile.h"
 #include "EvolutionAnalyser.h"
 #include "File.h"
 #include "FileNameExtractor.h"
 #include "Generator.h"
+#include "GravityTree.h"
 #include "Heatmap.h"
+#include "IOBackend.h"
 #include "MassAnalyser.h"
 #include "OpacityTable.h"
 #include "OpticalDepthOctree.h"
 #include "Parameters.h"
+#include "ParticleCut.h"
+#include "Pipeline.h"
 #include "RadialAnalyser.h"
+#include "Random.h"
 #include "SerenFile.h"
 #include "SinkAnalyser.h"
+#include "SPHDensity.h"
 #include "SinkFile.h"
+#include "SparFile.h"
+#include "ThermoKernel.h"
+#include "Transcoder.h"
 
 class Application {
 public:
@@ -54,6 +65,7 @@ private:
   int mFilesPerThread = 0;
   int mRemainder = 0;
   int mOutputInfo = 0;
+  int mParticleThreads = 1;
 
   Arguments *mArgs = NULL;
   Parameters *mParams = NULL;
@@ -64,17 +76,20 @@ private:
   EvolutionAnalyser *mEvolAnalyser = NULL;
   SinkAnalyser *mSinkAnalyser = NULL;
   RadialAnalyser *mRadialAnalyser = NULL;
+  ProfileStore *mProfileStore = NULL;
   MassAnalyser *mMassAnalyser = NULL;
   Generator *mGenerator = NULL;
   CoolingMap *mCoolingMap = NULL;
+  Pipeline *mPipeline = NULL;
 
   std::vector<File *> mFiles;
   std::vector<SinkFile *> mSinkFiles;
-  int mFilesAnalysed = 0;
+  std::atomic<int> mFilesAnalysed{0};
   std::vector<std::string> mFileNames;
 
   std::string mInFormat = "";
   std::string mOutFormat = "";
+  std::string mCompression = "none";
   std::string mCoolingMethod = "";
   std::string mEosFilePath = "";
   float mGamma = 0.0;
@@ -102,19 +117,42 @@ private:
   int mHillRadiusCut = 0;
   float mMidplaneCut = 0.0;
   int mInsertPlanet = 0.0;
+  int mGravity = 0;
+  int mSPHDensity = 0;
+  int mNumNeigh = 50;
+  int mStreamAnalyse = 0;
+  int mChunkSize = 1000000;
+  int mTranscode = 0;
+  int mDerivedCache = 0;
+  unsigned long mDerivedConfig = 0;
 
   void Analyse(int task, int start, int end);
-  void MidplaneCut(SnapshotFile *file);
-  void RadialCut(SnapshotFile *file, const float r, const int dim);
-  void HillRadiusCut(SnapshotFile *file);
+  bool CheckStreamable();
+  void StreamAnalyse(int task, int start, int end);
+  bool StreamFile(SerenFile *file, const int task);
+  SerenFile *BeginStreamOutput(SnapshotFile *file, const double hydro_mass);
+  NameData StreamNameData(SnapshotFile *file);
+  bool CheckTranscodable();
+  void Transcode(int task, int start, int end);
+  void Cut(SnapshotFile *file, const bool radial, const bool hill,
+           const bool midplane);
   void OutputFile(SnapshotFile *file);
-  void FindThermo(SnapshotFile *file);
+  void BuildPipeline();
+  std::vector<Stage> DeriveStages(int fields, const int valid);
+  void FindGravity(SnapshotFile *file);
   void FindOpticalDepth(SnapshotFile *file);
-  void FindToomre(SnapshotFile *file);
-  void FindEnergy(SnapshotFile *file);
-  void FindBeta(SnapshotFile *file);
+  void FindEnclosed(SnapshotFile *file, const int fields);
+  void SetToomre(Particle *p, const double interior);
+  void SetEnergies(Particle *p, const double interior, const double phi = 0.0);
+  double BindingPotential(Particle *p, const std::vector<Sink *> &sink,
+                          const int first_sink);
+  void FindBeta(Particle *p);
   void InsertPlanet(SnapshotFile *file);
   void ReduceParticles(SnapshotFile *file);
 
   void OutputInfo(SnapshotFile *file);
+  void OutputInfo(SnapshotFile *file, const float gas_mass,
+                  const float max_rho, const float max_temp);
+  void TallyInfo(const std::vector<Particle *> &part, float &gas_mass,
+                 float &max_rho, float &max_temp);
 };
@@ -10,19 +10,28 @@
 ///
 /// \file
 /// BinaryIO.h allows the reading and writing of various data types in binary
-/// format.
+/// format. Reading goes through the IOBackend chosen for the file.
 ///
 //===----------------------------------------------------------------------===//
 
 #pragma once
 
+#include <cstring>
+
 #include "Definitions.h"
+#include "IOBackend.h"
 
+/// Values are collected in a buffer and written out together when it fills,
+/// on Seek and on destruction. Arrays larger than the buffer bypass it.
 class BinaryWriter {
 public:
-  BinaryWriter(std::ofstream &outStream) : mOutStream(outStream) {}
+  BinaryWriter(std::ostream &outStream, const long capacity = 1 << 20)
+      : mOutStream(outStream), mBuffer(std::max(64L, capacity)) {}
+  ~BinaryWriter() { Flush(); }
 
-  void WriteValue(const std::string &value) { mOutStream << value; }
+  void WriteValue(const std::string &value) {
+    WriteBytes(value.data(), value.size());
+  }
 
   void WriteValue(const bool &value) {
     const int intVal = value;
@@ -30,21 +39,106 @@ public:
   }
 
   template <class TypeToWrite> void WriteValue(const TypeToWrite &value) {
-    mOutStream.write((char *)&value, sizeof(value));
+    WriteBytes((const char *)&value, sizeof(value));
+  }
+
+  template <class TypeToWrite>
+  void WriteArray(const TypeToWrite *values, const long n) {
+    WriteBytes((const char *)values, n * sizeof(TypeToWrite));
+  }
+
+  template <class TypeToWrite>
+  void WriteArray(const std::vector<TypeToWrite> &values) {
+    if (values.size() > 0)
+      WriteArray(&values[0], values.size());
+  }
+
+  /// Moves the write position, after writing out what is held.
+  void Seek(const std::streampos pos) {
+    Flush();
+    mOutStream.seekp(pos);
+  }
+
+  /// The position the next value will be written to.
+  std::streampos Tell() {
+    Flush();
+    return mOutStream.tellp();
+  }
+
+  void Flush() {
+    if (mSize > 0)
+      mOutStream.write(&mBuffer[0], mSize);
+    mSize = 0;
   }
 
 private:
-  std::ofstream &mOutStream;
+  std::ostream &mOutStream;
+  std::vector<char> mBuffer;
+  long mSize = 0;
+
+  void WriteBytes(const char *bytes, const long n) {
+    if (mSize + n > mBuffer.size()) {
+      Flush();
+      if (n > mBuffer.size()) {
+        mOutStream.write(bytes, n);
+        return;
+      }
+    }
+    memcpy(&mBuffer[mSize], bytes, n);
+    mSize += n;
+  }
 };
 
+/// Reads go through an IOBackend at an explicit position, which the reader
+/// keeps. Small values are served from a read-ahead buffer, while arrays at
+/// least as large as it are read directly. The reader owns the backend.
 class BinaryReader {
 public:
-  BinaryReader(std::ifstream &inStream) : mInStream(inStream) {}
+  BinaryReader(IOBackend *backend, const long capacity = 1 << 16)
+      : mBackend(backend), mBuffer(std::max(64L, capacity)) {}
+  ~BinaryReader() {
+    mBackend->Close();
+    delete mBackend;
+  }
 
   template <class TypeToRead> void ReadValue(TypeToRead &result) {
-    mInStream.read((char *)&result, sizeof(TypeToRead));
+    ReadBytes((char *)&result, sizeof(TypeToRead));
+  }
+
+  template <class TypeToRead> void ReadArray(TypeToRead *result, const long n) {
+    ReadBytes((char *)result, n * sizeof(TypeToRead));
   }
 
+  void ReadBytes(char *bytes, const long n) {
+    if (mPos < mStart || mPos + n > mStart + mHeld) {
+      if (n >= mBuffer.size()) {
+        mBackend->Read(bytes, n, mPos);
+        mPos += n;
+        return;
+      }
+      mStart = mPos;
+      mHeld = mBackend->Read(&mBuffer[0], mBuffer.size(), mPos);
+    }
+    // Bytes past the end of the file are left as they were
+    long held = std::min(n, mStart + mHeld - mPos);
+    if (held > 0)
+      memcpy(bytes, &mBuffer[mPos - mStart], held);
+    mPos += n;
+  }
+
+  /// Reads every request directly, leaving the position unchanged.
+  void ReadBatch(std::vector<IORequest> &requests) {
+    mBackend->ReadBatch(requests);
+  }
+
+  void Seek(const long pos) { mPos = pos; }
+  long Tell() const { return mPos; }
+  long Size() { return mBackend->Size(); }
+
 private:
-  std::ifstream &mInStream;
+  IOBackend *mBackend = NULL;
+  std::vector<char> mBuffer;
+  long mStart = 0; // File position of the buffer
+  long mHeld = 0;  // Bytes held in the buffer
+  long mPos = 0;
 };
@@ -0,0 +1,60 @@
+//===-- Catalogue.h -------------------------------------------------------===//
+//
+//                                  SPARGEL
+//                   Smoothed Particle Generator and Loader
+//
+// This file is distributed under the GNU General Public License. See LICENSE
+// for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Catalogue.h indexes the input snapshots from their headers alone, so that
+/// snapshots can be selected by time before any particle data is read. The
+/// headers are read in parallel.
+///
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "Definitions.h"
+#include "File.h"
+#include "Parallel.h"
+
+struct CatalogueEntry {
+  int index = 0; // Position in the list of input files
+  std::string name = "";
+  bool header = false; // False if the format has no header, or it is unread
+  double time = 0.0;
+  int num_gas = 0;
+  int num_dust = 0;
+  int num_sink = 0;
+  int dim = 3;
+  long data_offset = 0; // First byte after the header
+  long size = 0;        // File size on disk in bytes, or -1 if unknown
+};
+
+class Catalogue {
+public:
+  Catalogue(const int threads = 1);
+  ~Catalogue();
+
+  void Scan(const std::vector<File *> &files);
+
+  /// Indices of the files with time_min <= t <= time_max, taking every
+  /// stride-th in time order. A non-positive time_max has no upper bound.
+  /// Files without a header cannot be placed and are always selected.
+  std::vector<int> Select(const double time_min, const double time_max,
+                          const int stride) const;
+
+  const std::vector<CatalogueEntry> &GetEntries() const { return mEntries; }
+  /// Particles in the selected files, and the most in any one of them.
+  long GetNumParticles(const std::vector<int> &selection) const;
+  long GetMaxParticles(const std::vector<int> &selection) const;
+
+  void Print() const;
+
+private:
+  int mThreads = 1;
+  std::vector<CatalogueEntry> mEntries;
+};
@@ -19,24 +19,28 @@
 #include "Definitions.h"
 #include "File.h"
 #include "Particle.h"
+#include "ShardedAccumulator.h"
 
 struct CentralValue {
+  double time = 0.0;
   float density = 0.0;
   float temperature = 0.0;
 };
 
 class CloudAnalyser {
 public:
-  CloudAnalyser(NameData nd, const int avg);
+  CloudAnalyser(NameData nd, const int avg, const int threads = 1);
   ~CloudAnalyser();
 
-  void FindCentralQuantities(SnapshotFile *file);
+  void FindCentralQuantities(SnapshotFile *file, const int task = 0);
+  void Merge();
   void CenterAroundDensest(SnapshotFile *file);
   bool Write();
 
 private:
   NameData mNameData;
   int mAverage;
+  ShardedAccumulator<CentralValue> mShards;
   std::vector<CentralValue> mMaxima;
   std::ofstream mOutStream;
 };
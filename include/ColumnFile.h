@@ -28,8 +28,21 @@ public:
   ~ColumnFile();
 
   bool Read();
+  bool ReadHeader();
+  int GetDimensions() { return mDimensions; }
   bool Write(std::string fileName);
 
+  /// Writes a file a block of rows at a time, each array holding one value,
+  /// or three for x and v, per particle. The sinks follow at the end.
+  bool BeginStream(std::string fileName, const int num_gas);
+  void AppendStreamRows(const std::vector<double> &x,
+                        const std::vector<double> &v,
+                        const std::vector<double> &m,
+                        const std::vector<double> &h,
+                        const std::vector<double> &rho,
+                        const std::vector<double> &u);
+  void EndStream();
+
 private:
   int mDimensions = 3;
 
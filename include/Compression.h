@@ -0,0 +1,227 @@
+//===-- Compression.h -----------------------------------------------------===//
+//
+//                                  SPARGEL
+//                   Smoothed Particle Generator and Loader
+//
+// This file is distributed under the GNU General Public License. See LICENSE
+// for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Compression.h lets snapshots be read and written gzip or zstd compressed
+/// without a separate decompression step. Compressed input is recognised by
+/// its leading bytes, compressed output by a .gz or .zst suffix.
+///
+/// Output is compressed in independent blocks of BLOCK_SIZE bytes, several
+/// at once when threads are given. For gzip each block is a member of the
+/// file whose header records its compressed size, as BGZF does, and for zstd
+/// each is a frame holding its content size. Any gzip or zstd tool reads the
+/// result, while here the blocks can be found without decompressing and
+/// then decompressed in parallel or individually for random access. Files
+/// without such blocks are decompressed as a stream.
+///
+/// zstd support requires building with SPARGEL_ZSTD.
+///
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "Definitions.h"
+#include "IOBackend.h"
+
+enum class Codec { None, Gzip, Zstd };
+
+/// The codec of fileName, found from its leading bytes.
+Codec DetectCodec(const std::string &fileName);
+/// The codec named by the suffix of fileName.
+Codec SuffixCodec(const std::string &fileName);
+/// fileName without a .gz or .zst suffix.
+std::string StripCodecSuffix(const std::string &fileName);
+/// fileName with the suffix of the codec named "gz" or "zst" added, or
+/// unchanged for "none".
+std::string AddCodecSuffix(const std::string &fileName,
+                           const std::string &codec);
+/// Whether output can be compressed with the codec named "none", "gz" or
+/// "zst" in this build.
+bool CodecAvailable(const std::string &codec);
+/// Whether fileName is compressed without blocks, so that it can only be
+/// decompressed as a stream from the start.
+bool StreamCompressed(const std::string &fileName);
+
+struct CompressedBlock {
+  long offset = 0; // Compressed data, from the start of the file
+  long bytes = 0;
+  long start = 0; // Uncompressed data
+  long size = 0;
+};
+
+/// A compressed file, mapped into memory, and the blocks found in it.
+class CompressedFile {
+public:
+  CompressedFile() {}
+  ~CompressedFile();
+
+  bool Open(const std::string &fileName);
+  void Close();
+
+  Codec GetCodec() const { return mCodec; }
+  /// Whether the whole file is made of blocks of known size.
+  bool Indexed() const { return mIndexed; }
+  const std::vector<CompressedBlock> &GetBlocks() const { return mBlocks; }
+  /// The uncompressed size, exact when indexed and otherwise as recorded
+  /// by the last gzip member, which is exact for a single member under 4GB.
+  /// Unknown, -1, for zstd without blocks.
+  long Size() const { return mSize; }
+
+  /// Decompresses block i into data, which must hold its size.
+  bool DecompressBlock(const int i, char *data) const;
+
+  /// Streams the whole file, returning the next bytes decompressed, 0 at the
+  /// end or -1 on error.
+  long Next(char *data, const long capacity);
+  /// Restarts Next from the beginning of the file.
+  void Rewind() { EndStream(); }
+
+private:
+  Codec mCodec = Codec::None;
+  const unsigned char *mData = NULL;
+  long mBytes = 0;
+  bool mIndexed = false;
+  std::vector<CompressedBlock> mBlocks;
+  long mSize = 0;
+
+  // State of Next
+  void *mStream = NULL;
+  long mConsumed = 0;
+
+  void IndexGzip();
+  void IndexZstd();
+  void EndStream();
+};
+
+/// Compresses blocks of bytes written to it into a file.
+class CompressBuf : public std::streambuf {
+public:
+  static const int BLOCK_SIZE = 1 << 20;
+
+  CompressBuf(const Codec codec, const int threads);
+  ~CompressBuf();
+
+  bool Open(const std::string &fileName);
+  bool Close();
+
+protected:
+  int overflow(int c);
+  int sync();
+  std::streampos seekoff(std::streamoff off, std::ios_base::seekdir dir,
+                         std::ios_base::openmode which);
+  std::streampos seekpos(std::streampos pos, std::ios_base::openmode which);
+
+private:
+  Codec mCodec;
+  int mThreads = 1;
+  FILE *mFile = NULL;
+  std::vector<char> mBuffer; // Up to mThreads blocks
+  long mWritten = 0;         // Uncompressed bytes before the buffer
+
+  bool Compress();
+};
+
+/// Decompresses a file as it is read, in parallel blocks when indexed.
+class DecompressBuf : public std::streambuf {
+public:
+  DecompressBuf(const int threads = 1);
+
+  bool Open(const std::string &fileName);
+  void SetThreads(const int threads) { mThreads = std::max(1, threads); }
+  void Close();
+  long Size() const { return mFile.Size(); }
+
+protected:
+  int underflow();
+  std::streampos seekoff(std::streamoff off, std::ios_base::seekdir dir,
+                         std::ios_base::openmode which);
+
+private:
+  CompressedFile mFile;
+  int mThreads = 1;
+  int mNextBlock = 0;
+  std::vector<char> mBuffer;
+  long mStart = 0; // Uncompressed position of the buffer
+};
+
+/// An input file stream which decompresses compressed files.
+class InFileStream : public std::istream {
+public:
+  InFileStream() : std::istream(NULL) {}
+
+  void open(const std::string &fileName,
+            std::ios_base::openmode mode = std::ios::in);
+  bool is_open() const { return mOpen; }
+  void close();
+  void SetThreads(const int threads) { mThreads = std::max(1, threads); }
+  /// The uncompressed size of the open file.
+  long Size();
+
+private:
+  std::filebuf mFileBuf;
+  DecompressBuf mDecompress;
+  bool mCompressed = false;
+  bool mOpen = false;
+  int mThreads = 1;
+  std::string mFileName = "";
+};
+
+/// An output file stream which compresses files named with a codec suffix.
+/// Compressed files can only be written in order, so a file written out of
+/// order is kept uncompressed until closed and compressed then.
+class OutFileStream : public std::ostream {
+public:
+  OutFileStream() : std::ostream(NULL) {}
+  ~OutFileStream() { close(); }
+
+  void open(const std::string &fileName,
+            std::ios_base::openmode mode = std::ios::out,
+            const bool in_order = true);
+  bool is_open() const { return mOpen; }
+  void close();
+  void SetThreads(const int threads) { mThreads = std::max(1, threads); }
+
+private:
+  std::filebuf mFileBuf;
+  CompressBuf *mCompress = NULL;
+  bool mOpen = false;
+  int mThreads = 1;
+  std::string mFileName = "";
+  std::string mStagedName = ""; // Uncompressed copy written out of order
+};
+
+/// Reads a compressed file at any offset, decompressing its blocks in
+/// parallel and keeping the most recent. A file without blocks is kept
+/// decompressed as far as it has been read.
+class CompressedBackend : public IOBackend {
+public:
+  CompressedBackend(const Codec codec);
+
+  bool Open(const std::string &fileName);
+  void Close();
+  long Size();
+
+protected:
+  long ReadAt(char *data, const long bytes, const long offset);
+
+private:
+  static const int CACHED_BLOCKS = 32;
+
+  CompressedFile mFile;
+  std::string mFileName = "";
+  std::vector<std::pair<int, std::vector<char>>> mCache; // Oldest first
+  // Without blocks, the stream is held from mWindowStart, as far as it has
+  // been decompressed
+  std::vector<char> mWindow;
+  long mWindowStart = 0;
+  long mStreamSize = -1;
+
+  const char *CachedBlock(const int i);
+};
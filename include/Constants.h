@@ -27,6 +27,7 @@ static const float M_P = 1.6726219E-27;
 static const float GAMMA = 5.0 / 3.0;
 static const float MU = 2.35;
 static const float THETA = 0.57735026919;
+static const float LOMBARDI_ZETA = 1.014;
 
 static const float MSUN_TO_KG = 1.9891E30;
 static const float MSUN_TO_G = 1.9891E33;
@@ -40,6 +41,7 @@ static const float MSOLAU_TO_KGM = 8.88803576E7;
 static const float MSOLPERAU2_TO_GPERCM2 = 8.888035760594663E6;
 static const float MSOLPERAU3_TO_GPERCM3 = 5.94128494E-7;
 static const float GPERCM2_TO_KGPERM2 = 10.0;
+static const float GPERCM3_TO_KGPERM3 = 1000.0;
 static const float KMPERS_TO_MPERS = 1000.0;
 static const float KMPERS_TO_CMPERS = 1E5;
 static const float ERGPERG_TO_JPERKG = 1E-4;
@@ -17,16 +17,29 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <cstdlib>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
 #include <map>
+#include <mutex>
 #include <sstream>
+#include <sys/stat.h>
 #include <thread>
 #include <vector>
 
 #define GAS_TYPE 1
 #define SINK_TYPE -1
-#define DUST_TYPE 2
\ No newline at end of file
+#define DUST_TYPE 2
+
+// Derived particle quantities, computed on demand and tracked per snapshot
+#define DERIVED_THERMO 1 // T, u, P, cs, kappa, sigma, tau, du/dt
+#define DERIVED_TOOMRE 2 // Omega, Q
+#define DERIVED_ENERGY 4 // Energies and angular momentum
+#define DERIVED_BETA 8   // Beta cooling parameter
+#define DERIVED_ALL 15
+// Quantities that depend on positions or the particle and sink sets
+#define DERIVED_MOVED (DERIVED_TOOMRE | DERIVED_ENERGY | DERIVED_BETA)
\ No newline at end of file
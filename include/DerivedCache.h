@@ -0,0 +1,98 @@
+//===-- DerivedCache.h ----------------------------------------------------===//
+//
+//                                  SPARGEL
+//                   Smoothed Particle Generator and Loader
+//
+// This file is distributed under the GNU General Public License. See LICENSE
+// for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// DerivedCache.h keeps the derived quantities of a snapshot in a sidecar
+/// file, named after it with a .derived suffix, so that later runs load them
+/// rather than compute them again. The results of each cached stage are
+/// stored against a hash of the snapshot data the stage reads and overwrites,
+/// seeded with the parameters which change the results, such as the EOS
+/// table, OPACITY_MOD and the cooling method. A stage is therefore only
+/// loaded when it would have computed the same values, whatever ran before
+/// it in this or the earlier run.
+///
+/// The sidecar records the size, modification time and leading and trailing
+/// bytes of the snapshot, and is discarded once these change. It holds the
+/// most recent MAX_ENTRIES results, replaced as a whole when new ones are
+/// stored.
+///
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "BinaryIO.h"
+#include "Definitions.h"
+#include "File.h"
+#include "IOBackend.h"
+#include "Parallel.h"
+#include "Particle.h"
+#include "Pipeline.h"
+
+class DerivedCache {
+public:
+  DerivedCache(const std::string &fileName, const unsigned long config,
+               const std::string &backend = "stream", const int threads = 1);
+  ~DerivedCache();
+
+  /// A hash of bytes, continuing from seed.
+  static unsigned long Hash(const char *data, const long bytes,
+                            unsigned long seed = 0);
+  /// A hash of the whole contents of a file, or 0 if it cannot be read.
+  static unsigned long HashFile(const std::string &fileName);
+
+  /// Loads the results of the stage if stored for the current state of the
+  /// file, and otherwise runs the stage and stores its results.
+  void Run(const Stage &stage, SnapshotFile *file, const int task);
+
+  /// Writes the sidecar if new results were stored.
+  bool Save();
+
+  int GetLoaded() const { return mLoaded; }
+  int GetComputed() const { return mComputed; }
+
+private:
+  static const int MAX_ENTRIES = 8;
+  static const int HASH_BLOCK = 1 << 14; // Particles hashed per task
+
+  struct Entry {
+    std::string name = "";
+    unsigned long state = 0;
+    int writes = 0;
+    int count = 0;
+    long offset = 0; // Columns in the sidecar, or -1 if held in data
+    long bytes = 0;
+    std::vector<char> data;
+  };
+
+  std::string mFileName;
+  std::string mSidecarName;
+  unsigned long mConfig = 0;
+  unsigned long mFileKey = 0;
+  int mThreads = 1;
+  BinaryReader *mBR = NULL;
+  std::vector<Entry> mEntries; // Oldest first
+  bool mModified = false;
+  int mLoaded = 0;
+  int mComputed = 0;
+  std::mutex mMutex;
+
+  unsigned long FileKey();
+  void ReadDirectory();
+  unsigned long StateHash(const Stage &stage, SnapshotFile *file);
+
+  /// Bytes of the columns written by a stage for count particles.
+  static long ColumnBytes(const int writes, const int count);
+  void Pack(const int writes, const std::vector<Particle *> &part,
+            const std::vector<int> &order, std::vector<char> &data);
+  /// Sets the columns on the particles, given in their order before the
+  /// stage, and returns that after it. False if the order is not valid.
+  bool Unpack(const int writes, const std::vector<Particle *> &before,
+              const std::vector<char> &data, std::vector<int> &order);
+};
@@ -16,6 +16,7 @@
 #pragma once
 
 #include "Definitions.h"
+#include "EnclosedMass.h"
 #include "File.h"
 #include "Parameters.h"
 #include "Particle.h"
@@ -28,6 +29,17 @@ public:
 
   void Center(SnapshotFile *file, int sinkIndex, Vec3 posCenter, int densest);
   void FindOuterRadius(SnapshotFile *file);
+  /// Outer radii from the gas mass tabulated against radius.
+  void FindOuterRadius(SnapshotFile *file, const EnclosedMass &table);
+
+  /// Offset to center on a sink or a given position. Returns false if there
+  /// is neither.
+  bool FindOffset(const std::vector<Sink *> &sink, int sinkIndex,
+                  Vec3 posCenter, Vec3 &dX, std::string &appendage);
+  void Shift(const std::vector<Particle *> &part, const Vec3 &dX,
+             const Vec3 &dV);
+  void CenterSinks(SnapshotFile *file, const Vec3 &dX,
+                   const std::string &appendage);
 
 private:
   Parameters *mParams = NULL;
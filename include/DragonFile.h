@@ -28,16 +28,30 @@ public:
   ~DragonFile();
 
   bool Read();
+  bool ReadHeader();
   bool Write(std::string fileName, bool formatted);
 
   void CreateHeader();
 
+  /// Writes a formatted file a column at a time. Each column lists the
+  /// particles, appended in order, and then the sinks, in the order
+  /// positions, velocities, temperatures, smoothing lengths, densities,
+  /// masses, types and ids. Positions and lengths are given in parsecs.
+  bool BeginStream(std::string fileName, const int num_gas);
+  void AppendStreamColumn(const std::vector<double> &values, const int dim);
+  void AppendStreamColumn(const std::vector<int> &values);
+  void WriteStreamSinks(const int column);
+  void EndStream();
+
 private:
   int mIntData[20] = {0};
   float mFloatData[50] = {0};
 
   int mTypeData[8][5] = {};
 
+  bool mStreaming = false;
+
+  void UnpackHeader();
   void AllocateMemory();
 
   bool ReadHeaderForm();
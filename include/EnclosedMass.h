@@ -0,0 +1,51 @@
+//===-- EnclosedMass.h ----------------------------------------------------===//
+//
+//                                  SPARGEL
+//                   Smoothed Particle Generator and Loader
+//
+// This file is distributed under the GNU General Public License. See LICENSE
+// for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// EnclosedMass.h tabulates mass against radius on a fine logarithmic grid, so
+/// that the mass within a radius, and the radius enclosing a mass, can be
+/// found without sorting the particles. This lets snapshots read in chunks
+/// find radius-ordered quantities from a first pass over the particles.
+/// Radii are resolved to within a bin, 1/4096 of a decade, and are
+/// interpolated linearly in mass within it.
+///
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "Definitions.h"
+
+class EnclosedMass {
+public:
+  EnclosedMass();
+  ~EnclosedMass();
+
+  void Add(const float r, const double m);
+  void Merge(const EnclosedMass &other);
+  /// Accumulates the bins, after which the mass and radius can be queried.
+  void Finalise();
+
+  double GetTotal() const { return mCumulative.back(); }
+  double GetInterior(const float r) const;
+  float GetRadius(const double mass) const;
+
+private:
+  static const int BINS_PER_DEX = 4096;
+  const float LOG_MIN = -4.0f;
+  const float LOG_MAX = 6.0f;
+
+  int mBins = 0;
+  std::vector<double> mMass;
+  // Mass within the outer edge of each bin, and of the bin before the first
+  std::vector<double> mCumulative;
+
+  int Bin(const float r) const;
+  float Edge(const int bin) const;
+};
@@ -21,13 +21,15 @@
 #include "Definitions.h"
 #include "File.h"
 #include "Particle.h"
+#include "ShardedAccumulator.h"
 
 class EvolutionAnalyser {
 public:
-  EvolutionAnalyser(NameData nd);
+  EvolutionAnalyser(NameData nd, const int threads = 1);
   ~EvolutionAnalyser();
 
-  void Append(SnapshotFile *file);
+  void Append(SnapshotFile *file, const int task = 0);
+  void Merge();
   bool Write();
 
 private:
@@ -41,6 +43,7 @@ private:
   };
 
   NameData mNameData;
+  ShardedAccumulator<Record> mShards;
   std::vector<Record> mRecords;
   std::ofstream mOutStream;
 };
\ No newline at end of file
@@ -16,6 +16,7 @@
 #pragma once
 
 #include "BinaryIO.h"
+#include "Compression.h"
 #include "Definitions.h"
 #include "Formatter.h"
 #include "Particle.h"
@@ -29,6 +30,38 @@ struct NameData {
   std::string append = "";
 };
 
+/// Particles to keep when reading a snapshot. The readers test positions and
+/// type before reading the remaining columns, and only create particles which
+/// pass. The tests match the radial and midplane cuts.
+struct ReadFilter {
+  float radius = 0.0f;  // Keep r < radius if positive
+  int radial_dim = 3;   // Planar (2) or spherical (3) radius
+  float height = 0.0f;  // Keep |z| <= height if positive
+  int type = 0;         // Keep only this particle type if non-zero
+  float density = 0.0f; // Keep rho >= density if positive
+
+  bool Active() const {
+    return radius > 0.0f || height > 0.0f || type != 0 || density > 0.0f;
+  }
+  bool PassType(const int t) const { return type == 0 || t == type; }
+  bool PassDensity(const float rho) const {
+    return density <= 0.0f || rho >= density;
+  }
+  bool Pass(const Vec3 &x) const {
+    if (radius > 0.0f) {
+      float r = 0.0f;
+      if (radial_dim == 2) {
+        r = x.Norm2();
+      } else if (radial_dim == 3) {
+        r = x.Norm();
+      }
+      if (!(r < radius))
+        return false;
+    }
+    return height <= 0.0f || fabs(x.z) <= height;
+  }
+};
+
 class File {
 public:
   File(){};
@@ -47,8 +80,8 @@ public:
 protected:
   NameData mNameData = {};
 
-  std::ifstream mInStream;
-  std::ofstream mOutStream;
+  InFileStream mInStream;
+  OutFileStream mOutStream;
 
   int mExtraData = 0;
 
@@ -77,6 +110,15 @@ public:
   virtual int GetNumPart() { return mNumTot; }
   virtual bool GetFormatted() { return mFormatted; }
   virtual double GetOuterRadius(const int i) { return mRout[i]; }
+  virtual int GetDerived() { return mDerived; }
+  virtual int GetDimensions() { return 3; }
+  virtual long GetDataOffset() { return mDataOffset; }
+  virtual long GetFileSize() { return mFileSize; }
+
+  /// Reads only the header, setting the particle counts, time and byte
+  /// offsets without creating any particles. Returns false if the format has
+  /// no header or it could not be read.
+  virtual bool ReadHeader() { return false; }
 
   virtual void SetParticles(std::vector<Particle *> particles) {
     mParticles = particles;
@@ -92,6 +134,36 @@ public:
   virtual void SetNumTot(const int i) { mNumTot = i; }
   virtual void SetTime(const double t) { mTime = t; }
   virtual void SetOuterRadius(const double val, const int i) { mRout[i] = val; }
+  virtual void SetDerived(const int fields) { mDerived |= fields; }
+  virtual void SetReadFilter(const ReadFilter &filter) { mFilter = filter; }
+  virtual void SetThreads(const int threads) {
+    mThreads = std::max(1, threads);
+    mInStream.SetThreads(mThreads);
+    mOutStream.SetThreads(mThreads);
+  }
+  virtual void SetIOBackend(const std::string &name) { mIOBackend = name; }
+  virtual void InvalidateDerived(const int fields) { mDerived &= ~fields; }
+
+  /// Drops the particles below the density of the read filter, for readers
+  /// which only learn densities after creating the particles.
+  virtual void ApplyDensityFilter() {
+    if (mFilter.density <= 0.0f)
+      return;
+    std::vector<Particle *> kept;
+    mNumGas = 0;
+    for (int i = 0; i < mParticles.size(); ++i) {
+      if (!mFilter.PassDensity(mParticles[i]->GetD())) {
+        delete mParticles[i];
+        continue;
+      }
+      if (mParticles[i]->GetType() == GAS_TYPE)
+        ++mNumGas;
+      kept.push_back(mParticles[i]);
+    }
+    mNumDust = kept.size() - mNumGas;
+    mNumTot = mNumGas + mNumSink;
+    mParticles = kept;
+  }
 
 protected:
   virtual bool Read(){};
@@ -115,8 +187,8 @@ protected:
   virtual void WriteParticleUnform(){};
   virtual void WriteSinkUnform(){};
 
-  BinaryReader *mBR;
-  BinaryWriter *mBW;
+  BinaryReader *mBR = NULL;
+  BinaryWriter *mBW = NULL;
 
   bool mFormatted = true;
 
@@ -130,4 +202,74 @@ protected:
 
   double mTime = 0.0;
   double mRout[3] = {0.0f, 0.0f, 0.0f};
+
+  // Byte offset of the first particle after the header, and the file size
+  // on disk
+  long mDataOffset = 0;
+  long mFileSize = 0;
+
+  // Derived quantities which are currently valid, see DERIVED_*
+  int mDerived = 0;
+
+  ReadFilter mFilter;
+
+  // Threads sharing the formatting of text output and the compression
+  int mThreads = 1;
+
+  // How binary snapshots are read, see IOBackend::Create
+  std::string mIOBackend = "stream";
+
+  /// Opens mNameData.name for binary reading through mBR, decompressing it
+  /// if compressed.
+  bool OpenReader() {
+    Codec codec = DetectCodec(mNameData.name);
+    IOBackend *backend = (codec == Codec::None)
+                             ? IOBackend::Create(mIOBackend)
+                             : new CompressedBackend(codec);
+    backend->SetThreads(mThreads);
+    if (!backend->Open(mNameData.name)) {
+      delete backend;
+      return false;
+    }
+    mBR = new BinaryReader(backend);
+    return true;
+  }
+
+  void CloseReader() {
+    delete mBR;
+    mBR = NULL;
+  }
+
+  /// Records the current read position as the start of the particle data,
+  /// and the size of the file on disk, or -1 if unknown. For compressed
+  /// files this is the compressed size, as without a block index the
+  /// decompressed size is only known once the whole stream is read.
+  void RecordOffsets() {
+    mDataOffset = (mBR != NULL) ? mBR->Tell() : (long)mInStream.tellg();
+    struct stat info;
+    mFileSize = (stat(mNameData.name.c_str(), &info) == 0) ? info.st_size : -1;
+  }
+
+  /// Creates particles for those which pass the filter, given their
+  /// positions. Indices from num_gas on are dust. If num_gas is negative the
+  /// types are not yet known and are left to the reader. Returns the index of
+  /// each in mParticles, or -1 if it was rejected.
+  std::vector<int> SelectParticles(const std::vector<Vec3> &pos,
+                                   const int num_gas = -1) {
+    std::vector<int> slot(pos.size(), -1);
+    for (int i = 0; i < pos.size(); ++i) {
+      int type = (i < num_gas) ? GAS_TYPE : DUST_TYPE;
+      if (num_gas >= 0 && !mFilter.PassType(type))
+        continue;
+      if (!mFilter.Pass(pos[i]))
+        continue;
+      slot[i] = mParticles.size();
+      Particle *p = new Particle();
+      p->SetX(pos[i]);
+      if (num_gas >= 0)
+        p->SetType(type);
+      mParticles.push_back(p);
+    }
+    return slot;
+  }
 };
@@ -10,35 +10,40 @@
 ///
 /// \file
 /// Formatter.h makes it easy to set the format of output data, mainly for
-/// files.
+/// files. Output is collected by a TextWriter, so nothing else should write
+/// to the stream while a Formatter is in use.
 ///
 //===----------------------------------------------------------------------===//
 
 #pragma once
 
+#include <cstring>
+#include <memory>
+
 #include "Definitions.h"
+#include "Parallel.h"
+#include "TextWriter.h"
 
 class Formatter {
 public:
   Formatter(std::ostream &outStream, int widthFloat, int widthInteger,
             int precision)
-      : mOutStream(outStream), mWidthFloat(widthFloat),
-        mWidthInteger(widthInteger), mPrecision(precision) {}
+      : mWriter(std::make_shared<TextWriter>(outStream)),
+        mWidthFloat(widthFloat), mWidthInteger(widthInteger),
+        mPrecision(precision) {}
 
   Formatter &operator<<(const int &output) {
-    mOutStream << std::setw(mWidthInteger) << output;
+    mWriter->WriteInt(output, mWidthInteger);
     return *this;
   }
 
   Formatter &operator<<(const float &output) {
-    mOutStream << std::setw(mWidthFloat) << std::setprecision(mPrecision)
-               << output;
+    mWriter->WriteFloat(output, mWidthFloat, mPrecision);
     return *this;
   }
 
   Formatter &operator<<(const double &output) {
-    mOutStream << std::setw(mWidthFloat) << std::setprecision(mPrecision)
-               << output;
+    mWriter->WriteFloat(output, mWidthFloat, mPrecision);
     return *this;
   }
 
@@ -49,25 +54,76 @@ public:
     } else {
       boolVal = 'F';
     }
-    mOutStream << boolVal;
+    mWriter->Write(boolVal);
+    return *this;
+  }
+
+  Formatter &operator<<(const char *output) {
+    mWriter->Write(output, strlen(output));
     return *this;
   }
 
-  Formatter &operator<<(std::ostream &(*Func)(std::ostream &)) {
-    Func(mOutStream);
+  Formatter &operator<<(const std::string &output) {
+    mWriter->Write(output);
     return *this;
   }
 
   template <typename T> Formatter &operator<<(const T &output) {
-    mOutStream << output;
+    std::ostringstream stream;
+    stream << output;
+    mWriter->Write(stream.str());
     return *this;
   }
 
   void SetWidthInteger(int width) { mWidthInteger = width; }
 
+  /// Copies share one buffer, which is written out when the last is
+  /// destroyed, or here, e.g. before the stream is closed.
+  void Flush() { mWriter->Flush(); }
+
+  /// A formatter with the same layout which keeps its text, to be added to
+  /// this one by Append.
+  Formatter Fork() const {
+    return Formatter(std::make_shared<TextWriter>(), mWidthFloat,
+                     mWidthInteger, mPrecision);
+  }
+  void Append(Formatter &part) { mWriter->Append(*part.mWriter); }
+
 private:
-  std::ostream &mOutStream;
+  Formatter(std::shared_ptr<TextWriter> writer, int widthFloat,
+            int widthInteger, int precision)
+      : mWriter(writer), mWidthFloat(widthFloat), mWidthInteger(widthInteger),
+        mPrecision(precision) {}
+
+  std::shared_ptr<TextWriter> mWriter;
   int mWidthFloat;
   int mWidthInteger;
   int mPrecision;
 };
+
+/// Calls format(part, start, end) to format [0, n) on the given threads, each
+/// range into its own part, and adds the parts to formatStream in order. The
+/// range is taken in blocks, so only a block's text is held at once.
+template <typename Function>
+void ParallelFormat(Formatter &formatStream, const int n, const int threads,
+                    Function format) {
+  if (threads <= 1) {
+    format(formatStream, 0, n);
+    return;
+  }
+
+  const int BLOCK_PER_THREAD = 1 << 16;
+  std::vector<Formatter> parts;
+  for (int i = 0; i < threads; ++i)
+    parts.push_back(formatStream.Fork());
+
+  int block = BLOCK_PER_THREAD * threads;
+  for (int first = 0; first < n; first += block) {
+    int count = std::min(block, n - first);
+    ParallelFor(count, threads, [&](int start, int end, int task) {
+      format(parts[task], first + start, first + end);
+    });
+    for (int i = 0; i < threads; ++i)
+      formatStream.Append(parts[i]);
+  }
+}
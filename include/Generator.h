@@ -17,10 +17,13 @@
 #pragma once
 
 #include "Definitions.h"
-#include "Octree.h"
+#include "GravityTree.h"
 #include "OpacityTable.h"
 #include "Parameters.h"
 #include "Particle.h"
+#include "Random.h"
+#include "SPHDensity.h"
+#include "SerenFile.h"
 
 class Generator {
 public:
@@ -28,28 +31,39 @@ public:
   ~Generator();
 
   void Create();
+  bool Stream(SerenFile *file, const std::string &fileName);
 
   std::vector<Particle *> GetParticles() { return mParticles; }
   std::vector<Sink *> GetSinks() { return mSinks; }
 
 private:
   void SetupParams();
-  void GenerateRandoms();
+  void GenerateRandoms(const int index, float rands[3]) const;
   void CreateDisc();
+  void CreateDiscParticle(const int i, Particle *p) const;
   void CreateCloud();
+  void CreateCloudParticle(const int i, Particle *p) const;
+  void FindDensity();
 
   void CreateStars();
   void CreatePlanet();
   void CalculateVelocity();
+  void SetSinkVelocities();
+
+  void CreateMassProfile();
+  float EnclosedMass(const float r) const;
+  void SetProfileVelocity(Particle *p) const;
+
+  const int MASS_PROFILE_BINS = 4096;
 
   Parameters *mParams = NULL;
   OpacityTable *mOpacity = NULL;
   std::vector<Particle *> mParticles;
   std::vector<Sink *> mSinks;
-  Octree *mOctree = NULL;
-  OctreePoint *mOctreePoints = NULL;
-
   int mSeed = 0;
+  int mNumThreads = 1;
+  int mDirectGravity = 0;
+  int mChunkSize = 0;
   int mNumHydro = 0;
   int mDim = 0;
 
@@ -73,7 +87,6 @@ private:
   float mStarSmoothing = 0.0;
   float mPlanetSmoothing = 0.0;
 
-  float mRands[3];
   float mOmegaIn = 0.0;
   float mOmegaOut = 0.0;
   float mSigma0 = 0.0;
@@ -87,4 +100,7 @@ private:
   float mCloudRadius = 0.0;
   float mCloudMass = 0.0;
   float mCloudVol = 0.0;
+
+  float mProfileMax = 0.0;
+  std::vector<float> mEnclosedMass;
 };
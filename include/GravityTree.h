@@ -0,0 +1,88 @@
+//===-- GravityTree.h -----------------------------------------------------===//
+//
+//                                  SPARGEL
+//                   Smoothed Particle Generator and Loader
+//
+// This file is distributed under the GNU General Public License. See LICENSE
+// for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// GravityTree.h contains a Barnes-Hut octree for computing gravitational
+/// accelerations and potentials. Leaves hold buckets of points, cells carry
+/// monopole and quadrupole moments and the nodes are stored depth-first with
+/// skip indices so the walk needs no recursion or stack. Subtrees are built on
+/// separate threads and spliced back in depth-first order, so the node layout
+/// does not depend on the number of threads. Positions are in AU and masses in
+/// solar masses, giving accelerations in AU/s^2 and potentials in AU^2/s^2.
+/// DirectGravity sums over every pair exactly, for small N and for checking
+/// the tree.
+///
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "Constants.h"
+#include "Definitions.h"
+#include "Parallel.h"
+#include "Vec.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+struct GravityNode {
+  Vec3 centre = Vec3(0.0, 0.0, 0.0);
+  double half = 0.0;
+  Vec3 com = Vec3(0.0, 0.0, 0.0);
+  double mass = 0.0;
+  double quad[6] = {0.0}; // xx, xy, xz, yy, yz, zz
+  double soft = 0.0;      // Largest softening length of the contained points
+  int first = 0;
+  int count = 0;
+  int next = 0;  // Node following this subtree
+  bool leaf = true;
+};
+
+class GravityTree {
+public:
+  GravityTree(const int leaf_size, const float theta);
+  ~GravityTree();
+
+  void Build(const std::vector<Vec3> &pos, const std::vector<double> &mass,
+             const std::vector<double> &soft, const int threads = 1);
+  void Walk(const Vec3 *pos, const double *soft, const int n, Vec3 *acc,
+            double *pot, const int threads) const;
+  void Acceleration(const Vec3 &pos, const double h, Vec3 &acc,
+                    double &pot) const;
+
+  int GetNumNodes() const { return mNodes.size(); }
+
+private:
+  static const int MAX_DEPTH = 48;
+
+  int mLeafSize = 8;
+  double mTheta2 = 0.25;
+
+  std::vector<GravityNode> mNodes;
+  std::vector<int> mIndex;
+  std::vector<Vec3> mPos;
+  std::vector<double> mMass;
+  std::vector<double> mSoft;
+
+  void BuildNode(std::vector<GravityNode> &nodes, const int first,
+                 const int count, const Vec3 &centre, const double half,
+                 const int depth, const int threads);
+  void LeafMoments(GravityNode &node);
+  void CellMoments(std::vector<GravityNode> &nodes, const int index);
+};
+
+/// Accelerations and potentials of the first num_targets points due to all
+/// points, summed directly. Each target is summed in a fixed order so the
+/// result does not depend on the number of threads. Softening lengths of the
+/// targets must be non-zero.
+void DirectGravity(const std::vector<Vec3> &pos,
+                   const std::vector<double> &mass,
+                   const std::vector<double> &soft, const int num_targets,
+                   Vec3 *acc, double *pot, const int threads);
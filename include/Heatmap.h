@@ -10,31 +10,56 @@
 ///
 /// \file
 /// Heatmap.h allows the output of heatmap data based on a given quantity.
-/// Multiple grid resolutions can be used to fill in gaps of particle sparse
-/// areas.
+/// Particles are projected onto the x-y plane with the column-integrated SPH
+/// kernel, giving surface density or a mass-weighted average of temperature,
+/// optical depth or Toomre Q. The grid is split into square tiles and each
+/// thread renders whole tiles, so no two threads write the same cell.
+/// Particles are visited in index order within a tile, so the map does not
+/// depend on the number of threads. Particles may be added in several sets,
+/// e.g. the chunks of a streamed snapshot.
 ///
 //===----------------------------------------------------------------------===//
 
 #pragma once
 
+#include "Constants.h"
 #include "Definitions.h"
 #include "File.h"
+#include "Kernel.h"
+#include "Parallel.h"
 #include "Particle.h"
 
 class Heatmap {
 public:
-  Heatmap(const int res);
+  Heatmap(const int res, const std::string &quantity = "tau",
+          const int threads = 1);
   ~Heatmap();
 
   void Create(SnapshotFile *file);
   void Output();
 
+  /// Creates the map in parts. Begin takes the grid size from the file's
+  /// outer radius, then Add projects each set of particles onto it.
+  void Begin(SnapshotFile *file);
+  void Add(const std::vector<Particle *> &part);
+  void End();
+
 private:
+  static const int TILE_SIZE = 64;
+  static const int COLUMN_TABLE_SIZE = 1024;
+
   std::string mFileName;
+  std::string mQuantity;
   int mRes = 0;
+  int mThreads = 1;
+  float mRout = 0.0f;
+  double mPix = 0.0;
   std::vector<std::vector<float>> mGrid;
-  std::vector<std::vector<int>> mGridNum;
+  std::vector<double> mWeighted;
+  std::vector<double> mWeight;
+  std::vector<double> mColumnTable;
 
-  int Bin(float d, float x);
-  float AverageNeighbours(const int x, const float y);
-};
\ No newline at end of file
+  void CreateColumnTable();
+  double ColumnKernel(const double q) const;
+  float Value(Particle *p) const;
+};
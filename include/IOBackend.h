@@ -0,0 +1,74 @@
+//===-- IOBackend.h -------------------------------------------------------===//
+//
+//                                  SPARGEL
+//                   Smoothed Particle Generator and Loader
+//
+// This file is distributed under the GNU General Public License. See LICENSE
+// for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// IOBackend.h contains the interchangeable ways binary snapshots are read.
+/// Every read names its byte offset, so a backend keeps no file position and
+/// several columns can be requested at once. "stream" reads through an
+/// ifstream, "pread" uses positional reads with sequential readahead advice,
+/// "mmap" copies from a mapping of the whole file and, when built with
+/// SPARGEL_IO_URING, "uring" queues a batch of reads on io_uring. Compressed
+/// files are read through CompressedBackend instead. The bytes read and the
+/// time taken are totalled per backend for Report.
+///
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "Definitions.h"
+
+struct IORequest {
+  char *data = NULL;
+  long bytes = 0;
+  long offset = 0;
+};
+
+class IOBackend {
+public:
+  virtual ~IOBackend() {}
+
+  /// The backend of the given name, or the stream backend if it is unknown
+  /// or not built.
+  static IOBackend *Create(const std::string &name);
+  /// Prints the bytes read and the throughput of each backend used.
+  static void Report();
+
+  virtual bool Open(const std::string &fileName) = 0;
+  virtual void Close() = 0;
+  virtual long Size() = 0;
+  const std::string &GetName() const { return mName; }
+  void SetThreads(const int threads) { mThreads = std::max(1, threads); }
+
+  /// Reads up to bytes at offset into data, returning the number read.
+  long Read(char *data, const long bytes, const long offset);
+  /// Reads every request, which may be served in any order.
+  void ReadBatch(std::vector<IORequest> &requests);
+
+protected:
+  IOBackend(const std::string &name, const int index)
+      : mName(name), mIndex(index) {}
+
+  // Threads available to the backend, e.g. for decompression
+  int mThreads = 1;
+
+  virtual long ReadAt(char *data, const long bytes, const long offset) = 0;
+  virtual void ReadRequests(std::vector<IORequest> &requests);
+
+private:
+  static const int NUM_BACKENDS = 6;
+  static const char *NAMES[NUM_BACKENDS];
+  static std::atomic<long> sBytes[NUM_BACKENDS];
+  static std::atomic<long> sNanoseconds[NUM_BACKENDS];
+
+  std::string mName;
+  int mIndex = 0;
+
+  void Count(const long bytes, const long nanoseconds);
+};
@@ -0,0 +1,47 @@
+//===-- Kernel.h ----------------------------------------------------------===//
+//
+//                                  SPARGEL
+//                   Smoothed Particle Generator and Loader
+//
+// This file is distributed under the GNU General Public License. See LICENSE
+// for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Kernel.h contains the M4 cubic spline SPH kernel in three dimensions, with
+/// compact support at r = 2h. The smoothing length is related to the number
+/// of neighbours by (4/3) PI (2h)^3 rho = N_NEIGH m, the same relation used
+/// when initial conditions are generated.
+///
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "Constants.h"
+#include "Definitions.h"
+
+#define KERNEL_SUPPORT 2.0
+
+/// Dimensionless kernel f(q), where W(r, h) = f(r/h) / (PI h^3).
+inline double KernelW(const double q) {
+  if (q < 1.0)
+    return 1.0 - 1.5 * q * q + 0.75 * q * q * q;
+  if (q < 2.0)
+    return 0.25 * (2.0 - q) * (2.0 - q) * (2.0 - q);
+  return 0.0;
+}
+
+/// Derivative df/dq of the dimensionless kernel.
+inline double KernelDW(const double q) {
+  if (q < 1.0)
+    return -3.0 * q + 2.25 * q * q;
+  if (q < 2.0)
+    return -0.75 * (2.0 - q) * (2.0 - q);
+  return 0.0;
+}
+
+/// Smoothing length holding num_neigh neighbours of mass m at density rho.
+inline double KernelH(const double m, const double rho, const int num_neigh) {
+  return pow((3.0 * num_neigh * m) / (32.0 * PI * rho), 1.0 / 3.0);
+}
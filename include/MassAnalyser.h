@@ -19,6 +19,7 @@
 #include "Definitions.h"
 #include "File.h"
 #include "Particle.h"
+#include "ShardedAccumulator.h"
 
 struct MassComponent {
   float time = 0.0;
@@ -34,16 +35,30 @@ struct MassComponent {
   int sink_num = 0;
 };
 
+/// Sums over the particles, which may be gathered over several sets.
+struct MassTally {
+  MassComponent mc;
+  long num = 0;
+  float max_dens = 0.0f;
+  float sink_mass[3] = {0.0, 0.0, 0.0}; // Mass near the companion
+  float sink_n[3] = {0.0, 0.0, 0.0};
+};
+
 class MassAnalyser {
 public:
-  MassAnalyser();
+  MassAnalyser(const int threads = 1);
   ~MassAnalyser();
 
-  void ExtractValues(SnapshotFile *file);
+  void ExtractValues(SnapshotFile *file, const int task = 0);
+  void Tally(MassTally &tally, const std::vector<Particle *> &part,
+             const std::vector<Sink *> &sinks) const;
+  void Report(SnapshotFile *file, MassTally &tally, const int task = 0);
+  void Merge();
   void CalculateAccretionRate();
   bool Write();
 
 private:
+  ShardedAccumulator<MassComponent> mShards;
   std::vector<MassComponent> mMasses;
   std::ofstream mOutStream;
   float rout_percs[3] = {0.9, 0.95, 0.99};
@@ -0,0 +1,54 @@
+//===-- NeighbourTree.h ---------------------------------------------------===//
+//
+//                                  SPARGEL
+//                   Smoothed Particle Generator and Loader
+//
+// This file is distributed under the GNU General Public License. See LICENSE
+// for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// NeighbourTree.h contains a kd-tree for finding all points within a given
+/// radius. Cells are split at the median along their longest axis, leaves
+/// hold small buckets of points and every node carries a tight bounding box.
+/// Queries only read the tree, so any number of threads can search at once.
+///
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "Definitions.h"
+#include "Vec.h"
+
+struct NeighbourNode {
+  Vec3 min = Vec3(0.0, 0.0, 0.0);
+  Vec3 max = Vec3(0.0, 0.0, 0.0);
+  int first = 0;
+  int count = 0;
+  int left = -1;
+  int right = -1;
+};
+
+class NeighbourTree {
+public:
+  NeighbourTree(const int leaf_size = 8);
+  ~NeighbourTree();
+
+  void Build(const std::vector<Vec3> &pos);
+  void FindNeighbours(const Vec3 &pos, const double radius,
+                      std::vector<int> &neighbours) const;
+
+  const Vec3 &GetPosition(const int i) const { return mPos[i]; }
+
+private:
+  static const int MAX_DEPTH = 64;
+
+  int mLeafSize = 8;
+
+  std::vector<NeighbourNode> mNodes;
+  std::vector<int> mIndex;
+  std::vector<Vec3> mPos;
+
+  int BuildNode(const int first, const int count, const int depth);
+};
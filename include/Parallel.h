@@ -0,0 +1,47 @@
+//===-- Parallel.h --------------------------------------------------------===//
+//
+//                                  SPARGEL
+//                   Smoothed Particle Generator and Loader
+//
+// This file is distributed under the GNU General Public License. See LICENSE
+// for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Parallel.h contains a simple parallel loop over a range of particles. The
+/// range is split into contiguous batches in the same way as files are split
+/// between threads in Application::Run, so the batch a given index falls into
+/// depends only on the range size and the number of threads.
+///
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "Definitions.h"
+
+/// Calls func(start, end, task) for each batch of [0, n) on its own thread.
+template <typename Function>
+void ParallelFor(const int n, int threads, Function func) {
+  if (threads > n)
+    threads = n;
+  if (threads <= 1) {
+    func(0, n, 0);
+    return;
+  }
+
+  int per_thread = n / threads;
+  int remainder = n % threads;
+  std::vector<std::thread> pool;
+
+  int pos = 0;
+  for (int i = 0; i < threads; ++i) {
+    int start = pos;
+    int end = pos + per_thread + ((i < remainder) ? 1 : 0);
+    pos = end;
+    pool.push_back(std::thread(func, start, end, i));
+  }
+  for (int i = 0; i < pool.size(); ++i) {
+    pool[i].join();
+  }
+}
@@ -27,6 +27,7 @@ public:
   int GetID() { return mID; }
   Vec3 GetX() { return mX; }
   Vec3 GetV() { return mV; }
+  Vec3 GetA() { return mA; }
   float GetR() { return mR; }
   float GetS() { return mS; }
   float GetT() { return mT; }
@@ -44,6 +45,7 @@ public:
   float GetDUDT() { return mDUDT; }
   float GetBeta() { return mBeta; }
   double GetEnergy(const int i) { return mEnergy[i]; }
+  double GetPhi() { return mPhi; }
   int GetType() { return mType; }
   float GetExtra(int index) { return mExtra[index]; }
 
@@ -51,6 +53,7 @@ public:
   void SetX(Vec3 x) { mX = x; }
   void SetR(float r) { mR = r; }
   void SetV(Vec3 v) { mV = v; }
+  void SetA(Vec3 a) { mA = a; }
   void SetT(float T) { mT = T; }
   void SetH(float H) { mH = H; }
   void SetD(float D) { mD = D; }
@@ -66,6 +69,7 @@ public:
   void SetDUDT(float dudt) { mDUDT = dudt; }
   void SetBeta(float beta) { mBeta = beta; }
   void SetEnergy(const double e, const int i) { mEnergy[i] = e; }
+  void SetPhi(const double phi) { mPhi = phi; }
   void SetType(int type) { mType = type; }
   void SetExtra(int index, float value) { mExtra[index] = value; }
 
@@ -73,6 +77,7 @@ private:
   int mID = 0;
   Vec3 mX = Vec3(0.0, 0.0, 0.0);
   Vec3 mV = Vec3(0.0, 0.0, 0.0);
+  Vec3 mA = Vec3(0.0, 0.0, 0.0);
   float mR = 0.0;
   float mS = 0.0;
   float mT = 0.0;
@@ -92,6 +97,7 @@ private:
   float mDUDT = 0.0;
   float mBeta = 0.0;
   double mEnergy[4] = {0.0, 0.0, 0.0, 0.0};
+  double mPhi = 0.0;
   int mType = 1;
   float mExtra[EXTRA_DATA] = {0.0};
 };
@@ -0,0 +1,71 @@
+//===-- ParticleCut.h -----------------------------------------------------===//
+//
+//                                  SPARGEL
+//                   Smoothed Particle Generator and Loader
+//
+// This file is distributed under the GNU General Public License. See LICENSE
+// for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// ParticleCut.h removes particles failing any of the radial, Hill radius and
+/// midplane cuts in a single pass. Each thread tests and compacts its own
+/// batch in place, then the batches are joined in order, so survivors keep
+/// their order whatever the number of threads. Rejected particles are
+/// deleted. The Hill cut measures distances from the planet rather than
+/// moving the particles into its frame and back.
+///
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "Definitions.h"
+#include "Parallel.h"
+#include "Particle.h"
+#include "Vec.h"
+
+#define CUT_RADIAL 0
+#define CUT_HILL 1
+#define CUT_MIDPLANE 2
+
+class ParticleCut {
+public:
+  ParticleCut(const int threads = 1);
+  ~ParticleCut();
+
+  /// Keeps particles within dist, in the plane (dim 2) or in 3D (dim 3).
+  void SetRadial(const float dist, const int dim);
+  /// Keeps particles further than radius from the centre.
+  void SetHill(const Vec3 &centre, const float radius);
+  /// Keeps particles with |z| no more than height.
+  void SetMidplane(const float height);
+
+  bool PassRadial(const Vec3 &x) const;
+
+  void Apply(std::vector<Particle *> &part);
+
+  /// Particles removed by each cut, counting each against the first it fails.
+  long GetRejected(const int cut) const { return mRejected[cut]; }
+  /// Number of particles which passed the radial cut.
+  long GetRadialCount() const { return mRadialCount; }
+  /// Velocity of the densest particle passing the radial cut, which the
+  /// survivors are moved into the frame of.
+  Vec3 GetFrameVelocity() const { return mFrameVelocity; }
+
+private:
+  int mThreads = 1;
+
+  bool mRadial = false;
+  float mRadialDist = 0.0f;
+  int mRadialDim = 3;
+  bool mHill = false;
+  Vec3 mHillCentre = {0.0, 0.0, 0.0};
+  float mHillRadius = 0.0f;
+  bool mMidplane = false;
+  float mMidplaneHeight = 0.0f;
+
+  long mRejected[3] = {0, 0, 0};
+  long mRadialCount = 0;
+  Vec3 mFrameVelocity = {0.0, 0.0, 0.0};
+};
@@ -0,0 +1,78 @@
+//===-- Pipeline.h --------------------------------------------------------===//
+//
+//                                  SPARGEL
+//                   Smoothed Particle Generator and Loader
+//
+// This file is distributed under the GNU General Public License. See LICENSE
+// for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Pipeline.h describes the analysis of a snapshot as a list of stages, each
+/// declaring the snapshot data it reads and writes. Stages which provide the
+/// derived quantities (DERIVED_*) are inserted before the first stage needing
+/// them, and again after anything invalidates them. Adjacent per-particle
+/// stages are fused into a single pass, and consecutive stages which do not
+/// conflict run concurrently.
+///
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "Definitions.h"
+#include "File.h"
+#include "Parallel.h"
+#include "Particle.h"
+
+// Snapshot data a stage may read or write, alongside the DERIVED_* bits
+#define STAGE_POSITION 16   // Particle and sink positions and velocities
+#define STAGE_PARTICLES 32  // Particle set and masses
+#define STAGE_SINKS 64      // Sink set and sink properties
+#define STAGE_DENSITY 128   // Densities and smoothing lengths
+#define STAGE_GRAVITY 256   // Accelerations and potentials
+#define STAGE_HEADER 512    // Name data, time and outer radii
+#define STAGE_CONSOLE 1024  // Screen output, kept in order
+#define STAGE_ORDER 2048    // Particle order only, e.g. a sort by radius
+
+class DerivedCache;
+
+struct Stage {
+  std::string name = "";
+  int reads = 0;
+  int writes = 0;
+  // Derived quantities this stage computes. It is skipped if they are valid.
+  int provides = 0;
+  // Whether its results may be stored in and loaded from a DerivedCache
+  bool cached = false;
+  // Either a whole-snapshot function, or a per-particle kernel which may be
+  // fused with its neighbours.
+  std::function<void(SnapshotFile *, int)> run;
+  std::function<void(Particle *)> kernel;
+};
+
+class Pipeline {
+public:
+  /// The provider returns the stages computing the requested derived
+  /// quantities, given those which are already valid.
+  Pipeline(std::function<std::vector<Stage>(int, int)> provider,
+           const int threads = 1);
+  ~Pipeline();
+
+  void Add(Stage stage);
+  void Build();
+  /// Runs the stages on a snapshot, through the cache if one is given.
+  void Run(SnapshotFile *file, const int task, DerivedCache *cache = NULL);
+
+  std::string Describe() const;
+
+private:
+  std::function<std::vector<Stage>(int, int)> mProvider;
+  int mThreads = 1;
+  int mValid = 0;
+  std::vector<Stage> mStages;
+  std::vector<std::vector<Stage>> mWaves;
+
+  void Append(const Stage &stage);
+  Stage Fuse(const std::vector<Stage> &kernels) const;
+};
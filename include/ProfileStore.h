@@ -0,0 +1,64 @@
+//===-- ProfileStore.h ----------------------------------------------------===//
+//
+//                                  SPARGEL
+//                   Smoothed Particle Generator and Loader
+//
+// This file is distributed under the GNU General Public License. See LICENSE
+// for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// ProfileStore.h collects the radial profiles of every snapshot in a run into
+/// a single file. Each thread appends fixed-size records to its own segment
+/// file, so no locks are needed, and Write merges the segments in time order.
+/// The merged file starts with the 16 character format ID, the ints (radial
+/// bins, quantities, records, log), the floats (inner radius, bin width) and
+/// the long offsets of the index, count and cube sections. The bin radii
+/// follow, then the index of (double time, 16 character snapshot) entries,
+/// the long particle counts (record x bin) and the float cube (record x bin x
+/// quantity), which can be mapped directly.
+///
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "Constants.h"
+#include "Definitions.h"
+#include "File.h"
+#include "RadialProfile.h"
+
+class ProfileStore {
+public:
+  ProfileStore(NameData nd, const int bins, const float in, const float width,
+               const int log, const int threads);
+  ~ProfileStore();
+
+  void Append(const int task, SnapshotFile *file,
+              const RadialProfile &profile);
+  bool Write();
+
+private:
+  static const int STRING_LENGTH = 16;
+  const std::string FORMAT = "SPARGELSTORE1";
+
+  struct Entry {
+    double time = 0.0;
+    std::string snap;
+    int task = 0;
+    int index = 0;
+  };
+
+  NameData mNameData;
+  std::string mFileName;
+  int mBins = 0;
+  float mIn = 0.0f;
+  float mWidth = 0.0f;
+  int mLog = 0;
+
+  std::vector<std::ofstream *> mSegments;
+  std::vector<std::vector<Entry>> mEntries;
+
+  std::string SegmentName(const int task);
+  long RecordSize();
+};
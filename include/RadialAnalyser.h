@@ -14,24 +14,47 @@
 /// for example to analyse the region around the central object or a formed
 /// sink or a particle at the center of a dense clump.
 ///
+/// With RADIAL_OUTPUT = binary, each snapshot is written as one .profile file
+/// instead of a text table plus a file per vertical column. The file starts
+/// with the 16 character format ID, the ints (radial bins, vertical bins,
+/// quantities, spherical, log, sections), the floats (inner radius, bin
+/// width, first vertical mid, vertical bin height) and the double time. An
+/// index of (16 character name, long offset, long bytes) entries follows for
+/// the radius, radial_num, radial, vertical_num and vertical sections. With
+/// RADIAL_OUTPUT = store, radial profiles only go to the run's ProfileStore.
+///
 //===----------------------------------------------------------------------===//
 
 #pragma once
 
 #include "Definitions.h"
 #include "File.h"
+#include "Parallel.h"
 #include "Parameters.h"
-#include "RadialBin.h"
-#include "VerticalBin.h"
+#include "ProfileStore.h"
+#include "RadialProfile.h"
 
 class RadialAnalyser {
 public:
   RadialAnalyser(Parameters *params);
   ~RadialAnalyser();
 
-  void Run(SnapshotFile *file);
+  void Run(SnapshotFile *file, ProfileStore *store = NULL,
+           const int task = 0);
+
+  /// Run in parts, for particles which are not all held at once. Output
+  /// finalises the profile and writes it for the file.
+  RadialProfile CreateProfile() const;
+  void Accumulate(RadialProfile &profile,
+                  const std::vector<Particle *> &part) const;
+  void Output(SnapshotFile *file, RadialProfile &profile,
+              ProfileStore *store = NULL, const int task = 0);
 
 private:
+  const int RADIAL_COLUMNS = 32;
+  const int PROFILE_STRING_LENGTH = 16;
+  const std::string PROFILE_FORMAT = "SPARGELPROFILE1";
+
   Parameters *mParams = NULL;
 
   int mSpherical = 0.0;
@@ -41,8 +64,10 @@ private:
   int mLog = 0;
   int mVert = 0;
   float mWidth = 0.0f;
+  int mThreads = 1;
+  bool mBinaryOutput = false;
+  bool mStoreOutput = false;
 
-  std::vector<RadialBin *> mRadialBins;
-
-  int GetBinID(float r);
+  void OutputBinary(const RadialProfile &profile,
+                    const std::string &outputName, const double time);
 };
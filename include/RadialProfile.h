@@ -0,0 +1,86 @@
+//===-- RadialProfile.h ---------------------------------------------------===//
+//
+//                                  SPARGEL
+//                   Smoothed Particle Generator and Loader
+//
+// This file is distributed under the GNU General Public License. See LICENSE
+// for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// RadialProfile.h accumulates radial and vertical profiles in a single pass
+/// over the particles. Bin indices are found arithmetically and quantities are
+/// summed into flat (R) and (R, z) arrays, so no particles are stored and the
+/// cost does not depend on the number of bins. One profile is filled per
+/// thread and the profiles are merged in thread order before averaging. The
+/// radial quantity indices are as thus:
+/// 0 : Density
+/// 1 : Temperature
+/// 2 : Smoothing length
+/// 3 : Speed
+/// 4 : Toomre parameter
+/// 5 : Pressure
+/// 6 : Optical depth
+/// 7 : Surface density
+/// 8 : Cooling rate
+/// 9 : Sound speed
+/// 10 : Angular velocity
+/// 11 : Cumulative mass
+/// 12 : Beta cooling parameter
+/// 13 : Specific internal energy
+/// 14 : Radial velocity
+/// 15 : Planar speed
+/// 16 - 19 : Cumulative energies
+/// 19 - 22 : Extra data, the first sharing index 19 with the last energy
+///
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "Constants.h"
+#include "Definitions.h"
+#include "Particle.h"
+
+class RadialProfile {
+public:
+  RadialProfile(const int bins, const float in, const float width,
+                const int vert_bins, const float height_lo,
+                const float height_width);
+  ~RadialProfile();
+
+  void Add(Particle *p, float r);
+  void Merge(const RadialProfile &other);
+  void Finalise();
+
+  int GetNumBins() const { return mBins; }
+  int GetNumVerticalBins() const { return mVertBins; }
+  float GetMid(const int r) const { return mIn + (r + 0.5f) * mWidth; }
+  float GetVerticalMid(const int z) const {
+    return mHeightLo + (z + 0.5f) * mHeightWidth;
+  }
+
+  long GetNumParticles(const int r) const { return mNum[r]; }
+  double GetAverage(const int r, const int q) const {
+    return mSum[r * TOT_RAD_QUAN + q];
+  }
+  long GetNumParticles(const int r, const int z) const {
+    return mVertNum[r * mVertBins + z];
+  }
+  double GetAverage(const int r, const int z, const int q) const {
+    return mVertSum[(r * mVertBins + z) * TOT_RAD_QUAN + q];
+  }
+
+private:
+  int mBins = 0;
+  float mIn = 0.0f;
+  float mWidth = 0.0f;
+  int mVertBins = 0;
+  float mHeightLo = 0.0f;
+  float mHeightWidth = 0.0f;
+
+  std::vector<long> mNum;
+  std::vector<double> mSum;
+  std::vector<long> mVertNum;
+  std::vector<double> mVertSum;
+};
@@ -0,0 +1,82 @@
+//===-- Random.h ----------------------------------------------------------===//
+//
+//                                  SPARGEL
+//                   Smoothed Particle Generator and Loader
+//
+// This file is distributed under the GNU General Public License. See LICENSE
+// for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Random.h contains a Philox4x32-10 counter-based random number generator.
+/// Each call maps a (seed, stream, index) triple to four independent 32-bit
+/// values without any shared state, so particle i gets the same numbers
+/// whichever thread it is generated on and in whatever order.
+///
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include <cstdint>
+
+#include "Definitions.h"
+
+// Independent streams for each use of the generator.
+#define RANDOM_STREAM_GENERATE 0
+#define RANDOM_STREAM_REDUCE 1
+
+class Random {
+public:
+  Random(const uint64_t seed, const uint32_t stream = RANDOM_STREAM_GENERATE)
+      : mKey0((uint32_t)seed), mKey1((uint32_t)(seed >> 32)),
+        mStream(stream) {}
+
+  /// Four random 32-bit integers for the given counter.
+  void Generate(const uint64_t index, uint32_t out[4]) const {
+    uint32_t ctr[4] = {(uint32_t)index, (uint32_t)(index >> 32), mStream, 0};
+    uint32_t k0 = mKey0;
+    uint32_t k1 = mKey1;
+
+    for (int round = 0; round < 10; ++round) {
+      uint64_t p0 = (uint64_t)PHILOX_M0 * ctr[0];
+      uint64_t p1 = (uint64_t)PHILOX_M1 * ctr[2];
+      uint32_t c0 = (uint32_t)(p1 >> 32) ^ ctr[1] ^ k0;
+      uint32_t c2 = (uint32_t)(p0 >> 32) ^ ctr[3] ^ k1;
+      ctr[0] = c0;
+      ctr[1] = (uint32_t)p1;
+      ctr[2] = c2;
+      ctr[3] = (uint32_t)p0;
+      k0 += PHILOX_W0;
+      k1 += PHILOX_W1;
+    }
+
+    for (int i = 0; i < 4; ++i)
+      out[i] = ctr[i];
+  }
+
+  /// Up to four uniform floats in [0, 1) for the given counter.
+  void Uniform(const uint64_t index, float *out, const int n) const {
+    uint32_t bits[4];
+    Generate(index, bits);
+    for (int i = 0; i < n && i < 4; ++i)
+      out[i] = (bits[i] >> 8) * (1.0f / 16777216.0f);
+  }
+
+  /// A uniform integer in [0, range) for the given counter.
+  uint32_t Integer(const uint64_t index, const uint32_t range) const {
+    uint32_t bits[4];
+    Generate(index, bits);
+    return (uint32_t)(((uint64_t)bits[0] * range) >> 32);
+  }
+
+private:
+  static const uint32_t PHILOX_M0 = 0xD2511F53;
+  static const uint32_t PHILOX_M1 = 0xCD9E8D57;
+  static const uint32_t PHILOX_W0 = 0x9E3779B9;
+  static const uint32_t PHILOX_W1 = 0xBB67AE85;
+
+  uint32_t mKey0 = 0;
+  uint32_t mKey1 = 0;
+  uint32_t mStream = 0;
+};
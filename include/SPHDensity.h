@@ -0,0 +1,32 @@
+//===-- SPHDensity.h ------------------------------------------------------===//
+//
+//                                  SPARGEL
+//                   Smoothed Particle Generator and Loader
+//
+// This file is distributed under the GNU General Public License. See LICENSE
+// for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// SPHDensity.h contains the solver for self-consistent smoothing lengths and
+/// densities. For each particle h is iterated with Newton-Raphson, falling
+/// back to bisection, until the kernel-summed density matches the density
+/// that puts num_neigh neighbours inside 2h. Neighbours come from a kd-tree
+/// and particles are solved independently, so the result does not depend on
+/// the number of threads.
+///
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "Definitions.h"
+#include "Kernel.h"
+#include "NeighbourTree.h"
+#include "Parallel.h"
+#include "Particle.h"
+
+/// Sets h (AU) and rho (g/cm^3) of every particle. Existing smoothing lengths
+/// are used as the first guess when they are set.
+void FindSPHDensity(std::vector<Particle *> &part, const int num_neigh,
+                    const int threads);
@@ -30,11 +30,46 @@ public:
   ~SerenFile();
 
   bool Read();
+  bool ReadHeader();
   bool Write(std::string fileName, bool formatted);
   void FindTemperatures(OpacityTable *op);
+  int GetDimensions() { return mPosDim; }
 
   void CreateHeader();
 
+  /// Opens fileName for WriteStreamChunk, or for the Append functions if
+  /// in_order, which lets a compressed file be written without staging.
+  bool BeginStream(std::string fileName, const int num_gas,
+                   const double hydro_mass, const bool formatted = false,
+                   const bool in_order = false);
+  void WriteStreamChunk(const std::vector<Particle *> &chunk, const int first);
+  /// Appends values to the file in order, so whole columns are written one
+  /// after another, as ids, r, m, h, v, rho and u. Vectors have dim
+  /// components per particle.
+  void AppendStreamIDs(const std::vector<int> &ids);
+  void AppendStreamColumn(const std::vector<double> &values, const int dim);
+  void EndStream();
+
+  /// Reads an unformatted file a range of particles at a time. OpenChunks
+  /// reads the header and the sinks, then each ReadChunk replaces the
+  /// particles in chunk with count particles from index first. Without
+  /// all_columns only positions and masses are read.
+  bool OpenChunks();
+  void ReadChunk(std::vector<Particle *> &chunk, const int first,
+                 const int count, const bool all_columns);
+  void CloseChunks();
+
+  /// Reads count values of a column, numbered in file order from the ids at
+  /// 0, from index first. Positions and velocities are given three
+  /// components per particle, whatever the file's dimensions.
+  void ReadColumn(const int column, const int first, const int count,
+                  std::vector<double> &values);
+  /// Reads the same range of several columns, requesting them from the
+  /// backend together.
+  void ReadColumns(const std::vector<int> &columns, const int first,
+                   const int count, std::vector<std::vector<double>> &values);
+  void ReadIDs(const int first, const int count, std::vector<int> &ids);
+
 private:
   const int STRING_LENGTH = 20;
   const std::string ASCII_FORMAT = "SERENASCIIDUMPV2";
@@ -54,6 +89,10 @@ private:
 
   int mSinkDataLength = 0;
 
+  bool mStreaming = false;
+  double mStreamMass = 0.0;
+  std::streampos mStreamStart = 0;
+
   std::vector<std::string> mUnitData;
   std::vector<std::string> mDataID;
   int mNumUnit = 0;
@@ -62,6 +101,7 @@ private:
   int mTypeData[8][5] = {};
   int mUnknownValues[50] = {};
 
+  void UnpackHeader();
   void AllocateMemory();
 
   bool ReadHeaderForm();
@@ -71,6 +111,7 @@ private:
   bool ReadHeaderUnform();
   void ReadParticleUnform();
   void ReadSinkUnform();
+  void CountSelected(const std::vector<int> &slot);
 
   void WriteHeaderForm(Formatter formatStream);
   void WriteParticleForm(Formatter formatStream);
@@ -79,4 +120,11 @@ private:
   void WriteHeaderUnform();
   void WriteParticleUnform();
   void WriteSinkUnform();
+
+  void PackIDs(const std::vector<Particle *> &part, std::vector<int> &ids);
+  void PackColumn(const std::vector<Particle *> &part, const int column,
+                  std::vector<double> &values);
+  void PackSinkData();
+  void UnpackSinkData();
+  std::streampos StreamColumnOffset(const int column, const int first);
 };
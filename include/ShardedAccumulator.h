@@ -0,0 +1,45 @@
+//===-- ShardedAccumulator.h ----------------------------------------------===//
+//
+//                                  SPARGEL
+//                   Smoothed Particle Generator and Loader
+//
+// This file is distributed under the GNU General Public License. See LICENSE
+// for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// ShardedAccumulator.h collects records from several threads without locks.
+/// Each thread appends only to its own shard, and once the threads have
+/// joined the shards are merged and stably sorted, so the result is the same
+/// for any number of threads.
+///
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "Definitions.h"
+
+template <typename T> class ShardedAccumulator {
+public:
+  ShardedAccumulator(const int shards = 1)
+      : mShards(std::max(1, shards)) {}
+
+  /// Only the thread that owns the shard may call this.
+  void Add(const int shard, const T &value) {
+    mShards[shard].push_back(value);
+  }
+
+  /// Concatenates the shards in order and sorts them. Not thread safe.
+  template <typename Compare> std::vector<T> Merge(Compare compare) const {
+    std::vector<T> merged;
+    for (int i = 0; i < mShards.size(); ++i) {
+      merged.insert(merged.end(), mShards[i].begin(), mShards[i].end());
+    }
+    std::stable_sort(merged.begin(), merged.end(), compare);
+    return merged;
+  }
+
+private:
+  std::vector<std::vector<T>> mShards;
+};
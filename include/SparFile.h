@@ -0,0 +1,86 @@
+//===-- SparFile.h --------------------------------------------------------===//
+//
+//                                  SPARGEL
+//                   Smoothed Particle Generator and Loader
+//
+// This file is distributed under the GNU General Public License. See LICENSE
+// for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// SparFile.h contains the functions to read and write snapshots in SParGeL's
+/// own binary format, meant for analysis copies. Particles are sorted along a
+/// Morton curve, gas before dust, so neighbours in space are neighbours in
+/// the file, and stored in chunks of a fixed number of particles. Each chunk
+/// holds its particles column by column and an index at the end of the file
+/// records where each chunk starts, its bounding box and the range of every
+/// field. A reader given a ReadFilter skips any chunk the filter rejects as a
+/// whole, without reading it.
+///
+/// The file holds a header with the counts, time and sinks, then the chunks,
+/// each with the columns id, type, x, v, m, h, rho, u and any extra data,
+/// then the index and a trailer giving the index position. Positions and
+/// velocities keep double precision and the remaining fields single, as the
+/// particles hold them.
+///
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "BinaryIO.h"
+#include "Constants.h"
+#include "File.h"
+#include "Parallel.h"
+#include "Particle.h"
+#include "Vec.h"
+
+/// Index entry of one chunk. Scalar fields are m, h, rho, u and the extra
+/// data, in that order.
+struct SparChunk {
+  long offset = 0;
+  int count = 0;
+  int type_min = 0;
+  int type_max = 0;
+  double box_min[3] = {0.0, 0.0, 0.0};
+  double box_max[3] = {0.0, 0.0, 0.0};
+  std::vector<float> field_min;
+  std::vector<float> field_max;
+};
+
+class SparFile : public SnapshotFile {
+public:
+  SparFile(NameData nd, int extra_data, int chunk_size = 8192);
+  ~SparFile();
+
+  bool Read();
+  bool ReadHeader();
+  bool Write(std::string fileName, bool formatted = false);
+
+  /// Chunks in the file, and those read by the last Read.
+  int GetNumChunks() { return mChunks.size(); }
+  int GetChunksRead() { return mChunksRead; }
+
+private:
+  static const int SCALAR_FIELDS = 4; // Before the extra data
+  static const int SINK_BYTES = 6 * sizeof(double) + 2 * sizeof(float);
+
+  int mChunkSize = 8192;
+  std::vector<SparChunk> mChunks;
+  int mChunksRead = 0;
+
+  bool ReadHeaderUnform();
+  void ReadSinkUnform();
+  bool ReadIndex();
+  void ReadChunk(const SparChunk &chunk, std::vector<char> &buffer);
+  bool PassChunk(const SparChunk &chunk);
+
+  void WriteHeaderUnform();
+  void WriteSinkUnform();
+  void WriteChunk(const std::vector<int> &order, const int first,
+                  const int count, SparChunk &chunk);
+  void WriteIndex();
+
+  /// The order particles are written in, by type and then along the curve.
+  std::vector<int> SortParticles();
+};
@@ -0,0 +1,59 @@
+//===-- TextWriter.h ------------------------------------------------------===//
+//
+//                                  SPARGEL
+//                   Smoothed Particle Generator and Loader
+//
+// This file is distributed under the GNU General Public License. See LICENSE
+// for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// TextWriter.h collects formatted output in a large buffer and passes it to
+/// the stream in one write when full. Numbers are formatted directly rather
+/// than through the stream, giving the same characters as setw and
+/// setprecision in the default float format, i.e. printf's "%*.*g". Without
+/// a stream the text is kept, growing the buffer, until appended to another
+/// writer, so parts of a file can be formatted separately.
+///
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "Definitions.h"
+
+class TextWriter {
+public:
+  TextWriter(std::ostream &outStream, const int capacity = 1 << 20);
+  TextWriter(const int capacity = 1 << 16);
+  /// Flushes any text still held.
+  ~TextWriter();
+
+  void Write(const char *text, const int length);
+  void Write(const std::string &text) { Write(text.data(), text.size()); }
+  void Write(const char c);
+
+  /// Right-aligned in width characters, as the stream would print them.
+  void WriteInt(const long value, const int width);
+  void WriteFloat(const double value, const int width, const int precision);
+
+  /// Writes the text held by part, and empties it.
+  void Append(TextWriter &part);
+  void Flush();
+
+  /// Writes value to text as printf's "%.*g" with the given precision, and
+  /// returns the number of characters. text must hold at least 32.
+  static int FormatGeneral(const double value, int precision, char *text);
+
+private:
+  // Most significant digits found exactly with long double arithmetic
+  static const int MAX_FAST_PRECISION = 12;
+
+  std::ostream *mOutStream = NULL;
+  std::vector<char> mBuffer;
+  int mSize = 0;
+
+  /// Makes room for length more characters, by flushing or growing.
+  void Reserve(const int length);
+  void Pad(const int length, const int width);
+};
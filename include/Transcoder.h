@@ -0,0 +1,59 @@
+//===-- Transcoder.h ------------------------------------------------------===//
+//
+//                                  SPARGEL
+//                   Smoothed Particle Generator and Loader
+//
+// This file is distributed under the GNU General Public License. See LICENSE
+// for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Transcoder.h converts unformatted SEREN snapshots to another format column
+/// by column, without creating particles. Each column is read a chunk at a
+/// time, converted to the units of the destination and written, so memory
+/// use depends only on the chunk size. Values keep the double precision of
+/// the source rather than passing through the single precision particles.
+///
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "ColumnFile.h"
+#include "Constants.h"
+#include "Definitions.h"
+#include "DragonFile.h"
+#include "OpacityTable.h"
+#include "Parallel.h"
+#include "SerenFile.h"
+#include "ThermoKernel.h"
+
+class Transcoder {
+public:
+  Transcoder(OpacityTable *opacity, const Cooling cooling, const float mu_bar,
+             const float gamma, const int chunk_size, const int threads = 1);
+  ~Transcoder();
+
+  /// Whether a conversion to the format can be made column by column.
+  static bool Supports(const std::string &format);
+
+  /// Writes the source to nd.name in the format nd.format. The source must
+  /// have been opened with OpenChunks.
+  bool Run(SerenFile *source, const NameData &nd);
+
+private:
+  OpacityTable *mOpacity = NULL;
+  Cooling mCooling = Cooling::None;
+  float mMuBar = 0.0f;
+  float mGamma = 0.0f;
+  int mChunkSize = 1000000;
+  int mThreads = 1;
+
+  bool ToSeren(SerenFile *source, const NameData &nd, const bool formatted);
+  bool ToDragon(SerenFile *source, const NameData &nd);
+  bool ToColumn(SerenFile *source, const NameData &nd);
+
+  void FindTemperatures(const std::vector<double> &rho,
+                        const std::vector<double> &u,
+                        std::vector<double> &temp);
+};
@@ -29,12 +29,16 @@ Application::~Application() {
     delete mDiscAnalyser;
   if (mEvolAnalyser != NULL)
     delete mEvolAnalyser;
+  if (mProfileStore != NULL)
+    delete mProfileStore;
   if (mCloudAnalyser != NULL)
     delete mCloudAnalyser;
   if (mSinkAnalyser != NULL)
     delete mSinkAnalyser;
   if (mMassAnalyser != NULL)
     delete mMassAnalyser;
+  if (mPipeline != NULL)
+    delete mPipeline;
 }
 
 void Application::StartSplash() {
@@ -74,10 +78,17 @@ bool Application::Initialise() {
     mNumThreads = mMaxThreads;
 
   mOutputInfo = mParams->GetInt("OUTPUT_INFO");
+  mParticleThreads = std::max(1, mParams->GetInt("PARTICLE_THREADS"));
 
   mConvert = mParams->GetInt("CONVERT");
   mInFormat = mParams->GetString("IN_FORMAT");
   mOutFormat = mParams->GetString("OUT_FORMAT");
+  mCompression = mParams->GetString("COMPRESSION");
+  if (!CodecAvailable(mCompression)) {
+    std::cout << "Compression " << mCompression
+              << " not available, exiting...\n";
+    return false;
+  }
   mOutput = mParams->GetInt("OUTPUT_FILES");
   mReduceParticles = mParams->GetInt("REDUCE_PARTICLES");
   mExtraData = std::min(EXTRA_DATA, mParams->GetInt("EXTRA_DATA"));
@@ -106,27 +117,67 @@ bool Application::Initialise() {
   mHeatmap = mParams->GetInt("HEATMAP");
   mResetTime = mParams->GetInt("RESET_TIME");
   mInsertPlanet = mParams->GetInt("INSERT_PLANET");
+  mGravity = mParams->GetInt("GRAVITY");
+  mSPHDensity = mParams->GetInt("SPH_DENSITY");
+  mNumNeigh = mParams->GetInt("N_NEIGH");
+  mStreamAnalyse = mParams->GetInt("STREAM_ANALYSIS");
+  mChunkSize = std::max(1, mParams->GetInt("CHUNK_SIZE"));
+  if (mStreamAnalyse && !CheckStreamable())
+    return false;
+  // Pure conversions copy the columns straight from file to file
+  mTranscode = mParams->GetInt("TRANSCODE") && CheckTranscodable();
 
   mOpacity =
       new OpacityTable(mEosFilePath, true, mParams->GetFloat("OPACITY_MOD"));
   if (!mOpacity->Read())
     return false;
 
+  // Cached derived quantities are only reused under the same EOS table,
+  // opacities and cooling
+  mDerivedCache = mParams->GetInt("DERIVED_CACHE");
+  if (mDerivedCache) {
+    std::stringstream config;
+    config << DerivedCache::HashFile(mEosFilePath) << " "
+           << mParams->GetFloat("OPACITY_MOD") << " "
+           << (int)ResolveCooling(mCoolingMethod, mGravity) << " "
+           << mInFormat << " " << mMuBar << " " << mGamma << " " << mGravity
+           << " " << mCenterDensest;
+    std::string str = config.str();
+    mDerivedConfig = DerivedCache::Hash(str.data(), str.size());
+  }
+
   // Generation of initial conditions
   if (mParams->GetInt("GENERATE")) {
     mGenerator = new Generator(mParams, mOpacity);
-    mGenerator->Create();
     NameData nd;
     nd.dir = "./";
     nd.id = mParams->GetString("OUTPUT_ID");
     nd.format = mOutFormat;
     nd.snap = "00000";
 
-    SerenFile *gen = new SerenFile(nd, false, mExtraData);
-    gen->SetParticles(mGenerator->GetParticles());
-    gen->SetSinks(mGenerator->GetSinks());
-    OutputFile(gen);
-    mFiles.push_back(gen);
+    if (mParams->GetInt("GENERATE_STREAM")) {
+      // Particles are written in chunks and never held together in memory
+      if (mOutFormat != "su") {
+        std::cout << "Streamed generation requires OUT_FORMAT su, exiting...\n";
+        return false;
+      }
+      SerenFile *gen = new SerenFile(nd, false, mExtraData);
+      std::string outputName = AddCodecSuffix(
+          nd.dir + "/" + nd.id + "." + nd.format + "." + nd.snap,
+          mCompression);
+      if (!mGenerator->Stream(gen, outputName)) {
+        delete gen;
+        return false;
+      }
+      delete gen;
+    } else {
+      mGenerator->Create();
+      SerenFile *gen = new SerenFile(nd, false, mExtraData);
+      gen->SetParticles(mGenerator->GetParticles());
+      gen->SetSinks(mGenerator->GetSinks());
+      OutputFile(gen);
+      mFiles.push_back(gen);
+    }
   }
 
   // Cooling map creator
@@ -157,6 +208,8 @@ bool Application::Initialise() {
       mFiles.push_back(new DragonFile(nd, false, mExtraData));
     } else if (mInFormat == "df") {
       mFiles.push_back(new DragonFile(nd, true, mExtraData));
+    } else if (mInFormat == "spar") {
+      mFiles.push_back(new SparFile(nd, mExtraData));
     } else if (mInFormat == "column") {
       mFiles.push_back(new ColumnFile(nd));
     } else if (mInFormat == "ascii") {
@@ -169,19 +222,98 @@ bool Application::Initialise() {
     }
   }
 
+  std::string backend = mParams->GetString("IO_BACKEND");
+  for (int i = 0; i < mFiles.size(); ++i) {
+    ((SnapshotFile *)mFiles[i])->SetIOBackend(backend);
+    ((SnapshotFile *)mFiles[i])->SetThreads(mParticleThreads);
+  }
+
+  // Index the snapshots from their headers and drop those not selected
+  double time_min = mParams->GetFloat("TIME_MIN");
+  double time_max = mParams->GetFloat("TIME_MAX");
+  int stride = mParams->GetInt("SNAP_STRIDE");
+  bool select = time_min > 0.0 || time_max > 0.0 || stride > 1;
+  if (mGenerator == NULL && mFiles.size() > 0 &&
+      (select || mParams->GetInt("CATALOGUE"))) {
+    Catalogue catalogue(mNumThreads);
+    catalogue.Scan(mFiles);
+    if (mParams->GetInt("CATALOGUE"))
+      catalogue.Print();
+
+    std::vector<int> selection = catalogue.Select(time_min, time_max, stride);
+    std::vector<File *> files;
+    for (int i = 0, j = 0; i < mFiles.size(); ++i) {
+      if (j < selection.size() && selection[j] == i) {
+        files.push_back(mFiles[i]);
+        ++j;
+      } else {
+        delete mFiles[i];
+      }
+    }
+    mFiles = files;
+
+    std::cout << "   Catalogue        : " << selection.size() << " of "
+              << catalogue.GetEntries().size() << " files selected, "
+              << catalogue.GetNumParticles(selection) << " particles, at most "
+              << catalogue.GetMaxParticles(selection) << " per file\n";
+  }
+
+  // Push the cuts and particle type down into the readers
+  ReadFilter filter;
+  filter.type = mParams->GetInt("READ_TYPE");
+  if (mParams->GetInt("READ_FILTER")) {
+    // Only if nothing moves the particles or needs the rejected ones first
+    if (!mDiscAnalyse || mCenter || mCloudAnalyse || mSPHDensity ||
+        mGravity) {
+      std::cout << "   Read filter ignored, cuts depend on earlier analysis\n";
+    } else {
+      if (mRadialCut) {
+        filter.radius = mRadialCutDist;
+        filter.radial_dim = mRadialCut;
+      }
+      if (mMidplaneCut && !mExtraQuantities)
+        filter.height = mMidplaneCut;
+    }
+  }
+  if (mParams->GetFloat("READ_DENSITY") > 0.0) {
+    if (mSPHDensity) {
+      std::cout << "   Read density ignored, densities are recomputed\n";
+    } else {
+      filter.density = mParams->GetFloat("READ_DENSITY");
+    }
+  }
+  if (filter.Active()) {
+    for (int i = 0; i < mFiles.size(); ++i)
+      ((SnapshotFile *)mFiles[i])->SetReadFilter(filter);
+  }
+
   if (mCloudAnalyse && mFiles.size() > 0) {
-    mCloudAnalyser = new CloudAnalyser(mFiles[0]->GetNameData(),
-                                       mParams->GetInt("CLOUD_AVERAGE"));
+    mCloudAnalyser =
+        new CloudAnalyser(mFiles[0]->GetNameData(),
+                          mParams->GetInt("CLOUD_AVERAGE"), mNumThreads);
   }
 
   if (mEvolAnalyse && mFiles.size() > 0) {
-    mEvolAnalyser = new EvolutionAnalyser(mFiles[0]->GetNameData());
+    mEvolAnalyser =
+        new EvolutionAnalyser(mFiles[0]->GetNameData(), mNumThreads);
+  }
+
+  if (mRadialAnalyse && mParams->GetString("RADIAL_OUTPUT") == "store" &&
+      mFiles.size() > 0) {
+    int bins = mParams->GetInt("RADIAL_BINS");
+    float in = mParams->GetFloat("RADIUS_IN");
+    float width = (mParams->GetFloat("RADIUS_OUT") - in) / bins;
+    mProfileStore =
+        new ProfileStore(mFiles[0]->GetNameData(), bins, in, width,
+                         mParams->GetInt("RADIAL_LOG"), mNumThreads);
   }
 
   if (mMassAnalyse && mFiles.size() > 0) {
-    mMassAnalyser = new MassAnalyser();
+    mMassAnalyser = new MassAnalyser(mNumThreads);
   }
 
+  BuildPipeline();
+
   return true;
 }
 
@@ -200,7 +332,10 @@ void Application::Run() {
     std::cout << "   Files per thread : " << mFilesPerThread << "\n";
     std::cout << "   Remainder        : " << mRemainder << "\n\n";
 
-    std::cout << "   EOS table        : " << mOpacity->GetFileName() << "\n\n";
+    std::cout << "   EOS table        : " << mOpacity->GetFileName() << "\n";
+    std::cout << "   Pipeline         : "
+              << ((mTranscode) ? "transcode" : mPipeline->Describe())
+              << "\n\n";
 
     int pos = 0;
     for (int i = 0; i < mNumThreads; ++i) {
@@ -209,7 +344,14 @@ void Application::Run() {
       pos = end;
       --mRemainder;
 
-      threads[i] = std::thread(&Application::Analyse, this, i, start, end);
+      if (mTranscode) {
+        threads[i] = std::thread(&Application::Transcode, this, i, start, end);
+      } else if (mStreamAnalyse) {
+        threads[i] =
+            std::thread(&Application::StreamAnalyse, this, i, start, end);
+      } else {
+        threads[i] = std::thread(&Application::Analyse, this, i, start, end);
+      }
     }
     // Join the threads
     for (int i = 0; i < mNumThreads; ++i) {
@@ -231,6 +373,17 @@ void Application::Run() {
     }
   }
 
+  // Merge the per-thread results in time order before writing
+  if (mMassAnalyse) {
+    mMassAnalyser->Merge();
+  }
+  if (mCloudAnalyse) {
+    mCloudAnalyser->Merge();
+  }
+  if (mEvolAnalyse) {
+    mEvolAnalyser->Merge();
+  }
+
   if (mMassAnalyse) {
     mMassAnalyser->CalculateAccretionRate();
     mMassAnalyser->Write();
@@ -247,8 +400,13 @@ void Application::Run() {
   if (mEvolAnalyse) {
     mEvolAnalyser->Write();
   }
+  if (mProfileStore) {
+    mProfileStore->Write();
+  }
 
-  std::cout << "   Files analysed   : " << mFilesAnalysed << "\n\n";
+  std::cout << "   Files analysed   : " << mFilesAnalysed << "\n";
+  IOBackend::Report();
+  std::cout << "\n";
 }
 
 void Application::Analyse(int task, int start, int end) {
@@ -257,226 +415,607 @@ void Application::Analyse(int task, int start, int end) {
     if (mGenerator == NULL) {
       if (!mFiles[i]->Read())
         break;
+      ((SnapshotFile *)mFiles[i])->ApplyDensityFilter();
     }
-
-    // Thermal property calculation. Independant between particles/sinks. Can be
-    // done before all other analysis.
-    FindThermo((SnapshotFile *)mFiles[i]);
-
-    // Cloud analysis
-    if (mCloudAnalyse) {
-      mCloudAnalyser->FindCentralQuantities((SnapshotFile *)mFiles[i]);
-      if (mCloudCenter) {
-        mCloudAnalyser->CenterAroundDensest((SnapshotFile *)mFiles[i]);
-      }
+    DerivedCache *cache = NULL;
+    if (mDerivedCache && mGenerator == NULL) {
+      cache = new DerivedCache(mFiles[i]->GetFileName(), mDerivedConfig,
+                               mParams->GetString("IO_BACKEND"),
+                               mParticleThreads);
     }
-    // Disc analysis
-    if (mDiscAnalyse) {
-      if (mCenter) {
-        mDiscAnalyser->Center((SnapshotFile *)mFiles[i], mCenter - 1,
-                              mPosCenter, mCenterDensest);
-        mDiscAnalyser->FindOuterRadius((SnapshotFile *)mFiles[i]);
-      }
-      // Find vertically integrated quantities
-      if (mRadialCut) {
-        RadialCut((SnapshotFile *)mFiles[i], mRadialCutDist, mRadialCut);
-      }
+    mPipeline->Run((SnapshotFile *)mFiles[i], task, cache);
+    if (cache != NULL) {
+      cache->Save();
+      std::cout << "   Derived cache    : " << cache->GetLoaded()
+                << " loaded, " << cache->GetComputed() << " computed\n";
+      delete cache;
+    }
+    ++mFilesAnalysed;
+    delete mFiles[i];
+  }
+}
 
-      if (mHillRadiusCut) {
-        HillRadiusCut((SnapshotFile *)mFiles[i]);
-      }
-      if (mExtraQuantities) {
-        FindOpticalDepth((SnapshotFile *)mFiles[i]);
-        FindBeta((SnapshotFile *)mFiles[i]);
-      }
-      if (mMidplaneCut) {
-        MidplaneCut((SnapshotFile *)mFiles[i]);
-      }
-      if (mHeatmap) {
-        Heatmap *hm = new Heatmap(mParams->GetInt("HEATMAP_RES"));
-        hm->Create((SnapshotFile *)mFiles[i]);
-        hm->Output();
-        delete hm;
-      }
-      if (mEvolAnalyse) {
-        mEvolAnalyser->Append((SnapshotFile *)mFiles[i]);
-      }
-      if (mSinkAnalyse) {
-        mSinkAnalyser->CalculateMassRadius((SnapshotFile *)mFiles[i], 1);
-      }
+bool Application::CheckStreamable() {
+  if (mInFormat != "su") {
+    std::cout << "Streaming analysis requires IN_FORMAT su, exiting...\n";
+    return false;
+  }
+  if (mOutput && mConvert && mOutFormat != "su") {
+    std::cout << "Streaming analysis requires OUT_FORMAT su, exiting...\n";
+    return false;
+  }
+
+  // Analyses which need every particle at once, or a pass of their own
+  std::vector<std::pair<std::string, bool>> options = {
+      {"GENERATE", mParams->GetInt("GENERATE")},
+      {"CLOUD_ANALYSIS", mCloudAnalyse},
+      {"EVOLUTION_ANALYSIS", mEvolAnalyse},
+      {"SINK_ANALYSIS", mSinkAnalyse},
+      {"CENTER_DENSEST", mCenterDensest},
+      {"RADIAL_CUT", mRadialCut},
+      {"HILLRADIUS_CUT", mHillRadiusCut},
+      {"MIDPLANE_CUT", mMidplaneCut != 0.0},
+      {"EXTRA_QUANTITIES", mExtraQuantities},
+      {"INSERT_PLANET", mInsertPlanet},
+      {"GRAVITY", mGravity},
+      {"SPH_DENSITY", mSPHDensity},
+      {"REDUCE_PARTICLES", mReduceParticles},
+      {"READ_TYPE", mParams->GetInt("READ_TYPE")},
+      {"READ_DENSITY", mParams->GetFloat("READ_DENSITY") > 0.0}};
+  for (int i = 0; i < options.size(); ++i) {
+    if (options[i].second) {
+      std::cout << "Streaming analysis does not support " << options[i].first
+                << ", exiting...\n";
+      return false;
     }
+  }
 
-    // Planet insertion
-    if (mInsertPlanet) {
-      InsertPlanet((SnapshotFile *)mFiles[i]);
+  // Each chunk reads from every column, which a stream without blocks can
+  // only reach by decompressing again from the start
+  for (int i = 1; i < mArgs->GetNumArgs() - 1; ++i) {
+    if (StreamCompressed(mArgs->GetArgument(i))) {
+      std::cout << "Streaming analysis requires block compressed input, "
+                << mArgs->GetArgument(i)
+                << " has no block index, exiting...\n";
+      return false;
     }
+  }
+  return true;
+}
 
-    // Necessary Toomre quantity calculations. Needs to be done after moving the
-    // disc (e.g. centering).
-    FindToomre((SnapshotFile *)mFiles[i]);
-    FindEnergy((SnapshotFile *)mFiles[i]);
+void Application::StreamAnalyse(int task, int start, int end) {
+  for (int i = start; i < end; ++i) {
+    if (!StreamFile((SerenFile *)mFiles[i], task))
+      break;
+    ++mFilesAnalysed;
+    delete mFiles[i];
+  }
+}
 
-    // Particle reduction.
-    // TODO: Double-free when deleting snapshot file.
-    if (mReduceParticles) {
-      ReduceParticles((SnapshotFile *)mFiles[i]);
-    }
+bool Application::StreamFile(SerenFile *file, const int task) {
+  if (!file->OpenChunks())
+    return false;
+  int num = file->GetNumGas() + file->GetNumDust();
+  std::vector<Sink *> sink = file->GetSinks();
+  std::vector<Particle *> chunk;
+
+  // Centering on a sink or a position needs only the sinks
+  Vec3 dX = {0.0, 0.0, 0.0};
+  const Vec3 dV = {0.0, 0.0, 0.0};
+  bool center = false;
+  if (mDiscAnalyse && mCenter) {
+    std::string appendage = ".centered.";
+    center = mDiscAnalyser->FindOffset(sink, mCenter - 1, mPosCenter, dX,
+                                       appendage);
+    if (center)
+      mDiscAnalyser->CenterSinks(file, dX, appendage);
+  }
 
-    // Mass analysis
-    if (mMassAnalyse) {
-      mMassAnalyser->ExtractValues((SnapshotFile *)mFiles[i]);
+  // A first pass tabulates the gas mass against radius, for the outer radii
+  // and the mass enclosed by each particle.
+  bool heatmap = mDiscAnalyse && mHeatmap;
+  std::string quantity = mParams->GetString("HEATMAP_QUANTITY");
+  bool toomre = mRadialAnalyse || (heatmap && quantity == "Q");
+  bool energy = mRadialAnalyse;
+  EnclosedMass table;
+  if (center || toomre || energy) {
+    for (int first = 0; first < num; first += mChunkSize) {
+      file->ReadChunk(chunk, first, std::min(mChunkSize, num - first), false);
+      if (center)
+        mDiscAnalyser->Shift(chunk, dX, dV);
+      for (int i = 0; i < chunk.size(); ++i)
+        table.Add(chunk[i]->GetX().Norm(), chunk[i]->GetM());
     }
+    table.Finalise();
+    if (center)
+      mDiscAnalyser->FindOuterRadius(file, table);
+  }
 
-    // Radial analysis
-    if (mRadialAnalyse) {
-      RadialAnalyser *ra = new RadialAnalyser(mParams);
-      ra->Run((SnapshotFile *)mFiles[i]);
-      delete ra;
+  // Sinks are counted within the radius of the particle, and the central
+  // star always.
+  auto sink_mass = [&](const float r) {
+    double mass = (sink.size() > 0) ? sink[0]->GetM() : 0.0;
+    for (int j = 1; j < sink.size(); ++j) {
+      if (r > sink[j]->GetX().Norm())
+        mass += sink[j]->GetM();
     }
-    // File conversion
-    if (mConvert) {
-      mFiles[i]->SetNameDataFormat(mOutFormat);
-    }
-    // Snapshot output
+    return mass;
+  };
+
+  Cooling cooling = ResolveCooling(mCoolingMethod, mGravity);
+  ThermoFunction thermo =
+      SelectThermo(cooling, ResolveSource(cooling, mInFormat));
+
+  Heatmap *hm = NULL;
+  if (heatmap) {
+    hm = new Heatmap(mParams->GetInt("HEATMAP_RES"), quantity,
+                     mParticleThreads);
+    hm->Begin(file);
+  }
+  RadialAnalyser ra(mParams);
+  RadialProfile profile = ra.CreateProfile();
+  MassTally mass = {};
+  float gas_mass = 0.0, max_rho = 1E-30, max_temp = 1E-30;
+  SerenFile *writer = NULL;
+
+  for (int first = 0; first < num; first += mChunkSize) {
+    file->ReadChunk(chunk, first, std::min(mChunkSize, num - first), true);
+    if (center)
+      mDiscAnalyser->Shift(chunk, dX, dV);
+
+    ParallelFor(chunk.size(), mParticleThreads, [&](int s, int e, int t) {
+      for (int i = s; i < e; ++i) {
+        Particle *p = chunk[i];
+        thermo(p, mOpacity, mMuBar, mGamma);
+        float r = p->GetX().Norm();
+        if (toomre)
+          SetToomre(p, sink_mass(r) + table.GetInterior(r));
+        if (energy)
+          SetEnergies(p, sink_mass(r) + table.GetInterior(r) + p->GetM());
+      }
+    });
+
+    if (hm)
+      hm->Add(chunk);
+    if (mMassAnalyse)
+      mMassAnalyser->Tally(mass, chunk, sink);
+    if (mRadialAnalyse)
+      ra.Accumulate(profile, chunk);
+    if (mOutputInfo)
+      TallyInfo(chunk, gas_mass, max_rho, max_temp);
+
+    // Gas and dust are both written, as for a whole snapshot
     if (mOutput) {
-      OutputFile((SnapshotFile *)mFiles[i]);
-    }
-    // Screen output
-    if (mOutputInfo) {
-      OutputInfo((SnapshotFile *)mFiles[i]);
+      if (writer == NULL)
+        writer = BeginStreamOutput(file, chunk[0]->GetM());
+      if (writer == NULL)
+        break;
+      writer->WriteStreamChunk(chunk, first);
     }
-    ++mFilesAnalysed;
-    delete mFiles[i];
   }
+  file->ReadChunk(chunk, 0, 0, false);
+  file->CloseChunks();
+
+  if (hm) {
+    hm->End();
+    hm->Output();
+    delete hm;
+  }
+  if (mMassAnalyse)
+    mMassAnalyser->Report(file, mass, task);
+  if (mRadialAnalyse)
+    ra.Output(file, profile, mProfileStore, task);
+  if (mConvert)
+    file->SetNameDataFormat(mOutFormat);
+  if (writer) {
+    writer->EndStream();
+    writer->ClearSinks();
+    delete writer;
+  }
+  if (mOutputInfo)
+    OutputInfo(file, gas_mass, max_rho, max_temp);
+
+  return true;
 }
 
-void Application::MidplaneCut(SnapshotFile *file) {
-  std::vector<Particle *> part = file->GetParticles();
-  std::vector<Particle *> trimmed;
-  for (int i = 0; i < part.size(); ++i) {
-    Particle *p = part[i];
-    float R = p->GetX().Norm();
-    float z = abs(p->GetX().z);
-    if (z <= mMidplaneCut) {
-      trimmed.push_back(p);
-    } else {
-      delete part[i];
+SerenFile *Application::BeginStreamOutput(SnapshotFile *file,
+                                          const double hydro_mass) {
+  NameData nd = StreamNameData(file);
+
+  if (mResetTime) {
+    file->SetTime(0.0f);
+  }
+
+  SerenFile *writer = new SerenFile(nd, false, mExtraData);
+  writer->SetSinks(file->GetSinks());
+  writer->SetTime(file->GetTime());
+  int num = file->GetNumGas() + file->GetNumDust();
+  if (!writer->BeginStream(nd.name, num, hydro_mass)) {
+    writer->ClearSinks();
+    delete writer;
+    return NULL;
+  }
+  return writer;
+}
+
+NameData Application::StreamNameData(SnapshotFile *file) {
+  NameData nd = file->GetNameData();
+  if (nd.dir == "")
+    nd.dir = ".";
+  if (mConvert)
+    nd.format = mOutFormat;
+  nd.append += ".modified";
+  nd.name = AddCodecSuffix(
+      nd.dir + "/" + nd.id + "." + nd.format + "." + nd.snap + nd.append,
+      mCompression);
+  return nd;
+}
+
+bool Application::CheckTranscodable() {
+  if (!mConvert || !mOutput || mInFormat != "su" ||
+      !Transcoder::Supports(mOutFormat))
+    return false;
+
+  // Rows are read from every column at once, which a stream without blocks
+  // can only reach by decompressing again from the start
+  if (mOutFormat == "column") {
+    for (int i = 1; i < mArgs->GetNumArgs() - 1; ++i) {
+      if (StreamCompressed(mArgs->GetArgument(i))) {
+        std::cout << "   " << mArgs->GetArgument(i)
+                  << " has no block index, converting without transcoding\n";
+        return false;
+      }
     }
   }
-  file->SetParticles(trimmed);
-  file->SetNumGas(trimmed.size());
-  file->SetNameDataAppend(".midplane");
-  trimmed.clear();
+
+  // Anything beyond reading and writing needs the particles
+  return !mParams->GetInt("GENERATE") && !mOutputInfo && !mCloudAnalyse &&
+         !mDiscAnalyse && !mEvolAnalyse && !mSinkAnalyse &&
+         !mRadialAnalyse && !mMassAnalyse && !mCenterDensest &&
+         !mRadialCut && !mHillRadiusCut && mMidplaneCut == 0.0 &&
+         !mExtraQuantities && !mInsertPlanet && !mGravity && !mSPHDensity &&
+         !mReduceParticles && !mParams->GetInt("READ_TYPE") &&
+         mParams->GetFloat("READ_DENSITY") <= 0.0;
 }
 
-void Application::RadialCut(SnapshotFile *file, const float dist,
-                            const int dim) {
-  const std::vector<Particle *> part = file->GetParticles();
-  const std::vector<Sink *> sink = file->GetSinks();
-  std::vector<Particle *> trimmed_part;
-  std::vector<Sink *> trimmed_sink;
+void Application::Transcode(int task, int start, int end) {
+  Transcoder transcoder(mOpacity, ResolveCooling(mCoolingMethod, mGravity),
+                        mMuBar, mGamma, mChunkSize, mParticleThreads);
+  for (int i = start; i < end; ++i) {
+    SerenFile *file = (SerenFile *)mFiles[i];
+    if (!file->OpenChunks())
+      break;
+    if (mResetTime)
+      file->SetTime(0.0f);
+    bool written = transcoder.Run(file, StreamNameData(file));
+    file->CloseChunks();
+    if (!written)
+      break;
+    ++mFilesAnalysed;
+    delete mFiles[i];
+  }
+}
 
-  file->SetNameDataAppend(".radialcut");
+static Stage MakeStage(const std::string &name, const int reads,
+                       const int writes,
+                       std::function<void(SnapshotFile *, int)> run) {
+  Stage stage;
+  stage.name = name;
+  stage.reads = reads;
+  stage.writes = writes;
+  stage.run = run;
+  return stage;
+}
 
-  for (int i = 0; i < part.size(); ++i) {
-    Particle *p = part[i];
-    float r = 0.0f;
+static Stage MakeKernel(const std::string &name, const int reads,
+                        const int writes,
+                        std::function<void(Particle *)> kernel) {
+  Stage stage;
+  stage.name = name;
+  stage.reads = reads;
+  stage.writes = writes;
+  stage.kernel = kernel;
+  return stage;
+}
 
-    if (dim == 2) {
-      r = p->GetX().Norm2();
-    } else if (dim == 3) {
-      r = p->GetX().Norm();
-    }
+std::vector<Stage> Application::DeriveStages(int fields, const int valid) {
+  // Beta needs Omega, and the Toomre quantities and energies need the
+  // thermal quantities.
+  if (fields & DERIVED_BETA)
+    fields |= DERIVED_TOOMRE;
+  if (fields & (DERIVED_TOOMRE | DERIVED_ENERGY))
+    fields |= DERIVED_THERMO;
+  int missing = fields & ~valid;
+  // Recomputing a quantity means recomputing everything derived from it
+  if (missing & DERIVED_THERMO)
+    missing |= fields & DERIVED_MOVED;
+  if (missing & DERIVED_TOOMRE)
+    missing |= fields & DERIVED_BETA;
+
+  std::vector<Stage> stages;
+  if (missing & DERIVED_THERMO) {
+    Cooling cooling = ResolveCooling(mCoolingMethod, mGravity);
+    ThermoFunction thermo =
+        SelectThermo(cooling, ResolveSource(cooling, mInFormat));
+    OpacityTable *opacity = mOpacity;
+    float mu_bar = mMuBar, gamma = mGamma;
+    stages.push_back(MakeKernel(
+        "thermo", STAGE_DENSITY | STAGE_GRAVITY, DERIVED_THERMO,
+        [=](Particle *p) { thermo(p, opacity, mu_bar, gamma); }));
+  }
+  // Toomre quantities and energies share one sort and one radial scan
+  int enclosed = missing & (DERIVED_TOOMRE | DERIVED_ENERGY);
+  if (enclosed) {
+    std::string name = (enclosed == DERIVED_TOOMRE)   ? "toomre"
+                       : (enclosed == DERIVED_ENERGY) ? "energy"
+                                                      : "toomre + energy";
+    // Energies from the tree potential leave the order unchanged
+    bool sorted = !(mGravity && enclosed == DERIVED_ENERGY);
+    stages.push_back(MakeStage(
+        name,
+        DERIVED_THERMO | STAGE_POSITION | STAGE_PARTICLES | STAGE_SINKS |
+            STAGE_DENSITY | STAGE_GRAVITY,
+        enclosed | (sorted ? STAGE_ORDER : 0),
+        [=](SnapshotFile *file, int task) { FindEnclosed(file, enclosed); }));
+  }
+  if (missing & DERIVED_BETA) {
+    stages.push_back(MakeKernel("beta",
+                                DERIVED_THERMO | DERIVED_TOOMRE |
+                                    STAGE_DENSITY | STAGE_POSITION,
+                                DERIVED_BETA,
+                                [=](Particle *p) { FindBeta(p); }));
+  }
+  for (int i = 0; i < stages.size(); ++i) {
+    stages[i].provides = stages[i].writes & DERIVED_ALL;
+    stages[i].cached = true;
+  }
+  return stages;
+}
 
-    if (r < dist) {
-      trimmed_part.push_back(p);
-    }
+void Application::BuildPipeline() {
+  mPipeline = new Pipeline(
+      [=](int fields, int valid) { return DeriveStages(fields, valid); },
+      mParticleThreads);
+  const int all = STAGE_POSITION | STAGE_PARTICLES | STAGE_SINKS |
+                  STAGE_DENSITY | STAGE_HEADER;
+
+  // Self-consistent smoothing lengths and densities
+  if (mSPHDensity) {
+    mPipeline->Add(MakeStage("density", STAGE_POSITION | STAGE_PARTICLES,
+                             STAGE_DENSITY, [=](SnapshotFile *file, int task) {
+                               std::vector<Particle *> part =
+                                   file->GetParticles();
+                               FindSPHDensity(part, mNumNeigh,
+                                              mParticleThreads);
+                             }));
   }
 
-  for (int i = 0; i < sink.size(); ++i) {
-    Sink *s = sink[i];
-    float r = 0.0f;
+  // Tree gravity. Only depends on relative positions so is unaffected by
+  // later centering.
+  if (mGravity) {
+    mPipeline->Add(MakeStage(
+        "gravity",
+        STAGE_POSITION | STAGE_PARTICLES | STAGE_SINKS | STAGE_DENSITY,
+        STAGE_GRAVITY,
+        [=](SnapshotFile *file, int task) { FindGravity(file); }));
+  }
 
-    if (dim == 2) {
-      r = s->GetX().Norm2();
-    } else if (dim == 3) {
-      r = s->GetX().Norm();
+  // Cloud analysis
+  if (mCloudAnalyse) {
+    mPipeline->Add(MakeStage(
+        "cloud",
+        DERIVED_THERMO | STAGE_DENSITY | STAGE_PARTICLES | STAGE_HEADER,
+        STAGE_ORDER, [=](SnapshotFile *file, int task) {
+          mCloudAnalyser->FindCentralQuantities(file, task);
+        }));
+    if (mCloudCenter) {
+      // The densest particle is the first after the cloud stage's sort
+      mPipeline->Add(MakeStage("cloud center",
+                               STAGE_POSITION | STAGE_PARTICLES | STAGE_ORDER,
+                               STAGE_POSITION | STAGE_PARTICLES,
+                               [=](SnapshotFile *file, int task) {
+                                 mCloudAnalyser->CenterAroundDensest(file);
+                               }));
     }
+  }
 
-    if (r < dist) {
-      trimmed_sink.push_back(s);
+  // Disc analysis
+  if (mDiscAnalyse) {
+    if (mCenter) {
+      mPipeline->Add(MakeStage(
+          "center", all,
+          STAGE_POSITION | STAGE_PARTICLES | STAGE_SINKS | STAGE_HEADER |
+              STAGE_CONSOLE,
+          [=](SnapshotFile *file, int task) {
+            mDiscAnalyser->Center(file, mCenter - 1, mPosCenter,
+                                  mCenterDensest);
+            mDiscAnalyser->FindOuterRadius(file);
+          }));
+    }
+    // Cuts are applied together in one pass, except that the midplane cut
+    // must follow the optical depths, which need the particles above and
+    // below the midplane.
+    bool late_midplane = mMidplaneCut && mExtraQuantities;
+    bool radial = mRadialCut, hill = mHillRadiusCut;
+    bool midplane = mMidplaneCut && !late_midplane;
+    if (radial || hill || midplane) {
+      std::string name = "";
+      name += radial ? "radial + " : "";
+      name += hill ? "hill + " : "";
+      name += midplane ? "midplane + " : "";
+      mPipeline->Add(MakeStage(
+          name.substr(0, name.size() - 3) + " cut",
+          STAGE_POSITION | STAGE_PARTICLES | STAGE_SINKS,
+          STAGE_PARTICLES | STAGE_SINKS | STAGE_HEADER | STAGE_CONSOLE,
+          [=](SnapshotFile *file, int task) {
+            Cut(file, radial, hill, midplane);
+          }));
+    }
+    // Vertically integrated quantities
+    if (mExtraQuantities) {
+      Stage depth = MakeStage(
+          "optical depth",
+          DERIVED_THERMO | STAGE_POSITION | STAGE_PARTICLES | STAGE_DENSITY,
+          DERIVED_THERMO | STAGE_POSITION | STAGE_PARTICLES,
+          [=](SnapshotFile *file, int task) { FindOpticalDepth(file); });
+      depth.cached = true;
+      mPipeline->Add(depth);
+    }
+    if (late_midplane) {
+      mPipeline->Add(MakeStage(
+          "midplane cut", STAGE_POSITION | STAGE_PARTICLES,
+          STAGE_PARTICLES | STAGE_HEADER, [=](SnapshotFile *file, int task) {
+            Cut(file, false, false, true);
+          }));
+    }
+    if (mEvolAnalyse) {
+      mPipeline->Add(MakeStage(
+          "evolution", DERIVED_THERMO | all, 0,
+          [=](SnapshotFile *file, int task) {
+            mEvolAnalyser->Append(file, task);
+          }));
+    }
+    if (mSinkAnalyse) {
+      mPipeline->Add(MakeStage(
+          "sink radius", all, STAGE_POSITION | STAGE_SINKS,
+          [=](SnapshotFile *file, int task) {
+            mSinkAnalyser->CalculateMassRadius(file, 1);
+          }));
     }
   }
 
-  if (!trimmed_part.size()) {
-    file->ClearParticles();
-    return;
+  // Planet insertion
+  if (mInsertPlanet) {
+    mPipeline->Add(MakeStage(
+        "planet", STAGE_POSITION | STAGE_PARTICLES | STAGE_SINKS,
+        STAGE_SINKS | STAGE_HEADER,
+        [=](SnapshotFile *file, int task) { InsertPlanet(file); }));
   }
 
-  // Sort by density.
-  std::sort(trimmed_part.begin(), trimmed_part.end(),
-            [](Particle *a, Particle *b) { return b->GetD() < a->GetD(); });
+  // Projected maps
+  if (mDiscAnalyse && mHeatmap) {
+    std::string quantity = mParams->GetString("HEATMAP_QUANTITY");
+    int res = mParams->GetInt("HEATMAP_RES");
+    mPipeline->Add(MakeStage(
+        "heatmap",
+        DERIVED_THERMO | ((quantity == "Q") ? DERIVED_TOOMRE : 0) | all,
+        STAGE_CONSOLE,
+        [=](SnapshotFile *file, int task) {
+          Heatmap *hm = new Heatmap(res, quantity, mParticleThreads);
+          hm->Create(file);
+          hm->Output();
+          delete hm;
+        }));
+  }
 
-  // Velocity COM.
-  Vec3 vcom = trimmed_part.front()->GetV();
-  for (int i = 0; i < trimmed_part.size(); ++i) {
-    Vec3 new_v = trimmed_part[i]->GetV() - vcom;
-    trimmed_part[i]->SetV(new_v);
+  // Particle reduction. A new density solve changes every derived quantity.
+  if (mReduceParticles) {
+    mPipeline->Add(MakeStage(
+        "reduce",
+        STAGE_PARTICLES | STAGE_DENSITY | (mSPHDensity ? STAGE_POSITION : 0),
+        STAGE_PARTICLES | STAGE_HEADER | (mSPHDensity ? STAGE_DENSITY : 0),
+        [=](SnapshotFile *file, int task) { ReduceParticles(file); }));
   }
-  for (int i = 0; i < trimmed_sink.size(); ++i) {
-    Vec3 new_v = trimmed_sink[i]->GetV() - vcom;
-    trimmed_sink[i]->SetV(new_v);
+
+  // Mass analysis
+  if (mMassAnalyse) {
+    mPipeline->Add(MakeStage("mass", all, STAGE_CONSOLE,
+                             [=](SnapshotFile *file, int task) {
+                               mMassAnalyser->ExtractValues(file, task);
+                             }));
   }
 
-  file->SetParticles(trimmed_part);
-  if (trimmed_sink.size()) {
-    file->SetSinks(trimmed_sink);
+  // Radial analysis
+  if (mRadialAnalyse) {
+    int derived = DERIVED_THERMO | DERIVED_TOOMRE | DERIVED_ENERGY |
+                  (mExtraQuantities ? DERIVED_BETA : 0);
+    mPipeline->Add(MakeStage("radial", derived | all, STAGE_CONSOLE,
+                             [=](SnapshotFile *file, int task) {
+                               RadialAnalyser *ra = new RadialAnalyser(mParams);
+                               ra->Run(file, mProfileStore, task);
+                               delete ra;
+                             }));
+  }
 
-  } else {
-    file->ClearSinks();
+  // File conversion
+  if (mConvert) {
+    mPipeline->Add(MakeStage("convert", 0, STAGE_HEADER,
+                             [=](SnapshotFile *file, int task) {
+                               file->SetNameDataFormat(mOutFormat);
+                             }));
+  }
+  // Snapshot output
+  if (mOutput) {
+    mPipeline->Add(MakeStage(
+        "output", DERIVED_THERMO | all, STAGE_HEADER | STAGE_CONSOLE,
+        [=](SnapshotFile *file, int task) { OutputFile(file); }));
+  }
+  // Screen output
+  if (mOutputInfo) {
+    mPipeline->Add(MakeStage(
+        "info", DERIVED_THERMO | all, STAGE_CONSOLE,
+        [=](SnapshotFile *file, int task) { OutputInfo(file); }));
   }
-}
 
-void Application::HillRadiusCut(SnapshotFile *file) {
-  std::vector<Sink *> sinks = file->GetSinks();
-  if (sinks.size() < 2)
-    return;
+  mPipeline->Build();
+}
 
+void Application::Cut(SnapshotFile *file, const bool radial, const bool hill,
+                      const bool midplane) {
   std::vector<Particle *> part = file->GetParticles();
-  std::vector<Particle *> trimmed;
-
-  float planet_radius = sinks[1]->GetX().Norm();
-  float hill_radius =
-      planet_radius * pow(sinks[1]->GetM() / sinks[0]->GetM(), 0.333);
+  std::vector<Sink *> sink = file->GetSinks();
+  ParticleCut cut(mParticleThreads);
+
+  // Sinks outside the radial cut are removed before the Hill cut finds the
+  // planet, but only once some particles are known to survive.
+  std::vector<Sink *> trimmed_sink = sink;
+  if (radial) {
+    cut.SetRadial(mRadialCutDist, mRadialCut);
+    trimmed_sink.clear();
+    for (int i = 0; i < sink.size(); ++i) {
+      if (cut.PassRadial(sink[i]->GetX()))
+        trimmed_sink.push_back(sink[i]);
+    }
+    file->SetNameDataAppend(".radialcut");
+  }
 
-  std::cout << "Hill radius: " << hill_radius << " AU\n";
+  bool hill_active = hill && trimmed_sink.size() >= 2;
+  if (hill_active) {
+    float planet_radius = trimmed_sink[1]->GetX().Norm();
+    float hill_radius =
+        planet_radius *
+        pow(trimmed_sink[1]->GetM() / trimmed_sink[0]->GetM(), 0.333);
+    std::cout << "Hill radius: " << hill_radius << " AU\n";
+    cut.SetHill(trimmed_sink[1]->GetX(), mHillRadiusCut * hill_radius);
+    file->SetNameDataAppend(".hillradius");
+  }
 
-  // Center around the planet
-  for (int i = 0; i < part.size(); ++i) {
-    Vec3 new_pos = part[i]->GetX() - sinks[1]->GetX();
-    part[i]->SetX(new_pos);
+  if (midplane) {
+    cut.SetMidplane(mMidplaneCut);
+    file->SetNameDataAppend(".midplane");
   }
 
-  // Trim those particles within a Hill radius
-  for (int i = 0; i < part.size(); ++i) {
-    if (part[i]->GetX().Norm() > mHillRadiusCut * hill_radius) {
-      trimmed.push_back(part[i]);
-    } else {
-      delete part[i];
-    }
+  cut.Apply(part);
+  if (hill_active) {
+    std::cout << "Trimmed: " << cut.GetRejected(CUT_HILL) << " particles\n";
   }
-  std::cout << "Trimmed: " << part.size() - trimmed.size() << " particles\n";
 
-  // Re-center around previous position
-  for (int i = 0; i < trimmed.size(); ++i) {
-    Vec3 new_pos = trimmed[i]->GetX() + sinks[1]->GetX();
-    trimmed[i]->SetX(new_pos);
+  if (radial && cut.GetRadialCount() > 0) {
+    Vec3 vcom = cut.GetFrameVelocity();
+    for (int i = 0; i < trimmed_sink.size(); ++i) {
+      trimmed_sink[i]->SetV(trimmed_sink[i]->GetV() - vcom);
+    }
+    for (int i = 0; i < sink.size(); ++i) {
+      if (std::find(trimmed_sink.begin(), trimmed_sink.end(), sink[i]) ==
+          trimmed_sink.end())
+        delete sink[i];
+    }
+    file->SetSinks(trimmed_sink);
+    file->SetNumSinks(trimmed_sink.size());
   }
 
-  file->SetParticles(trimmed);
-  file->SetNumGas(trimmed.size());
-  file->SetNameDataAppend(".hillradius");
-  trimmed.clear();
+  file->SetParticles(part);
+  file->SetNumGas(part.size());
 }
 
 void Application::OutputFile(SnapshotFile *file) {
@@ -488,8 +1027,9 @@ void Application::OutputFile(SnapshotFile *file) {
   if (nd.dir == "")
     nd.dir = ".";
 
-  outputName =
-      nd.dir + "/" + nd.id + "." + nd.format + "." + nd.snap + nd.append;
+  outputName = AddCodecSuffix(
+      nd.dir + "/" + nd.id + "." + nd.format + "." + nd.snap + nd.append,
+      mCompression);
 
   if (mResetTime) {
     file->SetTime(0.0f);
@@ -504,6 +1044,7 @@ void Application::OutputFile(SnapshotFile *file) {
     df->SetNumSinks(file->GetNumSinks());
     df->SetNumTot(file->GetNumPart());
     df->SetTime(file->GetTime());
+    df->SetThreads(mParticleThreads);
     df->Write(outputName, true);
   }
 
@@ -515,9 +1056,20 @@ void Application::OutputFile(SnapshotFile *file) {
     su->SetNumSinks(file->GetNumSinks());
     su->SetNumTot(file->GetNumPart());
     su->SetTime(file->GetTime());
+    su->SetThreads(mParticleThreads);
     su->Write(outputName, false);
   }
 
+  if (nd.format == "spar") {
+    SparFile *spar =
+        new SparFile(nd, mExtraData, mParams->GetInt("SPAR_CHUNK_SIZE"));
+    spar->SetParticles(file->GetParticles());
+    spar->SetSinks(file->GetSinks());
+    spar->SetTime(file->GetTime());
+    spar->SetThreads(mParticleThreads);
+    spar->Write(outputName);
+  }
+
   if (nd.format == "column") {
     ColumnFile *cf = new ColumnFile(nd);
     cf->SetParticles(file->GetParticles());
@@ -526,50 +1078,45 @@ void Application::OutputFile(SnapshotFile *file) {
     cf->SetNumSinks(file->GetSinks().size());
     cf->SetNumTot(file->GetParticles().size() + file->GetSinks().size());
     cf->SetTime(file->GetTime());
+    cf->SetThreads(mParticleThreads);
     cf->Write(outputName);
   }
 }
 
-void Application::FindThermo(SnapshotFile *file) {
+void Application::FindGravity(SnapshotFile *file) {
   std::vector<Particle *> part = file->GetParticles();
-  for (int i = 0; i < part.size(); ++i) {
-    Particle *p = part[i];
-    double density = p->GetD();
-    double energy = p->GetU();
-    double sigma = p->GetSigma();
-    double temp = p->GetT();
-    if (mCoolingMethod == "stamatellos" || mCoolingMethod == "lombardi") {
-      if (mInFormat == "su" || mInFormat == "sf" || mInFormat == "column" ||
-          mInFormat == "ascii") {
-        temp = mOpacity->GetTemp(density, energy);
-      } else if (mInFormat == "df" || mInFormat == "du") {
-        energy = mOpacity->GetEnergy(density, temp);
-      }
-    } else if (mCoolingMethod == "beta_cooling") {
-      if (mInFormat == "su" || mInFormat == "sf" || mInFormat == "column") {
-        temp = (energy * mMuBar * M_P * (mGamma - 1.0)) / K;
-      } else if (mInFormat == "df" || mInFormat == "du") {
-        energy = (K * temp) / (mMuBar * M_P * (mGamma - 1.0));
-      }
-    }
-    double gamma = mOpacity->GetGamma(density, temp);
-    double kappa = mOpacity->GetKappa(density, temp);
-    double kappar = mOpacity->GetKappar(density, temp);
-    double mu_bar = mOpacity->GetMuBar(density, temp);
-    double press = (gamma - 1.0) * density * energy;
-    double cs = sqrt((K * temp) / (M_P * mu_bar));
-    double tau = kappa * sigma;
-    double dudt = 1.0 / ((sigma * sigma * kappa) + (1 / kappar));
-
-    part[i]->SetT(temp);
-    part[i]->SetU(energy);
-    part[i]->SetP(press);
-    part[i]->SetCS(cs);
-    part[i]->SetKappa(kappar);
-    part[i]->SetTau(tau);
-    part[i]->SetDUDT(dudt);
+  std::vector<Sink *> sink = file->GetSinks();
+  int num_part = part.size();
+  int num_sink = sink.size();
+
+  // Gas particles followed by sinks, softened by their smoothing lengths.
+  std::vector<Vec3> pos(num_part + num_sink);
+  std::vector<double> mass(num_part + num_sink);
+  std::vector<double> soft(num_part + num_sink);
+  for (int i = 0; i < num_part; ++i) {
+    pos[i] = part[i]->GetX();
+    mass[i] = part[i]->GetM();
+    soft[i] = part[i]->GetH();
+  }
+  for (int i = 0; i < num_sink; ++i) {
+    pos[num_part + i] = sink[i]->GetX();
+    mass[num_part + i] = sink[i]->GetM();
+    soft[num_part + i] = sink[i]->GetH();
+  }
+
+  GravityTree tree(mParams->GetInt("GRAVITY_LEAF"),
+                   mParams->GetFloat("GRAVITY_THETA"));
+  tree.Build(pos, mass, soft, mParticleThreads);
+
+  std::vector<Vec3> acc(num_part);
+  std::vector<double> pot(num_part);
+  tree.Walk(pos.data(), soft.data(), num_part, acc.data(), pot.data(),
+            mParticleThreads);
+
+  for (int i = 0; i < num_part; ++i) {
+    part[i]->SetA(acc[i]);
+    part[i]->SetPhi(pot[i]);
   }
-  file->SetParticles(part);
 }
 
 void Application::FindOpticalDepth(SnapshotFile *file) {
@@ -651,112 +1198,145 @@ void Application::FindOpticalDepth(SnapshotFile *file) {
   delete[] negative_points;
 }
 
-void Application::FindToomre(SnapshotFile *file) {
+void Application::FindEnclosed(SnapshotFile *file, const int fields) {
   std::vector<Particle *> part = file->GetParticles();
   std::vector<Sink *> sink = file->GetSinks();
+
+  // Energies include the particle itself, and the central star only if the
+  // disc was not centred on the densest particles.
+  int first_sink = (mParams->GetInt("CENTER_DENSEST") && sink.size() > 0);
+
+  // The tree potential needs no radial order, so energies alone are found
+  // without sorting
+  if (mGravity && fields == DERIVED_ENERGY) {
+    ParallelFor(part.size(), mParticleThreads, [&](int start, int end, int t) {
+      for (int i = start; i < end; ++i)
+        SetEnergies(part[i], 0.0, BindingPotential(part[i], sink, first_sink));
+    });
+    return;
+  }
+
   std::sort(part.begin(), part.end(), [](Particle *a, Particle *b) {
     return b->GetX().Norm() > a->GetX().Norm();
   });
-  float inner_mass = 0.0;
-  int sink_index = 0;
 
-  // Add mass contribution from central star if it exists
+  // Toomre quantities use the mass interior to each particle and always
+  // include the central star.
+  float toomre_mass = 0.0;
+  int toomre_sink = 0;
+  double energy_mass = 0.0;
+  int energy_sink = 0;
   if (sink.size() > 0) {
-    inner_mass += sink[0]->GetM();
-    sink_index = 1;
+    toomre_mass += sink[0]->GetM();
+    toomre_sink = 1;
+    if (!first_sink)
+      energy_mass += sink[0]->GetM();
+    energy_sink = 1;
   }
 
   for (int i = 0; i < part.size(); ++i) {
     Particle *p = part[i];
-    float r = p->GetX().Norm();
-    double r3 = pow(r * AU_TO_M, 3.0);
-    double omega = sqrt((G * inner_mass * MSUN_TO_KG) / (r3));
-
-    float cs = p->GetCS();
-    float sigma = p->GetSigma() * GPERCM2_TO_KGPERM2;
-    float Q = (cs * omega) / (PI * G * sigma);
-
-    part[i]->SetOmega(omega);
-    part[i]->SetQ(Q);
-
-    // Add contribution from other sinks but only once when
-    // we have exceeded it's radius
-    for (int i = sink_index; i < sink.size(); ++i) {
-      if (r > sink[i]->GetX().Norm()) {
-        inner_mass += sink[i]->GetM();
-        sink_index++;
+    if (fields & DERIVED_TOOMRE) {
+      float r = p->GetX().Norm();
+      SetToomre(p, toomre_mass);
+
+      // Add contribution from other sinks but only once when
+      // we have exceeded it's radius
+      for (int j = toomre_sink; j < sink.size(); ++j) {
+        if (r > sink[j]->GetX().Norm()) {
+          toomre_mass += sink[j]->GetM();
+          toomre_sink++;
+        }
+      }
+      toomre_mass += p->GetM();
+    }
+
+    if (fields & DERIVED_ENERGY) {
+      energy_mass += p->GetM();
+      SetEnergies(p, energy_mass,
+                  mGravity ? BindingPotential(p, sink, first_sink) : 0.0);
+
+      for (int j = energy_sink; j < sink.size(); ++j) {
+        if (p->GetX().Norm() > sink[j]->GetX().Norm()) {
+          energy_mass += sink[j]->GetM();
+          energy_sink++;
+        }
       }
     }
-    inner_mass += p->GetM();
   }
   file->SetParticles(part);
 }
 
-void Application::FindEnergy(SnapshotFile *file) {
-  std::vector<Particle *> part = file->GetParticles();
+double Application::BindingPotential(Particle *p,
+                                     const std::vector<Sink *> &sink,
+                                     const int first_sink) {
+  // Each pair of particles appears in the tree potential of both, so their
+  // share is halved to count the pair once. Sinks appear only in that of the
+  // particle, softened as in the tree, and those before first_sink are left
+  // out, as from the enclosed mass. Unlike the enclosed mass, every particle
+  // and sink counts, not only those at smaller radii.
+  double phi = p->GetPhi(), phi_sink = 0.0;
+  for (int j = 0; j < sink.size(); ++j) {
+    double d2 = (sink[j]->GetX() - p->GetX()).NormSquared();
+    double eps = std::max((double)p->GetH(), (double)sink[j]->GetH());
+    double phi_j = -G_AU * sink[j]->GetM() / sqrt(d2 + eps * eps);
+    phi -= phi_j;
+    if (j >= first_sink)
+      phi_sink += phi_j;
+  }
+  return 0.5 * phi + phi_sink;
+}
 
-  std::vector<Sink *> sink = file->GetSinks();
-  std::sort(part.begin(), part.end(), [](Particle *a, Particle *b) {
-    return b->GetX().Norm() > a->GetX().Norm();
-  });
-  double inner_mass = 0.0;
-  int sink_index = 0;
+void Application::SetToomre(Particle *p, const double interior) {
+  float r = p->GetX().Norm();
+  double r3 = pow(r * AU_TO_M, 3.0);
+  double omega = sqrt((G * interior * MSUN_TO_KG) / (r3));
 
-  if (sink.size() > 0 && !mParams->GetInt("CENTER_DENSEST")) {
-    inner_mass += sink[0]->GetM();
-    sink_index = 1;
-  }
+  float cs = p->GetCS();
+  float sigma = p->GetSigma() * GPERCM2_TO_KGPERM2;
+  float Q = (cs * omega) / (PI * G * sigma);
 
-  for (int i = 0; i < part.size(); ++i) {
-    Particle *p = part[i];
-    inner_mass += p->GetM();
-
-    double r = p->GetX().Norm() * AU_TO_M;
-    double r2 = p->GetX().Norm2() * AU_TO_M;
-    double m = p->GetM() * MSUN_TO_KG;
-    double m_in = inner_mass * MSUN_TO_KG;
-    double v_rot = p->GetV().Norm2() * KMPERS_TO_MPERS;
-    double u = p->GetU();
-
-    double e_grav = (G * m * m_in) / r;
-    double e_rot = 0.5 * m * v_rot * v_rot;
-    double e_ther = m * u;
-    double ang_mom = m * v_rot * r2;
-
-    part[i]->SetEnergy(e_grav, 0);
-    part[i]->SetEnergy(e_rot, 1);
-    part[i]->SetEnergy(e_ther, 2);
-    part[i]->SetEnergy(ang_mom, 3);
-
-    // Add contribution from other sinks but only once when
-    // we have exceeded it's radius
-    for (int i = sink_index; i < sink.size(); ++i) {
-      if (p->GetX().Norm() > sink[i]->GetX().Norm()) {
-        inner_mass += sink[i]->GetM();
-        sink_index++;
-      }
-    }
+  p->SetOmega(omega);
+  p->SetQ(Q);
+}
+
+void Application::SetEnergies(Particle *p, const double interior,
+                              const double phi) {
+  double r = p->GetX().Norm() * AU_TO_M;
+  double r2 = p->GetX().Norm2() * AU_TO_M;
+  double m = p->GetM() * MSUN_TO_KG;
+  double m_in = interior * MSUN_TO_KG;
+  double v_rot = p->GetV().Norm2() * KMPERS_TO_MPERS;
+  double u = p->GetU();
+
+  double e_grav = (G * m * m_in) / r;
+  // Binding energy from the tree potential rather than the enclosed mass.
+  if (mGravity) {
+    e_grav = m * fabs(phi) * AU_TO_M * AU_TO_M;
   }
-  file->SetParticles(part);
+  double e_rot = 0.5 * m * v_rot * v_rot;
+  double e_ther = m * u;
+  double ang_mom = m * v_rot * r2;
+
+  p->SetEnergy(e_grav, 0);
+  p->SetEnergy(e_rot, 1);
+  p->SetEnergy(e_ther, 2);
+  p->SetEnergy(ang_mom, 3);
 }
 
-void Application::FindBeta(SnapshotFile *file) {
-  std::vector<Particle *> part = file->GetParticles();
-  for (int i = 0; i < part.size(); ++i) {
-    float r = part[i]->GetX().Norm();
-    float omega = part[i]->GetOmega();
-    float u = part[i]->GetU() / ERGPERG_TO_JPERKG;
-    float dens = part[i]->GetD();
-    float temp = part[i]->GetT();
-    float u_bgr = mOpacity->GetEnergy(dens, 10.0) / ERGPERG_TO_JPERKG;
+void Application::FindBeta(Particle *p) {
+  float r = p->GetX().Norm();
+  float omega = p->GetOmega();
+  float u = p->GetU() / ERGPERG_TO_JPERKG;
+  float dens = p->GetD();
+  float temp = p->GetT();
+  float u_bgr = mOpacity->GetEnergy(dens, 10.0) / ERGPERG_TO_JPERKG;
 
-    float dudt_norm = part[i]->GetDUDT();
-    float dudt = dudt_norm * 4.0 * SB * pow(temp, 4.0);
-    float beta = u * (omega / dudt);
+  float dudt_norm = p->GetDUDT();
+  float dudt = dudt_norm * 4.0 * SB * pow(temp, 4.0);
+  float beta = u * (omega / dudt);
 
-    part[i]->SetBeta(beta);
-  }
-  file->SetParticles(part);
+  p->SetBeta(beta);
 }
 
 void Application::InsertPlanet(SnapshotFile *file) {
@@ -806,10 +1386,31 @@ void Application::ReduceParticles(SnapshotFile *file) {
 
   float new_mass = part[0]->GetM() * (curr_num / final_num);
 
+  // Each particle gets a random key from its index, unique as the index
+  // fills the low bits, and the final_num smallest keys are kept. This draws
+  // without replacement and does not depend on the number of threads.
+  Random random(mParams->GetInt("SEED"), RANDOM_STREAM_REDUCE);
+  std::vector<uint64_t> keys(curr_num);
+  ParallelFor(curr_num, mParticleThreads, [&](int start, int end, int task) {
+    for (int i = start; i < end; ++i) {
+      uint32_t bits[4];
+      random.Generate(i, bits);
+      keys[i] = ((uint64_t)bits[0] << 32) | (uint32_t)i;
+    }
+  });
+
+  std::vector<uint64_t> sorted = keys;
+  std::nth_element(sorted.begin(), sorted.begin() + final_num - 1,
+                   sorted.end());
+  uint64_t threshold = sorted[final_num - 1];
+
   std::vector<Particle *> new_part;
-  for (int i = 0; i < final_num; ++i) {
-    int r = rand() % curr_num;
-    new_part.push_back(part[r]);
+  new_part.reserve(final_num);
+  for (int i = 0; i < curr_num; ++i) {
+    if (keys[i] <= threshold)
+      new_part.push_back(part[i]);
+    else
+      delete part[i];
   }
 
   for (int i = 0; i < final_num; ++i) {
@@ -818,13 +1419,36 @@ void Application::ReduceParticles(SnapshotFile *file) {
     new_part[i]->SetM(new_mass);
     new_part[i]->SetH(h);
   }
+  if (mSPHDensity) {
+    FindSPHDensity(new_part, mNumNeigh, mParticleThreads);
+  }
   file->SetNumGas(new_part.size());
   file->SetNameDataAppend(".reduced");
   file->SetParticles(new_part);
 }
 
 void Application::OutputInfo(SnapshotFile *file) {
-  std::vector<Particle *> part = file->GetParticles();
+  float gas_mass = 0.0, max_rho = 1E-30, max_temp = 1E-30;
+  TallyInfo(file->GetParticles(), gas_mass, max_rho, max_temp);
+  OutputInfo(file, gas_mass, max_rho, max_temp);
+}
+
+void Application::TallyInfo(const std::vector<Particle *> &part,
+                            float &gas_mass, float &max_rho, float &max_temp) {
+  for (int i = 0; i < part.size(); ++i) {
+    gas_mass += part.at(i)->GetM();
+    if (part.at(i)->GetD() > max_rho) {
+      max_rho = part.at(i)->GetD();
+    }
+
+    if (part.at(i)->GetT() > max_temp) {
+      max_temp = part.at(i)->GetT();
+    }
+  }
+}
+
+void Application::OutputInfo(SnapshotFile *file, const float gas_mass,
+                             const float max_rho, const float max_temp) {
   std::vector<Sink *> sink = file->GetSinks();
 
   for (int i = 0; i < 16; ++i)
@@ -834,8 +1458,7 @@ void Application::OutputInfo(SnapshotFile *file) {
     std::cout << "=====";
   std::cout << "\n";
 
-  float gas_mass = 0.0, total_mass = 0.0;
-  float max_rho = 1E-30, max_temp = 1E-30;
+  float total_mass = 0.0;
   for (int i = 0; i < sink.size(); ++i) {
     std::cout << "   Sink " << i + 1 << "\n";
     std::cout << "   Mass   = " << sink.at(i)->GetM() << "\n";
@@ -847,18 +1470,8 @@ void Application::OutputInfo(SnapshotFile *file) {
 
     total_mass += sink.at(i)->GetM();
   }
-  for (int i = 0; i < part.size(); ++i) {
-    gas_mass += part.at(i)->GetM();
-    if (part.at(i)->GetD() > max_rho) {
-      max_rho = part.at(i)->GetD();
-    }
-
-    if (part.at(i)->GetT() > max_temp) {
-      max_temp = part.at(i)->GetT();
-    }
-  }
   std::cout << "   Max density     : " << max_rho << " g/cm^3\n";
   std::cout << "   Max temperature : " << max_temp << " K\n";
   std::cout << "   Gas mass        : " << gas_mass << "\n";
   std::cout << "   Total mass      : " << gas_mass + total_mass << "\n";
-}
\ No newline at end of file
+}
@@ -0,0 +1,107 @@
+//===-- Catalogue.cpp -----------------------------------------------------===//
+//
+//                                  SPARGEL
+//                   Smoothed Particle Generator and Loader
+//
+// This file is distributed under the GNU General Public License. See LICENSE
+// for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Catalogue.cpp
+///
+//===----------------------------------------------------------------------===//
+
+#include "Catalogue.h"
+
+Catalogue::Catalogue(const int threads) : mThreads(std::max(1, threads)) {}
+
+Catalogue::~Catalogue() {}
+
+void Catalogue::Scan(const std::vector<File *> &files) {
+  mEntries.assign(files.size(), CatalogueEntry());
+  ParallelFor(files.size(), mThreads, [&](int start, int end, int task) {
+    for (int i = start; i < end; ++i) {
+      SnapshotFile *file = (SnapshotFile *)files[i];
+      CatalogueEntry &entry = mEntries[i];
+      entry.index = i;
+      entry.name = file->GetFileName();
+      entry.header = file->ReadHeader();
+      if (!entry.header)
+        continue;
+      entry.time = file->GetTime();
+      entry.num_gas = file->GetNumGas();
+      entry.num_dust = file->GetNumDust();
+      entry.num_sink = file->GetNumSinks();
+      entry.dim = file->GetDimensions();
+      entry.data_offset = file->GetDataOffset();
+      entry.size = file->GetFileSize();
+    }
+  });
+}
+
+std::vector<int> Catalogue::Select(const double time_min,
+                                   const double time_max,
+                                   const int stride) const {
+  std::vector<const CatalogueEntry *> window;
+  std::vector<bool> selected(mEntries.size(), false);
+  for (int i = 0; i < mEntries.size(); ++i) {
+    const CatalogueEntry &entry = mEntries[i];
+    if (!entry.header) {
+      selected[i] = true;
+    } else if (entry.time >= time_min &&
+               (time_max <= 0.0 || entry.time <= time_max)) {
+      window.push_back(&entry);
+    }
+  }
+
+  // Stride through the window in time order, but keep the input order
+  std::stable_sort(window.begin(), window.end(),
+                   [](const CatalogueEntry *a, const CatalogueEntry *b) {
+                     return a->time < b->time;
+                   });
+  for (int i = 0; i < window.size(); i += std::max(1, stride))
+    selected[window[i]->index] = true;
+
+  std::vector<int> selection;
+  for (int i = 0; i < selected.size(); ++i) {
+    if (selected[i])
+      selection.push_back(i);
+  }
+  return selection;
+}
+
+long Catalogue::GetNumParticles(const std::vector<int> &selection) const {
+  long num = 0;
+  for (int i = 0; i < selection.size(); ++i) {
+    const CatalogueEntry &entry = mEntries[selection[i]];
+    num += entry.num_gas + entry.num_dust;
+  }
+  return num;
+}
+
+long Catalogue::GetMaxParticles(const std::vector<int> &selection) const {
+  long num = 0;
+  for (int i = 0; i < selection.size(); ++i) {
+    const CatalogueEntry &entry = mEntries[selection[i]];
+    num = std::max(num, (long)entry.num_gas + entry.num_dust);
+  }
+  return num;
+}
+
+void Catalogue::Print() const {
+  for (int i = 0; i < mEntries.size(); ++i) {
+    const CatalogueEntry &entry = mEntries[i];
+    std::cout << "   " << entry.name;
+    if (!entry.header) {
+      std::cout << " : no header\n";
+      continue;
+    }
+    std::cout << " : t = " << entry.time << ", gas = " << entry.num_gas
+              << ", dust = " << entry.num_dust
+              << ", sinks = " << entry.num_sink << ", ndim = " << entry.dim
+              << ", data at " << entry.data_offset << " of " << entry.size
+              << " bytes\n";
+  }
+}
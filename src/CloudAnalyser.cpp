@@ -15,14 +15,15 @@
 
 #include "CloudAnalyser.h"
 
-CloudAnalyser::CloudAnalyser(NameData nd, const int avg)
-    : mNameData(nd), mAverage(avg) {
+CloudAnalyser::CloudAnalyser(NameData nd, const int avg, const int threads)
+    : mNameData(nd), mAverage(avg), mShards(threads) {
   mNameData.append += "cloud";
 }
 
 CloudAnalyser::~CloudAnalyser() { mMaxima.clear(); }
 
-void CloudAnalyser::FindCentralQuantities(SnapshotFile *file) {
+void CloudAnalyser::FindCentralQuantities(SnapshotFile *file,
+                                          const int task) {
   std::vector<Particle *> part = file->GetParticles();
 
   std::sort(part.begin(), part.end(),
@@ -35,17 +36,23 @@ void CloudAnalyser::FindCentralQuantities(SnapshotFile *file) {
   }
 
   CentralValue m;
+  m.time = file->GetTime();
   for (int i = 0; i < avgNum; ++i) {
     m.density += part[i]->GetD();
     m.temperature += part[i]->GetT();
   }
   m.density /= avgNum;
   m.temperature /= avgNum;
-  mMaxima.push_back(m);
+  mShards.Add(task, m);
 
   file->SetParticles(part);
 }
 
+void CloudAnalyser::Merge() {
+  mMaxima = mShards.Merge(
+      [](CentralValue a, CentralValue b) { return b.time > a.time; });
+}
+
 void CloudAnalyser::CenterAroundDensest(SnapshotFile *file) {
   std::vector<Particle *> part = file->GetParticles();
 
@@ -61,27 +61,84 @@ bool ColumnFile::Write(std::string fileName) {
   WriteHeaderForm(formatStream);
   WriteParticleForm(formatStream);
   WriteSinkForm(formatStream);
+  formatStream.Flush();
 
   mOutStream.close();
 
   return true;
 }
 
-void ColumnFile::AllocateMemory() {
-  for (int i = 0; i < mNumGas; ++i) {
-    Particle *p = new Particle();
-    mParticles.push_back(p);
+bool ColumnFile::BeginStream(std::string fileName, const int num_gas) {
+  mOutStream.open(fileName, std::ios::out);
+  if (!mOutStream.is_open()) {
+    std::cout << "   Could not open COLUMN file " << fileName
+              << " for writing!\n\n";
+    return false;
   }
 
+  std::cout << "   File output      : " << fileName << "\n";
+
+  mNumGas = num_gas;
+  mNumSink = mSinks.size();
+  WriteHeaderForm(Formatter(mOutStream, 18, 2, 10));
+
+  return true;
+}
+
+void ColumnFile::AppendStreamRows(const std::vector<double> &x,
+                                  const std::vector<double> &v,
+                                  const std::vector<double> &m,
+                                  const std::vector<double> &h,
+                                  const std::vector<double> &rho,
+                                  const std::vector<double> &u) {
+  Formatter formatStream(mOutStream, 18, 2, 10);
+  ParallelFormat(formatStream, m.size(), mThreads,
+                 [&](Formatter &f, int s, int e) {
+                   for (int i = s; i < e; ++i) {
+                     for (int j = 0; j < mDimensions; ++j) {
+                       f << x[3 * i + j] << "\t";
+                     }
+                     for (int j = 0; j < mDimensions; ++j) {
+                       f << v[3 * i + j] << "\t";
+                     }
+                     f << m[i] << "\t";
+                     f << h[i] << "\t";
+                     f << rho[i] << "\t";
+                     f << u[i] << "\n";
+                   }
+                 });
+}
+
+void ColumnFile::EndStream() {
+  WriteSinkForm(Formatter(mOutStream, 18, 2, 10));
+  mOutStream.close();
+}
+
+void ColumnFile::AllocateMemory() {
+  // Particles are created as they pass the read filter
   for (int i = 0; i < mNumSink; ++i) {
     Sink *s = new Sink();
     mSinks.push_back(s);
   }
 }
 
+bool ColumnFile::ReadHeader() {
+  mInStream.open(mNameData.name);
+  if (!mInStream.is_open())
+    return false;
+
+  bool read = ReadHeaderForm();
+  if (read)
+    RecordOffsets();
+  mInStream.close();
+
+  return read;
+}
+
 bool ColumnFile::ReadHeaderForm() {
   mInStream >> mNumGas >> mNumSink >> mDimensions >> mTime;
   mNumTot = mNumGas + mNumSink;
+  return !mInStream.fail();
 }
 
 void ColumnFile::ReadParticleForm() {
@@ -90,13 +147,21 @@ void ColumnFile::ReadParticleForm() {
     mInStream >> temp[0] >> temp[1] >> temp[2] >> temp[3] >> temp[4] >>
         temp[5] >> temp[6] >> temp[7] >> temp[8] >> temp[9];
 
-    mParticles[i]->SetX(Vec3(temp[0], temp[1], temp[2]));
-    mParticles[i]->SetV(Vec3(temp[3], temp[4], temp[5]));
-    mParticles[i]->SetM(temp[6]);
-    mParticles[i]->SetH(temp[7]);
-    mParticles[i]->SetD(temp[8]);
-    mParticles[i]->SetU(temp[9]);
+    // Rows hold every column, so the filter is tested row by row
+    Vec3 x = Vec3(temp[0], temp[1], temp[2]);
+    if (!mFilter.PassType(GAS_TYPE) || !mFilter.Pass(x))
+      continue;
+    Particle *p = new Particle();
+    p->SetX(x);
+    p->SetV(Vec3(temp[3], temp[4], temp[5]));
+    p->SetM(temp[6]);
+    p->SetH(temp[7]);
+    p->SetD(temp[8]);
+    p->SetU(temp[9]);
+    mParticles.push_back(p);
   }
+  mNumGas = mParticles.size();
+  mNumTot = mNumGas + mNumSink;
 }
 
 void ColumnFile::ReadSinkForm() {
@@ -122,18 +187,22 @@ void ColumnFile::WriteHeaderForm(Formatter formatStream) {
 }
 
 void ColumnFile::WriteParticleForm(Formatter formatStream) {
-  for (int i = 0; i < mNumGas; ++i) {
-    for (int j = 0; j < mDimensions; ++j) {
-      formatStream << mParticles[i]->GetX()[j] << "\t";
-    }
-    for (int j = 0; j < mDimensions; ++j) {
-      formatStream << mParticles[i]->GetV()[j] << "\t";
-    }
-    formatStream << mParticles[i]->GetM() << "\t";
-    formatStream << mParticles[i]->GetH() << "\t";
-    formatStream << mParticles[i]->GetD() << "\t";
-    formatStream << mParticles[i]->GetU() << "\n";
-  }
+  std::vector<Particle *> &part = mParticles;
+  ParallelFormat(formatStream, mNumGas, mThreads,
+                 [&](Formatter &f, int s, int e) {
+                   for (int i = s; i < e; ++i) {
+                     for (int j = 0; j < mDimensions; ++j) {
+                       f << part[i]->GetX()[j] << "\t";
+                     }
+                     for (int j = 0; j < mDimensions; ++j) {
+                       f << part[i]->GetV()[j] << "\t";
+                     }
+                     f << part[i]->GetM() << "\t";
+                     f << part[i]->GetH() << "\t";
+                     f << part[i]->GetD() << "\t";
+                     f << part[i]->GetU() << "\n";
+                   }
+                 });
 }
 
 void ColumnFile::WriteSinkForm(Formatter formatStream) {
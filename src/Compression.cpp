@@ -0,0 +1,749 @@
+//===-- Compression.cpp ---------------------------------------------------===//
+//
+//                                  SPARGEL
+//                   Smoothed Particle Generator and Loader
+//
+// This file is distributed under the GNU General Public License. See LICENSE
+// for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Compression.cpp
+///
+//===----------------------------------------------------------------------===//
+
+#include "Compression.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <limits>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#ifdef SPARGEL_ZSTD
+#include <zstd.h>
+#endif
+
+#include "Parallel.h"
+
+// Fixed part of the gzip member header written for each block, including
+// the extra field which records the member size
+static const int GZIP_HEADER = 20;
+static const int GZIP_TRAILER = 8;
+// Particle data gains little from slower levels
+static const int GZIP_LEVEL = 1;
+static const int ZSTD_LEVEL = 1;
+
+static unsigned long ReadLE(const unsigned char *data, const int bytes) {
+  unsigned long value = 0;
+  for (int i = bytes - 1; i >= 0; --i)
+    value = (value << 8) | data[i];
+  return value;
+}
+
+static void WriteLE(unsigned char *data, unsigned long value,
+                    const int bytes) {
+  for (int i = 0; i < bytes; ++i) {
+    data[i] = value & 0xff;
+    value >>= 8;
+  }
+}
+
+static bool EndsWith(const std::string &str, const std::string &suffix) {
+  return str.size() >= suffix.size() &&
+         str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+Codec DetectCodec(const std::string &fileName) {
+  unsigned char magic[4] = {0, 0, 0, 0};
+  FILE *file = fopen(fileName.c_str(), "rb");
+  if (file == NULL)
+    return Codec::None;
+  size_t n = fread(magic, 1, 4, file);
+  fclose(file);
+
+  if (n >= 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+    return Codec::Gzip;
+  if (n == 4 && ReadLE(magic, 4) == 0xFD2FB528)
+    return Codec::Zstd;
+  return Codec::None;
+}
+
+Codec SuffixCodec(const std::string &fileName) {
+  if (EndsWith(fileName, ".gz"))
+    return Codec::Gzip;
+  if (EndsWith(fileName, ".zst"))
+    return Codec::Zstd;
+  return Codec::None;
+}
+
+std::string StripCodecSuffix(const std::string &fileName) {
+  if (EndsWith(fileName, ".gz"))
+    return fileName.substr(0, fileName.size() - 3);
+  if (EndsWith(fileName, ".zst"))
+    return fileName.substr(0, fileName.size() - 4);
+  return fileName;
+}
+
+std::string AddCodecSuffix(const std::string &fileName,
+                           const std::string &codec) {
+  if (codec == "gz" || codec == "zst")
+    return fileName + "." + codec;
+  return fileName;
+}
+
+bool CodecAvailable(const std::string &codec) {
+#ifdef SPARGEL_ZSTD
+  if (codec == "zst")
+    return true;
+#endif
+  return codec == "none" || codec == "gz";
+}
+
+bool StreamCompressed(const std::string &fileName) {
+  if (DetectCodec(fileName) == Codec::None)
+    return false;
+  CompressedFile file;
+  return file.Open(fileName) && !file.Indexed();
+}
+
+/// Compresses n bytes into out as one gzip member or zstd frame.
+static bool CompressBlock(const Codec codec, const char *data, const long n,
+                          std::vector<char> &out) {
+  if (codec == Codec::Gzip) {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, GZIP_LEVEL, Z_DEFLATED, -15, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK)
+      return false;
+    long bound = deflateBound(&zs, n);
+    out.resize(GZIP_HEADER + bound + GZIP_TRAILER);
+    zs.next_in = (Bytef *)data;
+    zs.avail_in = n;
+    zs.next_out = (Bytef *)&out[GZIP_HEADER];
+    zs.avail_out = bound;
+    int result = deflate(&zs, Z_FINISH);
+    long deflated = zs.total_out;
+    deflateEnd(&zs);
+    if (result != Z_STREAM_END)
+      return false;
+
+    // Header with an extra field "SP" holding the member size, then the
+    // CRC and size of the data
+    long member = GZIP_HEADER + deflated + GZIP_TRAILER;
+    out.resize(member);
+    unsigned char *header = (unsigned char *)&out[0];
+    const unsigned char fixed[16] = {0x1f, 0x8b, 8, 4,   0, 0, 0, 0,
+                                     0,    0xff, 8, 0, 'S', 'P', 4, 0};
+    memcpy(header, fixed, 16);
+    WriteLE(header + 16, member, 4);
+    unsigned char *trailer = header + GZIP_HEADER + deflated;
+    WriteLE(trailer, crc32(0, (const Bytef *)data, n), 4);
+    WriteLE(trailer + 4, n, 4);
+    return true;
+  }
+#ifdef SPARGEL_ZSTD
+  if (codec == Codec::Zstd) {
+    out.resize(ZSTD_compressBound(n));
+    size_t size = ZSTD_compress(&out[0], out.size(), data, n, ZSTD_LEVEL);
+    if (ZSTD_isError(size))
+      return false;
+    out.resize(size);
+    return true;
+  }
+#endif
+  return false;
+}
+
+CompressedFile::~CompressedFile() { Close(); }
+
+bool CompressedFile::Open(const std::string &fileName) {
+  Close();
+  int file = open(fileName.c_str(), O_RDONLY);
+  if (file < 0)
+    return false;
+  struct stat info;
+  if (fstat(file, &info) != 0 || info.st_size < 4) {
+    close(file);
+    return false;
+  }
+  void *map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+  close(file);
+  if (map == MAP_FAILED)
+    return false;
+  mData = (const unsigned char *)map;
+  mBytes = info.st_size;
+
+  if (mData[0] == 0x1f && mData[1] == 0x8b) {
+    mCodec = Codec::Gzip;
+    IndexGzip();
+  } else if (ReadLE(mData, 4) == 0xFD2FB528) {
+    mCodec = Codec::Zstd;
+    IndexZstd();
+  } else {
+    Close();
+    return false;
+  }
+#ifndef SPARGEL_ZSTD
+  if (mCodec == Codec::Zstd) {
+    std::cout << "   " << fileName << " is zstd compressed, build with ZSTD=1 "
+              << "to read it\n";
+    Close();
+    return false;
+  }
+#endif
+  madvise((void *)mData, mBytes, MADV_SEQUENTIAL);
+  return true;
+}
+
+void CompressedFile::Close() {
+  EndStream();
+  if (mData != NULL)
+    munmap((void *)mData, mBytes);
+  mData = NULL;
+  mBytes = 0;
+  mCodec = Codec::None;
+  mIndexed = false;
+  mBlocks.clear();
+  mSize = 0;
+}
+
+void CompressedFile::IndexGzip() {
+  long pos = 0, start = 0;
+  mIndexed = true;
+  while (pos < mBytes && mIndexed) {
+    // Only members as written by CompressBlock have a known size
+    const unsigned char *header = mData + pos;
+    mIndexed = pos + GZIP_HEADER + GZIP_TRAILER <= mBytes &&
+               header[0] == 0x1f && header[1] == 0x8b && header[2] == 8 &&
+               header[3] == 4 && ReadLE(header + 10, 2) == 8 &&
+               header[12] == 'S' && header[13] == 'P' &&
+               ReadLE(header + 14, 2) == 4;
+    if (!mIndexed)
+      break;
+    long member = ReadLE(header + 16, 4);
+    mIndexed = member >= GZIP_HEADER + GZIP_TRAILER && pos + member <= mBytes;
+    if (!mIndexed)
+      break;
+
+    CompressedBlock block;
+    block.offset = pos + GZIP_HEADER;
+    block.bytes = member - GZIP_HEADER - GZIP_TRAILER;
+    block.start = start;
+    block.size = ReadLE(header + member - 4, 4);
+    mBlocks.push_back(block);
+    start += block.size;
+    pos += member;
+  }
+
+  if (mIndexed) {
+    mSize = start;
+  } else {
+    mBlocks.clear();
+    mSize = ReadLE(mData + mBytes - 4, 4);
+  }
+}
+
+void CompressedFile::IndexZstd() {
+  mIndexed = false;
+  mSize = -1;
+#ifdef SPARGEL_ZSTD
+  long pos = 0, start = 0;
+  mIndexed = true;
+  while (pos < mBytes && mIndexed) {
+    size_t bytes = ZSTD_findFrameCompressedSize(mData + pos, mBytes - pos);
+    unsigned long long size =
+        ZSTD_getFrameContentSize(mData + pos, mBytes - pos);
+    mIndexed = !ZSTD_isError(bytes) && size != ZSTD_CONTENTSIZE_UNKNOWN &&
+               size != ZSTD_CONTENTSIZE_ERROR;
+    if (!mIndexed)
+      break;
+
+    CompressedBlock block;
+    block.offset = pos;
+    block.bytes = bytes;
+    block.start = start;
+    block.size = size;
+    mBlocks.push_back(block);
+    start += size;
+    pos += bytes;
+  }
+
+  if (mIndexed) {
+    mSize = start;
+  } else {
+    mBlocks.clear();
+  }
+#endif
+}
+
+bool CompressedFile::DecompressBlock(const int i, char *data) const {
+  const CompressedBlock &block = mBlocks[i];
+  if (block.size == 0)
+    return true;
+  if (mCodec == Codec::Gzip) {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, -15) != Z_OK)
+      return false;
+    zs.next_in = (Bytef *)(mData + block.offset);
+    zs.avail_in = block.bytes;
+    zs.next_out = (Bytef *)data;
+    zs.avail_out = block.size;
+    int result = inflate(&zs, Z_FINISH);
+    long size = zs.total_out;
+    inflateEnd(&zs);
+    return result == Z_STREAM_END && size == block.size;
+  }
+#ifdef SPARGEL_ZSTD
+  if (mCodec == Codec::Zstd) {
+    size_t size =
+        ZSTD_decompress(data, block.size, mData + block.offset, block.bytes);
+    return !ZSTD_isError(size) && size == block.size;
+  }
+#endif
+  return false;
+}
+
+long CompressedFile::Next(char *data, const long capacity) {
+  // Input is passed at most this much at a time, to fit zlib's counters
+  const long INPUT_STEP = 1L << 30;
+
+  if (mCodec == Codec::Gzip) {
+    if (mStream == NULL) {
+      z_stream *zs = new z_stream;
+      memset(zs, 0, sizeof(*zs));
+      // Accept a gzip header, for each member in turn
+      if (inflateInit2(zs, 15 + 32) != Z_OK) {
+        delete zs;
+        return -1;
+      }
+      mStream = zs;
+    }
+    z_stream *zs = (z_stream *)mStream;
+    long produced = 0;
+    while (produced == 0 && mConsumed < mBytes) {
+      long input = std::min(INPUT_STEP, mBytes - mConsumed);
+      zs->next_in = (Bytef *)(mData + mConsumed);
+      zs->avail_in = input;
+      zs->next_out = (Bytef *)data;
+      zs->avail_out = std::min(capacity, INPUT_STEP);
+      int result = inflate(zs, Z_NO_FLUSH);
+      mConsumed += input - zs->avail_in;
+      produced = std::min(capacity, INPUT_STEP) - zs->avail_out;
+      if (result == Z_STREAM_END) {
+        inflateReset(zs);
+      } else if (result != Z_OK) {
+        return -1;
+      }
+    }
+    return produced;
+  }
+#ifdef SPARGEL_ZSTD
+  if (mCodec == Codec::Zstd) {
+    if (mStream == NULL)
+      mStream = ZSTD_createDCtx();
+    ZSTD_DCtx *dctx = (ZSTD_DCtx *)mStream;
+    long produced = 0;
+    while (produced == 0 && mConsumed < mBytes) {
+      ZSTD_inBuffer in = {mData + mConsumed, (size_t)(mBytes - mConsumed), 0};
+      ZSTD_outBuffer out = {data, (size_t)capacity, 0};
+      size_t result = ZSTD_decompressStream(dctx, &out, &in);
+      if (ZSTD_isError(result))
+        return -1;
+      mConsumed += in.pos;
+      produced = out.pos;
+    }
+    return produced;
+  }
+#endif
+  return -1;
+}
+
+void CompressedFile::EndStream() {
+  if (mStream != NULL) {
+    if (mCodec == Codec::Gzip) {
+      inflateEnd((z_stream *)mStream);
+      delete (z_stream *)mStream;
+    }
+#ifdef SPARGEL_ZSTD
+    if (mCodec == Codec::Zstd)
+      ZSTD_freeDCtx((ZSTD_DCtx *)mStream);
+#endif
+  }
+  mStream = NULL;
+  mConsumed = 0;
+}
+
+CompressBuf::CompressBuf(const Codec codec, const int threads)
+    : mCodec(codec), mThreads(std::max(1, threads)),
+      mBuffer((long)mThreads * BLOCK_SIZE) {}
+
+CompressBuf::~CompressBuf() { Close(); }
+
+bool CompressBuf::Open(const std::string &fileName) {
+  mFile = fopen(fileName.c_str(), "wb");
+  mWritten = 0;
+  setp(&mBuffer[0], &mBuffer[0] + mBuffer.size());
+  return mFile != NULL;
+}
+
+bool CompressBuf::Close() {
+  if (mFile == NULL)
+    return true;
+  bool written = Compress();
+  written = (fclose(mFile) == 0) && written;
+  mFile = NULL;
+  return written;
+}
+
+int CompressBuf::overflow(int c) {
+  if (!Compress())
+    return traits_type::eof();
+  if (c != traits_type::eof()) {
+    *pptr() = c;
+    pbump(1);
+  }
+  return traits_type::not_eof(c);
+}
+
+// Blocks are only cut when full or at the end, so a flush keeps them whole
+int CompressBuf::sync() { return 0; }
+
+std::streampos CompressBuf::seekoff(std::streamoff off,
+                                    std::ios_base::seekdir dir,
+                                    std::ios_base::openmode which) {
+  // Only the current position can be asked for or sought to
+  long pos = mWritten + (pptr() - pbase());
+  if ((dir == std::ios::cur && off == 0) ||
+      (dir == std::ios::beg && off == pos))
+    return pos;
+  return std::streampos(std::streamoff(-1));
+}
+
+std::streampos CompressBuf::seekpos(std::streampos pos,
+                                    std::ios_base::openmode which) {
+  return seekoff(pos, std::ios::beg, which);
+}
+
+bool CompressBuf::Compress() {
+  long n = pptr() - pbase();
+  if (n == 0 || mFile == NULL)
+    return mFile != NULL;
+
+  int num_blocks = (n + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  std::vector<std::vector<char>> out(num_blocks);
+  std::atomic<bool> compressed(true);
+  ParallelFor(num_blocks, mThreads, [&](int start, int end, int task) {
+    for (int i = start; i < end; ++i) {
+      long first = (long)i * BLOCK_SIZE;
+      if (!CompressBlock(mCodec, pbase() + first,
+                         std::min((long)BLOCK_SIZE, n - first), out[i]))
+        compressed = false;
+    }
+  });
+
+  bool written = compressed;
+  for (int i = 0; i < num_blocks && written; ++i)
+    written = fwrite(&out[i][0], 1, out[i].size(), mFile) == out[i].size();
+  mWritten += n;
+  setp(&mBuffer[0], &mBuffer[0] + mBuffer.size());
+  return written;
+}
+
+DecompressBuf::DecompressBuf(const int threads)
+    : mThreads(std::max(1, threads)) {}
+
+bool DecompressBuf::Open(const std::string &fileName) {
+  mNextBlock = 0;
+  mStart = 0;
+  setg(NULL, NULL, NULL);
+  return mFile.Open(fileName);
+}
+
+void DecompressBuf::Close() {
+  mFile.Close();
+  mBuffer.clear();
+  mBuffer.shrink_to_fit();
+  setg(NULL, NULL, NULL);
+}
+
+int DecompressBuf::underflow() {
+  if (gptr() < egptr())
+    return traits_type::to_int_type(*gptr());
+  mStart += egptr() - eback();
+
+  long size = 0;
+  if (mFile.Indexed()) {
+    // Decompress the next block for each thread together
+    const std::vector<CompressedBlock> &blocks = mFile.GetBlocks();
+    int count = std::min(mThreads, (int)blocks.size() - mNextBlock);
+    if (count <= 0)
+      return traits_type::eof();
+    int first = mNextBlock;
+    size = blocks[first + count - 1].start + blocks[first + count - 1].size -
+           blocks[first].start;
+    mBuffer.resize(std::max(1L, size));
+    std::atomic<bool> decompressed(true);
+    ParallelFor(count, mThreads, [&](int start, int end, int task) {
+      for (int i = first + start; i < first + end; ++i) {
+        if (!mFile.DecompressBlock(
+                i, &mBuffer[blocks[i].start - blocks[first].start]))
+          decompressed = false;
+      }
+    });
+    mNextBlock += count;
+    if (!decompressed)
+      return traits_type::eof();
+  } else {
+    mBuffer.resize(1 << 20);
+    size = mFile.Next(&mBuffer[0], mBuffer.size());
+    if (size <= 0)
+      return traits_type::eof();
+  }
+
+  setg(&mBuffer[0], &mBuffer[0], &mBuffer[0] + size);
+  // Blocks holding nothing are passed over
+  if (size == 0)
+    return underflow();
+  return traits_type::to_int_type(*gptr());
+}
+
+std::streampos DecompressBuf::seekoff(std::streamoff off,
+                                      std::ios_base::seekdir dir,
+                                      std::ios_base::openmode which) {
+  // Only the current position can be asked for
+  if (dir == std::ios::cur && off == 0)
+    return mStart + (gptr() - eback());
+  return std::streampos(std::streamoff(-1));
+}
+
+void InFileStream::open(const std::string &fileName,
+                        std::ios_base::openmode mode) {
+  close();
+  mFileName = fileName;
+  mCompressed = DetectCodec(fileName) != Codec::None;
+  if (mCompressed) {
+    mDecompress.SetThreads(mThreads);
+    mOpen = mDecompress.Open(fileName);
+    rdbuf(&mDecompress);
+  } else {
+    mOpen = mFileBuf.open(fileName, mode | std::ios::in) != NULL;
+    rdbuf(&mFileBuf);
+  }
+  if (!mOpen)
+    setstate(std::ios::failbit);
+}
+
+void InFileStream::close() {
+  if (!mOpen)
+    return;
+  if (mCompressed)
+    mDecompress.Close();
+  else
+    mFileBuf.close();
+  mOpen = false;
+}
+
+long InFileStream::Size() {
+  if (mCompressed)
+    return mDecompress.Size();
+  struct stat info;
+  return (stat(mFileName.c_str(), &info) == 0) ? info.st_size : -1;
+}
+
+void OutFileStream::open(const std::string &fileName,
+                         std::ios_base::openmode mode, const bool in_order) {
+  close();
+  mFileName = fileName;
+  mStagedName = "";
+  Codec codec = SuffixCodec(fileName);
+  if (codec != Codec::None && !CodecAvailable((codec == Codec::Gzip) ? "gz"
+                                                                      : "zst"))
+    codec = Codec::None;
+
+  if (codec != Codec::None && in_order) {
+    mCompress = new CompressBuf(codec, mThreads);
+    mOpen = mCompress->Open(fileName);
+    rdbuf(mCompress);
+  } else {
+    if (codec != Codec::None)
+      mStagedName = fileName + ".part";
+    mOpen = mFileBuf.open((mStagedName == "") ? fileName : mStagedName,
+                          mode | std::ios::out) != NULL;
+    rdbuf(&mFileBuf);
+  }
+  if (!mOpen)
+    setstate(std::ios::failbit);
+}
+
+void OutFileStream::close() {
+  if (!mOpen)
+    return;
+  flush();
+  bool written = true;
+  if (mCompress != NULL) {
+    written = mCompress->Close();
+    delete mCompress;
+    mCompress = NULL;
+  } else {
+    mFileBuf.close();
+  }
+
+  // Compress a file written out of order now it is complete
+  if (mStagedName != "") {
+    CompressBuf compress(SuffixCodec(mFileName), mThreads);
+    std::ifstream staged(mStagedName, std::ios::binary);
+    written = staged.is_open() && compress.Open(mFileName);
+    std::vector<char> buffer(CompressBuf::BLOCK_SIZE);
+    while (written && staged) {
+      staged.read(&buffer[0], buffer.size());
+      compress.sputn(&buffer[0], staged.gcount());
+    }
+    written = compress.Close() && written;
+    staged.close();
+    remove(mStagedName.c_str());
+    mStagedName = "";
+  }
+  if (!written)
+    std::cout << "   Could not compress " << mFileName << "!\n";
+  rdbuf(NULL);
+  mOpen = false;
+}
+
+CompressedBackend::CompressedBackend(const Codec codec)
+    : IOBackend((codec == Codec::Zstd) ? "zstd" : "gzip",
+                (codec == Codec::Zstd) ? 5 : 4) {}
+
+bool CompressedBackend::Open(const std::string &fileName) {
+  mCache.clear();
+  mWindow.clear();
+  mWindowStart = 0;
+  mStreamSize = -1;
+  mFileName = fileName;
+  return mFile.Open(fileName);
+}
+
+void CompressedBackend::Close() {
+  mFile.Close();
+  mCache.clear();
+  mWindow.clear();
+  mWindow.shrink_to_fit();
+  mWindowStart = 0;
+  mStreamSize = -1;
+}
+
+long CompressedBackend::Size() {
+  // Without a recorded size the whole file must be decompressed once
+  if (mFile.Size() < 0) {
+    if (mStreamSize < 0) {
+      char byte;
+      ReadAt(&byte, 1, std::numeric_limits<long>::max() - 1);
+      mStreamSize = mWindowStart + mWindow.size();
+    }
+    return mStreamSize;
+  }
+  return mFile.Size();
+}
+
+long CompressedBackend::ReadAt(char *data, const long bytes,
+                               const long offset) {
+  if (!mFile.Indexed()) {
+    // Only a window of the stream is held, from the lowest offset still
+    // needed, as the readers move forward through the file. Reading behind
+    // it starts the stream again.
+    const long STEP = 1 << 22;
+    if (offset < mWindowStart) {
+      mFile.Rewind();
+      mWindow.clear();
+      mWindowStart = 0;
+    }
+    while (mWindowStart + (long)mWindow.size() < offset + bytes) {
+      long drop = std::min(offset - mWindowStart, (long)mWindow.size());
+      if (drop >= STEP) {
+        mWindow.erase(mWindow.begin(), mWindow.begin() + drop);
+        mWindowStart += drop;
+      }
+      long held = mWindow.size();
+      mWindow.resize(held + STEP);
+      long n = mFile.Next(&mWindow[held], STEP);
+      mWindow.resize(held + std::max(0L, n));
+      if (n <= 0)
+        break;
+    }
+    long end = mWindowStart + mWindow.size();
+    if (offset >= end)
+      return 0;
+    long n = std::min(bytes, end - offset);
+    memcpy(data, &mWindow[offset - mWindowStart], n);
+    return n;
+  }
+
+  const std::vector<CompressedBlock> &blocks = mFile.GetBlocks();
+  long end = std::min(offset + bytes, mFile.Size());
+  if (offset >= end)
+    return 0;
+
+  int first = 0, last = blocks.size();
+  while (last - first > 1) {
+    int mid = (first + last) / 2;
+    if (blocks[mid].start <= offset)
+      first = mid;
+    else
+      last = mid;
+  }
+
+  // Blocks lying wholly in the range are decompressed straight into it, in
+  // parallel, and the parts of any others copied from the cache
+  std::vector<int> whole;
+  bool read = true;
+  for (int i = first; i < blocks.size() && blocks[i].start < end && read;
+       ++i) {
+    long block_end = blocks[i].start + blocks[i].size;
+    if (blocks[i].start >= offset && block_end <= end) {
+      whole.push_back(i);
+      continue;
+    }
+    const char *block = CachedBlock(i);
+    read = block != NULL;
+    if (read) {
+      long from = std::max(offset, blocks[i].start);
+      long to = std::min(end, block_end);
+      memcpy(data + from - offset, block + from - blocks[i].start, to - from);
+    }
+  }
+  std::atomic<bool> decompressed(read);
+  ParallelFor(whole.size(), mThreads, [&](int start, int stop, int task) {
+    for (int j = start; j < stop; ++j) {
+      int i = whole[j];
+      if (!mFile.DecompressBlock(i, data + blocks[i].start - offset))
+        decompressed = false;
+    }
+  });
+
+  if (!decompressed) {
+    std::cout << "   Corrupt compressed data in " << mFileName << "!\n";
+    return 0;
+  }
+  return end - offset;
+}
+
+const char *CompressedBackend::CachedBlock(const int i) {
+  for (int c = 0; c < mCache.size(); ++c) {
+    if (mCache[c].first == i)
+      return &mCache[c].second[0];
+  }
+  if (mCache.size() >= CACHED_BLOCKS)
+    mCache.erase(mCache.begin());
+  long size = std::max(1L, mFile.GetBlocks()[i].size);
+  mCache.push_back(std::make_pair(i, std::vector<char>(size)));
+  if (!mFile.DecompressBlock(i, &mCache.back().second[0])) {
+    mCache.pop_back();
+    return NULL;
+  }
+  return &mCache.back().second[0];
+}
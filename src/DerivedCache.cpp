@@ -0,0 +1,485 @@
+//===-- DerivedCache.cpp --------------------------------------------------===//
+//
+//                                  SPARGEL
+//                   Smoothed Particle Generator and Loader
+//
+// This file is distributed under the GNU General Public License. See LICENSE
+// for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// DerivedCache.cpp
+///
+//===----------------------------------------------------------------------===//
+
+#include "DerivedCache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+#include <unordered_map>
+
+static const std::string CACHE_MAGIC = "SPARGELD";
+static const int CACHE_VERSION = 1;
+static const int MAX_NAME = 256;
+static const long KEY_BYTES = 1 << 16; // Leading and trailing bytes hashed
+static const long COPY_BYTES = 1 << 20;
+
+static inline void Mix(unsigned long &h, const unsigned long v) {
+  h ^= v * 0x9E3779B97F4A7C15UL;
+  h = ((h << 31) | (h >> 33)) * 0xC2B2AE3D27D4EB4FUL;
+}
+
+static inline unsigned long Bits(const float v) {
+  unsigned int bits;
+  memcpy(&bits, &v, sizeof(bits));
+  return bits;
+}
+
+static inline unsigned long Bits(const double v) {
+  unsigned long bits;
+  memcpy(&bits, &v, sizeof(bits));
+  return bits;
+}
+
+// The particle data in the given groups of STAGE_* and DERIVED_* bits. The
+// identity, mass and the thermal quantities read from the snapshot are
+// always included.
+static void HashParticle(unsigned long &h, Particle *p, const int groups) {
+  Mix(h, p->GetID());
+  Mix(h, p->GetType());
+  Mix(h, Bits(p->GetM()));
+  Mix(h, Bits(p->GetU()));
+  Mix(h, Bits(p->GetT()));
+  if (groups & STAGE_POSITION) {
+    Vec3 x = p->GetX(), v = p->GetV();
+    for (int j = 0; j < 3; ++j) {
+      Mix(h, Bits(x[j]));
+      Mix(h, Bits(v[j]));
+    }
+    Mix(h, Bits(p->GetR()));
+  }
+  if (groups & STAGE_DENSITY) {
+    Mix(h, Bits(p->GetD()));
+    Mix(h, Bits(p->GetH()));
+  }
+  if (groups & STAGE_GRAVITY) {
+    Vec3 a = p->GetA();
+    for (int j = 0; j < 3; ++j)
+      Mix(h, Bits(a[j]));
+    Mix(h, Bits(p->GetPhi()));
+  }
+  if (groups & DERIVED_THERMO) {
+    Mix(h, Bits(p->GetP()));
+    Mix(h, Bits(p->GetCS()));
+    Mix(h, Bits(p->GetKappa()));
+    Mix(h, Bits(p->GetSigma()));
+    Mix(h, Bits(p->GetTau()));
+    Mix(h, Bits(p->GetDUDT()));
+  }
+  if (groups & DERIVED_TOOMRE) {
+    Mix(h, Bits(p->GetOmega()));
+    Mix(h, Bits(p->GetQ()));
+  }
+  if (groups & DERIVED_ENERGY) {
+    for (int j = 0; j < 4; ++j)
+      Mix(h, Bits(p->GetEnergy(j)));
+  }
+  if (groups & DERIVED_BETA)
+    Mix(h, Bits(p->GetBeta()));
+}
+
+DerivedCache::DerivedCache(const std::string &fileName,
+                           const unsigned long config,
+                           const std::string &backend, const int threads)
+    : mFileName(fileName), mSidecarName(fileName + ".derived"),
+      mConfig(config), mThreads(std::max(1, threads)) {
+  mFileKey = FileKey();
+
+  IOBackend *io = IOBackend::Create(backend);
+  if (!io->Open(mSidecarName)) {
+    delete io;
+    return;
+  }
+  mBR = new BinaryReader(io);
+  ReadDirectory();
+}
+
+DerivedCache::~DerivedCache() { delete mBR; }
+
+unsigned long DerivedCache::Hash(const char *data, const long bytes,
+                                 unsigned long seed) {
+  unsigned long h = seed;
+  long i = 0;
+  for (; i + 8 <= bytes; i += 8) {
+    unsigned long word;
+    memcpy(&word, data + i, sizeof(word));
+    Mix(h, word);
+  }
+  unsigned long tail = 0;
+  memcpy(&tail, data + i, bytes - i);
+  Mix(h, tail);
+  Mix(h, bytes);
+  return h;
+}
+
+unsigned long DerivedCache::HashFile(const std::string &fileName) {
+  std::ifstream in(fileName, std::ios::binary);
+  if (!in.is_open())
+    return 0;
+  std::stringstream contents;
+  contents << in.rdbuf();
+  std::string str = contents.str();
+  return Hash(str.data(), str.size());
+}
+
+unsigned long DerivedCache::FileKey() {
+  struct stat info;
+  if (stat(mFileName.c_str(), &info) != 0)
+    return 0;
+  unsigned long h = 0;
+  Mix(h, info.st_size);
+  Mix(h, info.st_mtim.tv_sec);
+  Mix(h, info.st_mtim.tv_nsec);
+
+  // Rewritten within the timestamp resolution, the ends will differ
+  std::ifstream in(mFileName, std::ios::binary);
+  long size = info.st_size;
+  std::vector<char> bytes(std::min(size, KEY_BYTES));
+  if (bytes.size() > 0) {
+    in.read(&bytes[0], bytes.size());
+    h = Hash(&bytes[0], in.gcount(), h);
+    in.clear();
+    in.seekg(size - bytes.size());
+    in.read(&bytes[0], bytes.size());
+    h = Hash(&bytes[0], in.gcount(), h);
+  }
+  return h;
+}
+
+void DerivedCache::ReadDirectory() {
+  long size = mBR->Size();
+  std::vector<char> magic(CACHE_MAGIC.size());
+  int version = 0, num_entries = 0;
+  unsigned long file_key = 0;
+  mBR->ReadBytes(&magic[0], magic.size());
+  mBR->ReadValue(version);
+  mBR->ReadValue(file_key);
+  mBR->ReadValue(num_entries);
+  if (std::string(magic.begin(), magic.end()) != CACHE_MAGIC ||
+      version != CACHE_VERSION || file_key != mFileKey) {
+    // Another snapshot, or this one rewritten, so start again
+    delete mBR;
+    mBR = NULL;
+    return;
+  }
+
+  for (int e = 0; e < num_entries; ++e) {
+    Entry entry;
+    int length = 0;
+    mBR->ReadValue(length);
+    if (length < 0 || length > MAX_NAME)
+      break;
+    std::vector<char> name(length);
+    if (length > 0)
+      mBR->ReadBytes(&name[0], length);
+    entry.name = std::string(name.begin(), name.end());
+    mBR->ReadValue(entry.state);
+    mBR->ReadValue(entry.writes);
+    mBR->ReadValue(entry.count);
+    entry.offset = mBR->Tell();
+    entry.bytes = ColumnBytes(entry.writes, entry.count);
+    // Drop a truncated sidecar from here on
+    if (entry.count < 0 || entry.offset + entry.bytes > size)
+      break;
+    mBR->Seek(entry.offset + entry.bytes);
+    mEntries.push_back(entry);
+  }
+}
+
+unsigned long DerivedCache::StateHash(const Stage &stage,
+                                      SnapshotFile *file) {
+  // What a stage overwrites may also be read by it, e.g. the column
+  // densities by the thermal quantities, so both are hashed
+  int groups = stage.reads | stage.writes;
+  std::vector<Particle *> part = file->GetParticles();
+  unsigned long h = Hash(stage.name.data(), stage.name.size(), mConfig);
+  Mix(h, groups);
+  Mix(h, part.size());
+
+  // Blocks are fixed in size so the hash does not depend on the threads
+  int num = part.size();
+  int blocks = (num + HASH_BLOCK - 1) / HASH_BLOCK;
+  std::vector<unsigned long> block_hash(blocks);
+  ParallelFor(blocks, mThreads, [&](int start, int end, int task) {
+    for (int b = start; b < end; ++b) {
+      unsigned long bh = b;
+      int last = std::min(num, (b + 1) * HASH_BLOCK);
+      for (int i = b * HASH_BLOCK; i < last; ++i)
+        HashParticle(bh, part[i], groups);
+      block_hash[b] = bh;
+    }
+  });
+  for (int b = 0; b < blocks; ++b)
+    Mix(h, block_hash[b]);
+
+  if (groups & STAGE_SINKS) {
+    std::vector<Sink *> sink = file->GetSinks();
+    Mix(h, sink.size());
+    for (int i = 0; i < sink.size(); ++i)
+      HashParticle(h, sink[i], STAGE_POSITION);
+  }
+  return h;
+}
+
+void DerivedCache::Run(const Stage &stage, SnapshotFile *file,
+                       const int task) {
+  unsigned long state = StateHash(stage, file);
+  int writes = stage.writes & (DERIVED_ALL | STAGE_ORDER);
+  std::vector<Particle *> before = file->GetParticles();
+
+  std::vector<char> data;
+  bool found = false;
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (int e = mEntries.size() - 1; e >= 0 && !found; --e) {
+      const Entry &entry = mEntries[e];
+      if (entry.name != stage.name || entry.state != state ||
+          entry.writes != writes || entry.count != before.size())
+        continue;
+      if (entry.offset < 0) {
+        data = entry.data;
+      } else {
+        data.resize(entry.bytes);
+        if (entry.bytes > 0) {
+          mBR->Seek(entry.offset);
+          mBR->ReadBytes(&data[0], entry.bytes);
+        }
+      }
+      found = true;
+    }
+  }
+
+  std::vector<int> order;
+  if (found && Unpack(writes, before, data, order)) {
+    if (writes & STAGE_ORDER) {
+      std::vector<Particle *> part(before.size());
+      for (int i = 0; i < part.size(); ++i)
+        part[i] = before[order[i]];
+      file->SetParticles(part);
+    }
+    ++mLoaded;
+    return;
+  }
+
+  stage.run(file, task);
+
+  std::vector<Particle *> after = file->GetParticles();
+  if (writes & STAGE_ORDER) {
+    // Each particle's position before the stage
+    std::unordered_map<Particle *, int> index;
+    for (int i = 0; i < before.size(); ++i)
+      index[before[i]] = i;
+    order.resize(after.size());
+    for (int i = 0; i < after.size(); ++i) {
+      auto it = index.find(after[i]);
+      if (it == index.end())
+        return;
+      order[i] = it->second;
+    }
+  }
+  if (after.size() != before.size())
+    return;
+
+  Entry entry;
+  entry.name = stage.name;
+  entry.state = state;
+  entry.writes = writes;
+  entry.count = after.size();
+  entry.offset = -1;
+  entry.bytes = ColumnBytes(writes, entry.count);
+  Pack(writes, after, order, entry.data);
+
+  std::lock_guard<std::mutex> lock(mMutex);
+  mEntries.push_back(entry);
+  mModified = true;
+  ++mComputed;
+}
+
+bool DerivedCache::Save() {
+  if (!mModified)
+    return true;
+
+  // Written alongside and renamed over the sidecar, so a run stopped
+  // part way leaves the previous one intact
+  std::string partName = mSidecarName + ".part";
+  std::ofstream out(partName, std::ios::binary);
+  if (!out.is_open()) {
+    std::cout << "   Could not write derived cache " << mSidecarName << "\n";
+    return false;
+  }
+
+  int first = std::max(0, (int)mEntries.size() - MAX_ENTRIES);
+  {
+    BinaryWriter bw(out);
+    bw.WriteValue(CACHE_MAGIC);
+    bw.WriteValue(CACHE_VERSION);
+    bw.WriteValue(mFileKey);
+    bw.WriteValue((int)mEntries.size() - first);
+    std::vector<char> buffer;
+    for (int e = first; e < mEntries.size(); ++e) {
+      const Entry &entry = mEntries[e];
+      bw.WriteValue((int)entry.name.size());
+      bw.WriteValue(entry.name);
+      bw.WriteValue(entry.state);
+      bw.WriteValue(entry.writes);
+      bw.WriteValue(entry.count);
+      if (entry.offset < 0) {
+        bw.WriteArray(entry.data);
+        continue;
+      }
+      // Copied across from the previous sidecar
+      mBR->Seek(entry.offset);
+      for (long done = 0; done < entry.bytes; done += buffer.size()) {
+        buffer.resize(std::min(COPY_BYTES, entry.bytes - done));
+        mBR->ReadBytes(&buffer[0], buffer.size());
+        bw.WriteArray(buffer);
+      }
+    }
+  }
+  out.close();
+
+  delete mBR;
+  mBR = NULL;
+  if (!out || std::rename(partName.c_str(), mSidecarName.c_str()) != 0) {
+    std::cout << "   Could not write derived cache " << mSidecarName << "\n";
+    std::remove(partName.c_str());
+    return false;
+  }
+  mModified = false;
+  return true;
+}
+
+long DerivedCache::ColumnBytes(const int writes, const int count) {
+  long bytes = 0;
+  if (writes & DERIVED_ENERGY)
+    bytes += 4 * sizeof(double);
+  if (writes & DERIVED_THERMO)
+    bytes += 8 * sizeof(float);
+  if (writes & DERIVED_TOOMRE)
+    bytes += 2 * sizeof(float);
+  if (writes & DERIVED_BETA)
+    bytes += sizeof(float);
+  if (writes & STAGE_ORDER)
+    bytes += sizeof(int);
+  return bytes * count;
+}
+
+// Columns are laid out widest first so each stays aligned in the buffer.
+void DerivedCache::Pack(const int writes, const std::vector<Particle *> &part,
+                        const std::vector<int> &order,
+                        std::vector<char> &data) {
+  int n = part.size();
+  data.resize(ColumnBytes(writes, n));
+  if (n == 0)
+    return;
+
+  double *dbl = (double *)&data[0];
+  if (writes & DERIVED_ENERGY) {
+    for (int j = 0; j < 4; ++j) {
+      for (int i = 0; i < n; ++i)
+        dbl[i] = part[i]->GetEnergy(j);
+      dbl += n;
+    }
+  }
+
+  float *flt = (float *)dbl;
+  std::vector<std::function<float(Particle *)>> get;
+  if (writes & DERIVED_THERMO) {
+    get.push_back([](Particle *p) { return p->GetT(); });
+    get.push_back([](Particle *p) { return p->GetU(); });
+    get.push_back([](Particle *p) { return p->GetP(); });
+    get.push_back([](Particle *p) { return p->GetCS(); });
+    get.push_back([](Particle *p) { return p->GetKappa(); });
+    get.push_back([](Particle *p) { return p->GetSigma(); });
+    get.push_back([](Particle *p) { return p->GetTau(); });
+    get.push_back([](Particle *p) { return p->GetDUDT(); });
+  }
+  if (writes & DERIVED_TOOMRE) {
+    get.push_back([](Particle *p) { return p->GetOmega(); });
+    get.push_back([](Particle *p) { return p->GetQ(); });
+  }
+  if (writes & DERIVED_BETA)
+    get.push_back([](Particle *p) { return p->GetBeta(); });
+  for (int c = 0; c < get.size(); ++c) {
+    for (int i = 0; i < n; ++i)
+      flt[i] = get[c](part[i]);
+    flt += n;
+  }
+
+  if (writes & STAGE_ORDER)
+    memcpy(flt, &order[0], n * sizeof(int));
+}
+
+bool DerivedCache::Unpack(const int writes,
+                          const std::vector<Particle *> &before,
+                          const std::vector<char> &data,
+                          std::vector<int> &order) {
+  int n = before.size();
+  if (n == 0)
+    return true;
+
+  // Values are stored in the order after the stage
+  const char *end = &data[0] + data.size();
+  order.resize(n);
+  if (writes & STAGE_ORDER) {
+    memcpy(&order[0], end - n * sizeof(int), n * sizeof(int));
+    std::vector<bool> seen(n, false);
+    for (int i = 0; i < n; ++i) {
+      if (order[i] < 0 || order[i] >= n || seen[order[i]])
+        return false;
+      seen[order[i]] = true;
+    }
+  } else {
+    for (int i = 0; i < n; ++i)
+      order[i] = i;
+  }
+  std::vector<Particle *> part(n);
+  for (int i = 0; i < n; ++i)
+    part[i] = before[order[i]];
+
+  const double *dbl = (const double *)&data[0];
+  if (writes & DERIVED_ENERGY) {
+    for (int j = 0; j < 4; ++j) {
+      for (int i = 0; i < n; ++i)
+        part[i]->SetEnergy(dbl[i], j);
+      dbl += n;
+    }
+  }
+
+  const float *flt = (const float *)dbl;
+  std::vector<std::function<void(Particle *, float)>> set;
+  if (writes & DERIVED_THERMO) {
+    set.push_back([](Particle *p, float v) { p->SetT(v); });
+    set.push_back([](Particle *p, float v) { p->SetU(v); });
+    set.push_back([](Particle *p, float v) { p->SetP(v); });
+    set.push_back([](Particle *p, float v) { p->SetCS(v); });
+    set.push_back([](Particle *p, float v) { p->SetKappa(v); });
+    set.push_back([](Particle *p, float v) { p->SetSigma(v); });
+    set.push_back([](Particle *p, float v) { p->SetTau(v); });
+    set.push_back([](Particle *p, float v) { p->SetDUDT(v); });
+  }
+  if (writes & DERIVED_TOOMRE) {
+    set.push_back([](Particle *p, float v) { p->SetOmega(v); });
+    set.push_back([](Particle *p, float v) { p->SetQ(v); });
+  }
+  if (writes & DERIVED_BETA)
+    set.push_back([](Particle *p, float v) { p->SetBeta(v); });
+  for (int c = 0; c < set.size(); ++c) {
+    for (int i = 0; i < n; ++i)
+      set[c](part[i], flt[i]);
+    flt += n;
+  }
+  return true;
+}
@@ -27,12 +27,6 @@ void DiscAnalyser::Center(SnapshotFile *file, int sinkIndex, Vec3 posCenter,
   Vec3 dV = {0.0, 0.0, 0.0};
   std::string appendage = ".centered.";
 
-  // Return if there is no position to center around
-  if (posCenter.Norm() == 0.0 && (sinkIndex < 0 || sinkIndex >= sink.size()) &&
-      !densest) {
-    return;
-  }
-
   if (densest) {
     // Sort by density, but use a copy of the particles.
     std::vector<Particle *> dens_sorted = part;
@@ -51,19 +45,37 @@ void DiscAnalyser::Center(SnapshotFile *file, int sinkIndex, Vec3 posCenter,
     dX /= total_mass;
     dV /= total_mass;
     appendage += "densest";
+  } else if (!FindOffset(sink, sinkIndex, posCenter, dX, appendage)) {
+    // Return if there is no position to center around
+    return;
+  }
+
+  Shift(part, dX, dV);
+  CenterSinks(file, dX, appendage);
+  file->SetParticles(part);
+}
+
+bool DiscAnalyser::FindOffset(const std::vector<Sink *> &sink, int sinkIndex,
+                              Vec3 posCenter, Vec3 &dX,
+                              std::string &appendage) {
+  if (posCenter.Norm() == 0.0 && (sinkIndex < 0 || sinkIndex >= sink.size()))
+    return false;
+
+  if (posCenter.Norm() == 0.0) {
+    dX = sink[sinkIndex]->GetX();
+    appendage += std::to_string(sinkIndex);
   } else {
-    if (posCenter.Norm() == 0.0) {
-      dX = sink[sinkIndex]->GetX();
-      appendage += std::to_string(sinkIndex);
-    } else {
-      dX = posCenter;
-      appendage += mParams->GetString("CENTER_LABEL");
-    }
-    if (dX.z == 0.0) {
-      dX.z = sink[sinkIndex]->GetX().z;
-    }
+    dX = posCenter;
+    appendage += mParams->GetString("CENTER_LABEL");
+  }
+  if (dX.z == 0.0) {
+    dX.z = sink[sinkIndex]->GetX().z;
   }
+  return true;
+}
 
+void DiscAnalyser::Shift(const std::vector<Particle *> &part, const Vec3 &dX,
+                         const Vec3 &dV) {
   // TODO: Instead of using R, maybe replace all with GetX().Norm().
   // TODO: Set new velocity for all cases!
   for (int i = 0; i < part.size(); ++i) {
@@ -73,7 +85,11 @@ void DiscAnalyser::Center(SnapshotFile *file, int sinkIndex, Vec3 posCenter,
     part.at(i)->SetR(part.at(i)->GetX().Norm());
     part.at(i)->SetV(newV);
   }
+}
 
+void DiscAnalyser::CenterSinks(SnapshotFile *file, const Vec3 &dX,
+                               const std::string &appendage) {
+  std::vector<Sink *> sink = file->GetSinks();
   for (int i = 0; i < sink.size(); ++i) {
     Vec3 newX = sink[i]->GetX() - dX;
     sink[i]->SetX(newX);
@@ -82,7 +98,6 @@ void DiscAnalyser::Center(SnapshotFile *file, int sinkIndex, Vec3 posCenter,
   std::cout << "   " << file->GetNameData().id << " centering R "
             << sink[0]->GetX().Norm() << "\n";
 
-  file->SetParticles(part);
   file->SetSinks(sink);
   file->SetNameDataAppend(appendage);
 }
@@ -110,4 +125,11 @@ void DiscAnalyser::FindOuterRadius(SnapshotFile *file) {
       }
     }
   }
-}
\ No newline at end of file
+}
+
+void DiscAnalyser::FindOuterRadius(SnapshotFile *file,
+                                   const EnclosedMass &table) {
+  for (int i = 0; i < 3; ++i) {
+    file->SetOuterRadius(table.GetRadius(table.GetTotal() * ROUT_PERCS[i]), i);
+  }
+}
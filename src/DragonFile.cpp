@@ -87,18 +87,121 @@ bool DragonFile::Write(std::string fileName, bool formatted) {
   return true;
 }
 
-void DragonFile::AllocateMemory() {
+bool DragonFile::BeginStream(std::string fileName, const int num_gas) {
+  mOutStream.open(fileName, std::ios::out);
+  if (!mOutStream.is_open()) {
+    std::cout << "   Could not open DRAGON file " << fileName
+              << " for writing!\n\n";
+    return false;
+  }
+  std::cout << "   File output      : " << fileName << "\n";
+
+  mStreaming = true;
+  mNumGas = num_gas;
+  mNumSink = mSinks.size();
+  WriteHeaderForm(Formatter(mOutStream, 18, 2, 10));
+
+  return true;
+}
+
+void DragonFile::AppendStreamColumn(const std::vector<double> &values,
+                                    const int dim) {
+  Formatter formatStream(mOutStream, 18, 2, 10);
+  ParallelFormat(formatStream, values.size() / dim, mThreads,
+                 [&](Formatter &f, int s, int e) {
+                   for (int i = s; i < e; ++i) {
+                     if (dim == 1) {
+                       f << values[i] << "\n";
+                       continue;
+                     }
+                     for (int j = 0; j < dim; ++j)
+                       f << values[i * dim + j] << "\t";
+                     f << "\n";
+                   }
+                 });
+}
+
+void DragonFile::AppendStreamColumn(const std::vector<int> &values) {
+  Formatter formatStream(mOutStream, 18, 2, 10);
+  ParallelFormat(formatStream, values.size(), mThreads,
+                 [&](Formatter &f, int s, int e) {
+                   for (int i = s; i < e; ++i)
+                     f << values[i] << "\n";
+                 });
+}
+
+void DragonFile::WriteStreamSinks(const int column) {
+  Formatter formatStream(mOutStream, 18, 2, 10);
+  for (int i = 0; i < mNumSink; ++i) {
+    Sink *s = mSinks[i];
+    switch (column) {
+    case 0:
+      for (int j = 0; j < 3; ++j)
+        formatStream << s->GetX()[j] / PC_TO_AU << "\t";
+      formatStream << "\n";
+      break;
+    case 1:
+      for (int j = 0; j < 3; ++j)
+        formatStream << s->GetV()[j] << "\t";
+      formatStream << "\n";
+      break;
+    case 2:
+      formatStream << s->GetT() << "\n";
+      break;
+    case 3:
+      formatStream << s->GetH() / PC_TO_AU << "\n";
+      break;
+    case 4:
+      formatStream << s->GetD() << "\n";
+      break;
+    case 5:
+      formatStream << s->GetM() << "\n";
+      break;
+    case 6:
+      formatStream << s->GetType() << "\n";
+      break;
+    default:
+      formatStream << s->GetID() << "\n";
+      break;
+    }
+  }
+}
+
+void DragonFile::EndStream() {
+  mOutStream.close();
+  mStreaming = false;
+}
+
+bool DragonFile::ReadHeader() {
+  // The unformatted layout is not yet supported
+  if (!mFormatted)
+    return false;
+  mInStream.open(mNameData.name);
+  if (!mInStream.is_open())
+    return false;
+
+  bool read = ReadHeaderForm() && !mInStream.fail();
+  if (read) {
+    UnpackHeader();
+    RecordOffsets();
+  }
+  mInStream.close();
+
+  return read;
+}
+
+void DragonFile::UnpackHeader() {
   mNumTot = mIntData[0];
   mNumGas = mIntData[2];
   mNumSink = mNumTot - mNumGas;
 
   mTime = mFloatData[0] * 1E6;
+}
 
-  for (int i = 0; i < mNumGas; ++i) {
-    Particle *p = new Particle();
-    mParticles.push_back(p);
-  }
+void DragonFile::AllocateMemory() {
+  UnpackHeader();
 
+  // Particles are created as they pass the read filter
   for (int i = 0; i < mNumSink; ++i) {
     Sink *s = new Sink();
     mSinks.push_back(s);
@@ -122,13 +225,16 @@ bool DragonFile::ReadHeaderForm() {
 
 void DragonFile::ReadParticleForm() {
   float temp[3] = {0.0};
-  
+
   // Positions
+  std::vector<Vec3> pos(mNumGas);
   for (int i = 0; i < mNumGas; ++i) {
     mInStream >> temp[0] >> temp[1] >> temp[2];
-    mParticles[i]->SetX(
-        Vec3(temp[0] * PC_TO_AU, temp[1] * PC_TO_AU, temp[2] * PC_TO_AU));
+    pos[i] = Vec3(temp[0] * PC_TO_AU, temp[1] * PC_TO_AU, temp[2] * PC_TO_AU);
   }
+  std::vector<int> slot = SelectParticles(pos);
+  pos.clear();
+  pos.shrink_to_fit();
   for (int i = 0; i < mNumSink; ++i) {
     mInStream >> temp[0] >> temp[1] >> temp[2];
     mSinks[i]->SetX(
@@ -138,7 +244,8 @@ void DragonFile::ReadParticleForm() {
   // Velocities
   for (int i = 0; i < mNumGas; ++i) {
     mInStream >> temp[0] >> temp[1] >> temp[2];
-    mParticles[i]->SetV(Vec3(temp[0], temp[1], temp[2]));
+    if (slot[i] >= 0)
+      mParticles[slot[i]]->SetV(Vec3(temp[0], temp[1], temp[2]));
   }
   for (int i = 0; i < mNumSink; ++i) {
     mInStream >> temp[0] >> temp[1] >> temp[2];
@@ -148,7 +255,8 @@ void DragonFile::ReadParticleForm() {
   // temperature
   for (int i = 0; i < mNumGas; ++i) {
     mInStream >> temp[0];
-    mParticles[i]->SetT(temp[0]);
+    if (slot[i] >= 0)
+      mParticles[slot[i]]->SetT(temp[0]);
   }
   for (int i = 0; i < mNumSink; ++i) {
     mInStream >> temp[0];
@@ -158,7 +266,8 @@ void DragonFile::ReadParticleForm() {
   // Smoothing length
   for (int i = 0; i < mNumGas; ++i) {
     mInStream >> temp[0];
-    mParticles[i]->SetH(temp[0] * PC_TO_AU);
+    if (slot[i] >= 0)
+      mParticles[slot[i]]->SetH(temp[0] * PC_TO_AU);
   }
   for (int i = 0; i < mNumSink; ++i) {
     mInStream >> temp[0];
@@ -168,7 +277,8 @@ void DragonFile::ReadParticleForm() {
   // Density
   for (int i = 0; i < mNumGas; ++i) {
     mInStream >> temp[0];
-    mParticles[i]->SetD(temp[0]);
+    if (slot[i] >= 0)
+      mParticles[slot[i]]->SetD(temp[0]);
   }
   for (int i = 0; i < mNumSink; ++i) {
     mInStream >> temp[0];
@@ -178,7 +288,8 @@ void DragonFile::ReadParticleForm() {
   // Mass
   for (int i = 0; i < mNumGas; ++i) {
     mInStream >> temp[0];
-    mParticles[i]->SetM(temp[0]);
+    if (slot[i] >= 0)
+      mParticles[slot[i]]->SetM(temp[0]);
   }
   for (int i = 0; i < mNumSink; ++i) {
     mInStream >> temp[0];
@@ -188,7 +299,8 @@ void DragonFile::ReadParticleForm() {
   // Type
   for (int i = 0; i < mNumGas; ++i) {
     mInStream >> temp[0];
-    mParticles[i]->SetType(temp[0]);
+    if (slot[i] >= 0)
+      mParticles[slot[i]]->SetType(temp[0]);
   }
   for (int i = 0; i < mNumSink; ++i) {
     mInStream >> temp[0];
@@ -198,7 +310,8 @@ void DragonFile::ReadParticleForm() {
   // ID
   for (int i = 0; i < mNumGas; ++i) {
     mInStream >> temp[0];
-    mParticles[i]->SetID(temp[0]);
+    if (slot[i] >= 0)
+      mParticles[slot[i]]->SetID(temp[0]);
   }
   for (int i = 0; i < mNumSink; ++i) {
     mInStream >> temp[0];
@@ -209,13 +322,28 @@ void DragonFile::ReadParticleForm() {
   for (int n = 0; n < mExtraData; ++n) {
     for (int i = 0; i < mNumGas; ++i) {
       mInStream >> temp[0];
-      mParticles[i]->SetExtra(n, temp[0]);
+      if (slot[i] >= 0)
+        mParticles[slot[i]]->SetExtra(n, temp[0]);
     }
     for (int i = 0; i < mNumSink; ++i) {
       mInStream >> temp[0];
       mSinks[i]->SetExtra(n, temp[0]);
     }
   }
+
+  // Types are stored after the other columns, so are only filtered here
+  if (mFilter.type != 0) {
+    std::vector<Particle *> kept;
+    for (int i = 0; i < mParticles.size(); ++i) {
+      if (mFilter.PassType(mParticles[i]->GetType()))
+        kept.push_back(mParticles[i]);
+      else
+        delete mParticles[i];
+    }
+    mParticles = kept;
+  }
+  mNumGas = mParticles.size();
+  mNumTot = mNumGas + mNumSink;
 }
 
 void DragonFile::ReadSinkForm() {
@@ -230,8 +358,10 @@ void DragonFile::ReadParticleUnform() {}
 void DragonFile::ReadSinkUnform() {}
 
 void DragonFile::WriteHeaderForm(Formatter formatStream) {
-  mIntData[0] = mParticles.size() + mSinks.size();
-  mIntData[2] = mParticles.size();
+  // A streamed file is given its particle count up front
+  int num_gas = (mStreaming) ? mNumGas : mParticles.size();
+  mIntData[0] = num_gas + mSinks.size();
+  mIntData[2] = num_gas;
   mIntData[3] = mSinks.size();
 
   mFloatData[0] = mTime / 1E6;
@@ -243,52 +373,80 @@ void DragonFile::WriteHeaderForm(Formatter formatStream) {
 }
 
 void DragonFile::WriteParticleForm(Formatter formatStream) {
-  for (int i = 0; i < mNumGas; ++i) {
-    for (int j = 0; j < 3; ++j)
-      formatStream << mParticles[i]->GetX()[j] / PC_TO_AU << "\t";
-    formatStream << "\n";
-  }
+  std::vector<Particle *> &part = mParticles;
+  std::vector<Sink *> &sink = mSinks;
+
+  // Particles are formatted in parallel, and the few sinks in order after
+  ParallelFormat(formatStream, mNumGas, mThreads,
+                 [&](Formatter &f, int s, int e) {
+                   for (int i = s; i < e; ++i) {
+                     for (int j = 0; j < 3; ++j)
+                       f << part[i]->GetX()[j] / PC_TO_AU << "\t";
+                     f << "\n";
+                   }
+                 });
   for (int i = 0; i < mNumSink; ++i) {
     for (int j = 0; j < 3; ++j)
-      formatStream << mSinks[i]->GetX()[j] / PC_TO_AU << "\t";
+      formatStream << sink[i]->GetX()[j] / PC_TO_AU << "\t";
     formatStream << "\n";
   }
 
-  for (int i = 0; i < mNumGas; ++i) {
-    for (int j = 0; j < 3; ++j)
-      formatStream << mParticles[i]->GetV()[j] << "\t";
-    formatStream << "\n";
-  }
+  ParallelFormat(formatStream, mNumGas, mThreads,
+                 [&](Formatter &f, int s, int e) {
+                   for (int i = s; i < e; ++i) {
+                     for (int j = 0; j < 3; ++j)
+                       f << part[i]->GetV()[j] << "\t";
+                     f << "\n";
+                   }
+                 });
   for (int i = 0; i < mNumSink; ++i) {
     for (int j = 0; j < 3; ++j)
-      formatStream << mSinks[i]->GetV()[j] << "\t";
+      formatStream << sink[i]->GetV()[j] << "\t";
     formatStream << "\n";
   }
 
-  for (int i = 0; i < mNumGas; ++i)
-    formatStream << mParticles[i]->GetT() << "\n";
+  ParallelFormat(formatStream, mNumGas, mThreads,
+                 [&](Formatter &f, int s, int e) {
+                   for (int i = s; i < e; ++i)
+                     f << part[i]->GetT() << "\n";
+                 });
   for (int i = 0; i < mNumSink; ++i)
-    formatStream << mSinks[i]->GetT() << "\n";
-  for (int i = 0; i < mNumGas; ++i)
-    formatStream << mParticles[i]->GetH() / PC_TO_AU << "\n";
+    formatStream << sink[i]->GetT() << "\n";
+  ParallelFormat(formatStream, mNumGas, mThreads,
+                 [&](Formatter &f, int s, int e) {
+                   for (int i = s; i < e; ++i)
+                     f << part[i]->GetH() / PC_TO_AU << "\n";
+                 });
   for (int i = 0; i < mNumSink; ++i)
-    formatStream << mSinks[i]->GetH() / PC_TO_AU << "\n";
-  for (int i = 0; i < mNumGas; ++i)
-    formatStream << mParticles[i]->GetD() << "\n";
+    formatStream << sink[i]->GetH() / PC_TO_AU << "\n";
+  ParallelFormat(formatStream, mNumGas, mThreads,
+                 [&](Formatter &f, int s, int e) {
+                   for (int i = s; i < e; ++i)
+                     f << part[i]->GetD() << "\n";
+                 });
   for (int i = 0; i < mNumSink; ++i)
-    formatStream << mSinks[i]->GetD() << "\n";
-  for (int i = 0; i < mNumGas; ++i)
-    formatStream << mParticles[i]->GetM() << "\n";
+    formatStream << sink[i]->GetD() << "\n";
+  ParallelFormat(formatStream, mNumGas, mThreads,
+                 [&](Formatter &f, int s, int e) {
+                   for (int i = s; i < e; ++i)
+                     f << part[i]->GetM() << "\n";
+                 });
   for (int i = 0; i < mNumSink; ++i)
-    formatStream << mSinks[i]->GetM() << "\n";
-  for (int i = 0; i < mNumGas; ++i)
-    formatStream << mParticles[i]->GetType() << "\n";
+    formatStream << sink[i]->GetM() << "\n";
+  ParallelFormat(formatStream, mNumGas, mThreads,
+                 [&](Formatter &f, int s, int e) {
+                   for (int i = s; i < e; ++i)
+                     f << part[i]->GetType() << "\n";
+                 });
   for (int i = 0; i < mNumSink; ++i)
-    formatStream << mSinks[i]->GetType() << "\n";
-  for (int i = 0; i < mNumGas; ++i)
-    formatStream << mParticles[i]->GetID() << "\n";
+    formatStream << sink[i]->GetType() << "\n";
+  ParallelFormat(formatStream, mNumGas, mThreads,
+                 [&](Formatter &f, int s, int e) {
+                   for (int i = s; i < e; ++i)
+                     f << part[i]->GetID() << "\n";
+                 });
   for (int i = 0; i < mNumSink; ++i)
-    formatStream << mSinks[i]->GetID() << "\n";
+    formatStream << sink[i]->GetID() << "\n";
 }
 
 void DragonFile::WriteSinkForm(Formatter formatStream) {}
@@ -0,0 +1,67 @@
+//===-- EnclosedMass.cpp --------------------------------------------------===//
+//
+//                                  SPARGEL
+//                   Smoothed Particle Generator and Loader
+//
+// This file is distributed under the GNU General Public License. See LICENSE
+// for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// EnclosedMass.cpp
+///
+//===----------------------------------------------------------------------===//
+
+#include "EnclosedMass.h"
+
+EnclosedMass::EnclosedMass() {
+  mBins = (LOG_MAX - LOG_MIN) * BINS_PER_DEX;
+  mMass.assign(mBins, 0.0);
+  mCumulative.assign(mBins + 1, 0.0);
+}
+
+EnclosedMass::~EnclosedMass() {}
+
+void EnclosedMass::Add(const float r, const double m) { mMass[Bin(r)] += m; }
+
+void EnclosedMass::Merge(const EnclosedMass &other) {
+  for (int i = 0; i < mBins; ++i)
+    mMass[i] += other.mMass[i];
+}
+
+void EnclosedMass::Finalise() {
+  mCumulative[0] = 0.0;
+  for (int i = 0; i < mBins; ++i)
+    mCumulative[i + 1] = mCumulative[i] + mMass[i];
+}
+
+double EnclosedMass::GetInterior(const float r) const {
+  int bin = Bin(r);
+  float lo = Edge(bin), hi = Edge(bin + 1);
+  float frac = (r <= lo) ? 0.0f : std::min(1.0f, (r - lo) / (hi - lo));
+  return mCumulative[bin] + frac * mMass[bin];
+}
+
+float EnclosedMass::GetRadius(const double mass) const {
+  // First bin whose outer edge encloses the mass
+  int bin = std::lower_bound(mCumulative.begin() + 1, mCumulative.end(), mass) -
+            (mCumulative.begin() + 1);
+  if (bin >= mBins)
+    return Edge(mBins);
+  float frac = (mMass[bin] > 0.0)
+                   ? (mass - mCumulative[bin]) / mMass[bin]
+                   : 1.0;
+  return Edge(bin) + std::max(0.0f, frac) * (Edge(bin + 1) - Edge(bin));
+}
+
+int EnclosedMass::Bin(const float r) const {
+  if (r <= 0.0f)
+    return 0;
+  int bin = floor((log10(r) - LOG_MIN) * BINS_PER_DEX);
+  return std::max(0, std::min(mBins - 1, bin));
+}
+
+float EnclosedMass::Edge(const int bin) const {
+  return pow(10.0, LOG_MIN + (double)bin / BINS_PER_DEX);
+}
@@ -15,13 +15,14 @@
 
 #include "EvolutionAnalyser.h"
 
-EvolutionAnalyser::EvolutionAnalyser(NameData nd) : mNameData(nd) {
+EvolutionAnalyser::EvolutionAnalyser(NameData nd, const int threads)
+    : mNameData(nd), mShards(threads) {
   mNameData.append += "evolution";
 }
 
 EvolutionAnalyser::~EvolutionAnalyser() {}
 
-void EvolutionAnalyser::Append(SnapshotFile *file) {
+void EvolutionAnalyser::Append(SnapshotFile *file, const int task) {
   std::vector<Particle *> part = file->GetParticles();
   std::vector<Sink *> sink = file->GetSinks();
   Record r;
@@ -43,7 +44,12 @@ void EvolutionAnalyser::Append(SnapshotFile *file) {
   r.r_out[1] = file->GetOuterRadius(1);
   r.r_out[2] = file->GetOuterRadius(2);
 
-  mRecords.push_back(r);
+  mShards.Add(task, r);
+}
+
+void EvolutionAnalyser::Merge() {
+  mRecords =
+      mShards.Merge([](Record a, Record b) { return b.time > a.time; });
 }
 
 bool EvolutionAnalyser::Write() {
@@ -55,9 +61,6 @@ bool EvolutionAnalyser::Write() {
     return false;
   }
 
-  std::sort(mRecords.begin(), mRecords.end(),
-            [](Record a, Record b) { return b.time > a.time; });
-
   for (int i = 0; i < mRecords.size(); ++i) {
     Record r = mRecords[i];
     mOutStream << r.time << "\t" << r.disc_mass << "\t" << r.star_mass << "\t"
@@ -23,14 +23,16 @@ FileNameExtractor::FileNameExtractor(std::string fileName) {
 FileNameExtractor::~FileNameExtractor() {}
 
 void FileNameExtractor::Extract() {
+  // Compressed files are named as the file they hold
+  std::string name = StripCodecSuffix(mND.name);
   int pos = 0;
-  mND.snap = ExtractString(mND.name, pos, '.');
+  mND.snap = ExtractString(name, pos, '.');
   pos += mND.snap.size() + 1;
-  mND.format = ExtractString(mND.name, pos, '.');
+  mND.format = ExtractString(name, pos, '.');
   pos += mND.format.size() + 1;
-  mND.id = ExtractString(mND.name, pos, '/');
+  mND.id = ExtractString(name, pos, '/');
   pos += mND.id.size() + 1;
-  mND.dir = ExtractString(mND.name, pos, '=');
+  mND.dir = ExtractString(name, pos, '=');
 }
 
 std::string FileNameExtractor::ExtractString(std::string str, int start,
@@ -18,10 +18,7 @@
 Generator::Generator(Parameters *params, OpacityTable *opacity)
     : mParams(params), mOpacity(opacity) {}
 
-Generator::~Generator() {
-  delete mOctree;
-  delete[] mOctreePoints;
-}
+Generator::~Generator() {}
 
 void Generator::Create() {
   SetupParams();
@@ -29,6 +26,9 @@ void Generator::Create() {
   if (mParams->GetString("IC_TYPE") == "disc" ||
       mParams->GetString("IC_TYPE") == "binary") {
     CreateDisc();
+    if (mParams->GetInt("SPH_DENSITY")) {
+      FindDensity();
+    }
     CreateStars();
     CalculateVelocity();
     if (mPlanet) {
@@ -36,11 +36,79 @@ void Generator::Create() {
     }
   } else if (mParams->GetString("IC_TYPE") == "cloud") {
     CreateCloud();
+    if (mParams->GetInt("SPH_DENSITY")) {
+      FindDensity();
+    }
+  }
+}
+
+bool Generator::Stream(SerenFile *file, const std::string &fileName) {
+  SetupParams();
+
+  bool disc = mParams->GetString("IC_TYPE") == "disc" ||
+              mParams->GetString("IC_TYPE") == "binary";
+  bool cloud = mParams->GetString("IC_TYPE") == "cloud";
+  if (!disc && !cloud) {
+    std::cout << "Unrecognised IC_TYPE for streamed generation!\n";
+    return false;
+  }
+
+  // Only the stars and the enclosed mass profile stay resident
+  float hydro_mass = (disc) ? mMDisc / mNumHydro : mCloudMass / mNumHydro;
+  if (disc) {
+    CreateMassProfile();
+    CreateStars();
+    SetSinkVelocities();
+    if (mPlanet) {
+      CreatePlanet();
+    }
   }
+
+  file->SetSinks(mSinks);
+  if (!file->BeginStream(fileName, mNumHydro, hydro_mass))
+    return false;
+
+  int chunk_size = std::max(1, std::min(mChunkSize, mNumHydro));
+  std::vector<Particle *> chunk(chunk_size);
+  for (int i = 0; i < chunk_size; ++i) {
+    chunk[i] = new Particle();
+  }
+
+  for (int first = 0; first < mNumHydro; first += chunk_size) {
+    int n = std::min(chunk_size, mNumHydro - first);
+    std::vector<Particle *> part(chunk.begin(), chunk.begin() + n);
+
+    ParallelFor(n, mNumThreads, [&](int start, int end, int task) {
+      for (int i = start; i < end; ++i) {
+        if (disc) {
+          CreateDiscParticle(first + i, part[i]);
+          SetProfileVelocity(part[i]);
+        } else {
+          CreateCloudParticle(first + i, part[i]);
+        }
+      }
+    });
+
+    file->WriteStreamChunk(part, first);
+  }
+  file->EndStream();
+
+  // The sinks belong to the file once it has them
+  mSinks.clear();
+  for (int i = 0; i < chunk.size(); ++i) {
+    delete chunk[i];
+  }
+
+  return true;
 }
 
 void Generator::SetupParams() {
   mSeed = mParams->GetInt("SEED");
+  mNumThreads = mParams->GetInt("THREADS");
+  if (mNumThreads < 1 || mNumThreads > std::thread::hardware_concurrency())
+    mNumThreads = std::max(1u, std::thread::hardware_concurrency());
+  mDirectGravity = mParams->GetInt("DIRECT_GRAVITY");
+  mChunkSize = mParams->GetInt("GENERATE_CHUNK");
   mNumHydro = mParams->GetInt("N_HYDRO");
   mDim = mParams->GetInt("DIMENSIONS");
   mMStar = mParams->GetFloat("M_STAR");
@@ -78,18 +146,14 @@ void Generator::SetupParams() {
 
   mCloudVol = (4.0f / 3.0f) * PI * pow(mCloudRadius, 3.0f);
 
-  if (mSeed > 0) {
-    srand(mSeed);
-  } else {
-    srand(time(0));
+  if (mSeed <= 0) {
+    mSeed = time(0);
   }
 }
 
-void Generator::GenerateRandoms() {
-  // TODO: Add Mersenne twister
-  for (int i = 0; i < 3; ++i) {
-    mRands[i] = rand() / (float)RAND_MAX;
-  }
+void Generator::GenerateRandoms(const int index, float rands[3]) const {
+  Random random(mSeed);
+  random.Uniform(index, rands, 3);
 }
 
 void Generator::CreateDisc() {
@@ -98,61 +162,68 @@ void Generator::CreateDisc() {
     mParticles.push_back(new Particle());
   }
 
-  for (int i = 0; i < mNumHydro; ++i) {
-    GenerateRandoms();
+  ParallelFor(mNumHydro, mNumThreads, [&](int start, int end, int task) {
+    for (int i = start; i < end; ++i) {
+      CreateDiscParticle(i, mParticles[i]);
+    }
+  });
+}
 
-    float index[2];
-    index[0] = 1.0f - (mP / 2.0f);
-    index[1] = 2.0f / (2.0f - mP);
+void Generator::CreateDiscParticle(const int i, Particle *p) const {
+  float rands[3];
+  GenerateRandoms(i, rands);
 
-    float omegaIn = pow(1.0 + mOmegaIn, index[0]);
-    float omegaOut = pow(1.0 + mOmegaOut, index[0]);
-    float inner = (omegaIn + mRands[0] * (omegaOut - omegaIn));
+  float index[2];
+  index[0] = 1.0f - (mP / 2.0f);
+  index[1] = 2.0f / (2.0f - mP);
 
-    float omega = pow(inner, index[1]) - 1.0;
-    float R = mR0 * pow(omega, 0.5f);
-    float phi = 2 * PI * mRands[1];
+  float omegaIn = pow(1.0 + mOmegaIn, index[0]);
+  float omegaOut = pow(1.0 + mOmegaOut, index[0]);
+  float inner = (omegaIn + rands[0] * (omegaOut - omegaIn));
 
-    float x = R * cos(phi);
-    float y = R * sin(phi);
+  float omega = pow(inner, index[1]) - 1.0;
+  float R = mR0 * pow(omega, 0.5f);
+  float phi = 2 * PI * rands[1];
 
-    float sigma = mSigma0 * pow((mR0 * mR0) / (mR0 * mR0 + R * R), mP / 2.0);
+  float x = R * cos(phi);
+  float y = R * sin(phi);
 
-    float T =
-        pow(pow(mTinf, 4.0) +
-                pow(mT0, 4.0) * pow(pow(R, 2.0) + pow(mR0, 2.0), -2.0 * mQ),
-            0.25);
-    float cS2 = ((K * T) / (MU * M_P)) / (AU_TO_M * AU_TO_M);
+  float sigma = mSigma0 * pow((mR0 * mR0) / (mR0 * mR0 + R * R), mP / 2.0);
 
-    float z_0 = -((PI * sigma * R * R * R) / (2.0 * mMStar)) +
-                pow(pow((PI * sigma * R * R * R) / (2.0 * mMStar), 2.0) +
-                        ((cS2 * R * R * R) / (G_AU * mMStar)),
-                    0.5);
+  float T =
+      pow(pow(mTinf, 4.0) +
+              pow(mT0, 4.0) * pow(pow(R, 2.0) + pow(mR0, 2.0), -2.0 * mQ),
+          0.25);
+  float cS2 = ((K * T) / (MU * M_P)) / (AU_TO_M * AU_TO_M);
 
-    float z = (2.0 / PI) * z_0 * asin(2.0 * mRands[2] - 1.0);
+  float z_0 = -((PI * sigma * R * R * R) / (2.0 * mMStar)) +
+              pow(pow((PI * sigma * R * R * R) / (2.0 * mMStar), 2.0) +
+                      ((cS2 * R * R * R) / (G_AU * mMStar)),
+                  0.5);
 
-    float rho_0 = ((PI * mSigma0) / (4.0 * z_0)) *
-                  pow((mR0 * mR0) / (mR0 * mR0 + R * R), mP / 2.0);
+  float z = (2.0 / PI) * z_0 * asin(2.0 * rands[2] - 1.0);
 
-    float rho = (rho_0 * cos((PI * z) / (2 * z_0)));
+  float rho_0 = ((PI * mSigma0) / (4.0 * z_0)) *
+                pow((mR0 * mR0) / (mR0 * mR0 + R * R), mP / 2.0);
 
-    float m = mMDisc / mNumHydro;
+  float rho = (rho_0 * cos((PI * z) / (2 * z_0)));
 
-    float h = pow((3 * mNumNeigh * m) / (32.0 * PI * rho), (1.0 / 3.0));
+  float m = mMDisc / mNumHydro;
 
-    float U = mOpacity->GetEnergy(rho, T);
+  float h = pow((3 * mNumNeigh * m) / (32.0 * PI * rho), (1.0 / 3.0));
 
-    mParticles[i]->SetID(i);
-    mParticles[i]->SetX(Vec3(x, y, z));
-    mParticles[i]->SetR(Vec3(x, y, z).Norm());
-    mParticles[i]->SetT(T);
-    mParticles[i]->SetH(h);
-    mParticles[i]->SetD(rho * MSOLPERAU3_TO_GPERCM3);
-    mParticles[i]->SetM(m);
-    mParticles[i]->SetU(U);
-    mParticles[i]->SetSigma(sigma);
-    mParticles[i]->SetType(1);
-  }
+  float U = mOpacity->GetEnergy(rho, T);
+
+  p->SetID(i);
+  p->SetX(Vec3(x, y, z));
+  p->SetR(Vec3(x, y, z).Norm());
+  p->SetT(T);
+  p->SetH(h);
+  p->SetD(rho * MSOLPERAU3_TO_GPERCM3);
+  p->SetM(m);
+  p->SetU(U);
+  p->SetSigma(sigma);
+  p->SetType(1);
 }
 
 void Generator::CreateCloud() {
@@ -161,46 +232,67 @@ void Generator::CreateCloud() {
     mParticles.push_back(new Particle());
   }
 
-  for (int i = 0; i < mNumHydro; ++i) {
-    GenerateRandoms();
-
-    float r = pow(mRands[0], (1.0f / 3.0f)) * mCloudRadius;
-    float theta = acos(1.0f - 2.0f * mRands[1]);
-    float phi = 2.0f * PI * mRands[2];
-
-    float x = r * sin(theta) * cos(phi);
-    float y = r * sin(theta) * sin(phi);
-    float z = r * cos(theta);
-
-    float m = mCloudMass / mNumHydro;
-    float rho = mCloudMass / mCloudVol;
-
-    float h = pow((3 * mNumNeigh * m) / (32 * PI * (rho)), (1.0f / 3.0f));
-    float T = 5.0f;
-    float U = (K * T) / (2.35f * M_P * 0.66666f);
-
-    mParticles[i]->SetID(i);
-    mParticles[i]->SetX(Vec3(x, y, z));
-    mParticles[i]->SetR(Vec3(x, y, z).Norm());
-    mParticles[i]->SetT(T);
-    mParticles[i]->SetH(h);
-    mParticles[i]->SetD(rho * MSOLPERAU3_TO_GPERCM3);
-    mParticles[i]->SetM(m);
-    mParticles[i]->SetU(U);
-    mParticles[i]->SetType(1);
+  ParallelFor(mNumHydro, mNumThreads, [&](int start, int end, int task) {
+    for (int i = start; i < end; ++i) {
+      CreateCloudParticle(i, mParticles[i]);
+    }
+  });
+}
+
+void Generator::CreateCloudParticle(const int i, Particle *p) const {
+  float rands[3];
+  GenerateRandoms(i, rands);
+
+  float r = pow(rands[0], (1.0f / 3.0f)) * mCloudRadius;
+  float theta = acos(1.0f - 2.0f * rands[1]);
+  float phi = 2.0f * PI * rands[2];
+
+  float x = r * sin(theta) * cos(phi);
+  float y = r * sin(theta) * sin(phi);
+  float z = r * cos(theta);
+
+  float m = mCloudMass / mNumHydro;
+  float rho = mCloudMass / mCloudVol;
+
+  float h = pow((3 * mNumNeigh * m) / (32 * PI * (rho)), (1.0f / 3.0f));
+  float T = 5.0f;
+  float U = (K * T) / (2.35f * M_P * 0.66666f);
+
+  p->SetID(i);
+  p->SetX(Vec3(x, y, z));
+  p->SetR(Vec3(x, y, z).Norm());
+  p->SetT(T);
+  p->SetH(h);
+  p->SetD(rho * MSOLPERAU3_TO_GPERCM3);
+  p->SetM(m);
+  p->SetU(U);
+  p->SetType(1);
+}
+
+void Generator::FindDensity() {
+  FindSPHDensity(mParticles, mNumNeigh, mNumThreads);
+
+  // Disc energies follow the new densities at the same temperature
+  if (mParams->GetString("IC_TYPE") != "cloud") {
+    ParallelFor(mNumHydro, mNumThreads, [&](int start, int end, int task) {
+      for (int i = start; i < end; ++i) {
+        float rho = mParticles[i]->GetD() / MSOLPERAU3_TO_GPERCM3;
+        mParticles[i]->SetU(mOpacity->GetEnergy(rho, mParticles[i]->GetT()));
+      }
+    });
   }
 }
 
 void Generator::CreateStars() {
   Sink *s1 = new Sink();
-  s1->SetID(mParticles.size() + 1);
+  s1->SetID(mNumHydro + 1);
   s1->SetH(mStarSmoothing);
   s1->SetM(mMStar);
   s1->SetType(-1);
 
   if (mParams->GetString("IC_TYPE") == "binary") {
     Sink *s2 = new Sink();
-    s2->SetID(mParticles.size() + 2);
+    s2->SetID(mNumHydro + 2);
     s2->SetH(mStarSmoothing);
     s2->SetM(mMBinary);
 
@@ -221,7 +313,7 @@ void Generator::CreateStars() {
 
 void Generator::CreatePlanet() {
   Sink *s = new Sink();
-  s->SetID(mParticles.size() + mSinks.size() + 1);
+  s->SetID(mNumHydro + mSinks.size() + 1);
   Vec3 star_pos = mSinks[0]->GetX();
   Vec3 star_vel = mSinks[0]->GetV();
   Vec3 planet_pos = Vec3(mPlanetRadius * (1.0 - mPlanetEcc), 0.0, 0.0);
@@ -230,9 +322,13 @@ void Generator::CreatePlanet() {
   float hill_radius =
       mPlanetRadius * pow(mPlanetMass / (3.0 * mMStar), 1.0 / 3.0);
   float interior_mass = 0.0;
-  for (int i = 0; i < mParticles.size(); ++i) {
-    if (mParticles[i]->GetX().Norm() < mPlanetRadius) {
-      interior_mass += mParticles[i]->GetM();
+  if (!mEnclosedMass.empty()) {
+    interior_mass = EnclosedMass(mPlanetRadius);
+  } else {
+    for (int i = 0; i < mParticles.size(); ++i) {
+      if (mParticles[i]->GetX().Norm() < mPlanetRadius) {
+        interior_mass += mParticles[i]->GetM();
+      }
     }
   }
 
@@ -248,46 +344,58 @@ void Generator::CreatePlanet() {
 }
 
 void Generator::CalculateVelocity() {
-  mOctree = new Octree(Vec3(0.0, 0.0, 0.0), Vec3(512.0, 512.0, 512.0));
-
-  // Insert particles
-  mOctreePoints = new OctreePoint[mParticles.size() + mSinks.size()];
-  for (int i = 0; i < mParticles.size(); ++i) {
-    Vec3 pos = mParticles.at(i)->GetX();
-    float M = mParticles.at(i)->GetM();
-
-    mOctreePoints[i].SetPosition(pos);
-    mOctreePoints[i].SetMass(M);
-    mOctree->Insert(mOctreePoints + i);
+  int num_part = mParticles.size();
+  int num_sink = mSinks.size();
+
+  // Gas followed by the stars, softened by their smoothing lengths.
+  std::vector<Vec3> pos(num_part + num_sink);
+  std::vector<double> mass(num_part + num_sink);
+  std::vector<double> soft(num_part + num_sink);
+  for (int i = 0; i < num_part; ++i) {
+    pos[i] = mParticles[i]->GetX();
+    mass[i] = mParticles[i]->GetM();
+    soft[i] = mParticles[i]->GetH();
+  }
+  for (int i = 0; i < num_sink; ++i) {
+    pos[num_part + i] = mSinks[i]->GetX();
+    mass[num_part + i] = mSinks[i]->GetM();
+    soft[num_part + i] = mSinks[i]->GetH();
   }
 
-  // Insert sinks
-  for (int i = 0; i < mSinks.size(); ++i) {
-    Vec3 pos = mSinks.at(i)->GetX();
-    float M = mSinks.at(i)->GetM();
-
-    mOctreePoints[i].SetPosition(pos);
-    mOctreePoints[i].SetMass(M);
-    mOctree->Insert(mOctreePoints + i);
+  std::vector<Vec3> acc(num_part);
+  std::vector<double> pot(num_part);
+  if (mDirectGravity) {
+    DirectGravity(pos, mass, soft, num_part, acc.data(), pot.data(),
+                  mNumThreads);
+  } else {
+    GravityTree tree(mParams->GetInt("GRAVITY_LEAF"),
+                     mParams->GetFloat("GRAVITY_THETA"));
+    tree.Build(pos, mass, soft, mNumThreads);
+    tree.Walk(pos.data(), soft.data(), num_part, acc.data(), pot.data(),
+              mNumThreads);
   }
 
-  for (int i = 0; i < mParticles.size(); ++i) {
-    Vec3 acc = Vec3(0.0, 0.0, 0.0);
-    Vec3 pos = mParticles.at(i)->GetX();
-    float R = mParticles.at(i)->GetR();
-    float x = mParticles.at(i)->GetX()[0];
-    float y = mParticles.at(i)->GetX()[1];
-    float h = mParticles.at(i)->GetH();
+  // Circular velocity from the cylindrical radial component of the
+  // acceleration.
+  ParallelFor(num_part, mNumThreads, [&](int start, int end, int task) {
+    for (int i = start; i < end; ++i) {
+      float x = pos[i].x;
+      float y = pos[i].y;
+      float R = pos[i].Norm2();
+      float acc_R = -(acc[i].x * x + acc[i].y * y) / (R + 0.000001);
 
-    mOctree->TraverseTree(pos, acc, h);
+      float v = sqrt(std::max(acc_R, 0.0f) * R) * AU_TO_KM;
+      float vX = (-v * y) / (R + 0.000001);
+      float vY = (v * x) / (R + 0.000001);
 
-    float v = sqrt(acc.Norm() * R) * AU_TO_KM;
-    float vX = (-v * y) / (R + 0.000001);
-    float vY = (v * x) / (R + 0.000001);
+      mParticles[i]->SetV(Vec3(vX, vY, 0.0));
+    }
+  });
 
-    mParticles.at(i)->SetV(Vec3(vX, vY, 0.0));
-  }
+  SetSinkVelocities();
+}
 
+void Generator::SetSinkVelocities() {
   if (mParams->GetString("IC_TYPE") == "binary") {
     float v_y1 = -sqrt((G * mMTotal * MSUN_TO_KG) / (mBinarySep * AU_TO_M)) *
                  sqrt((1.0 + mBinaryEcc) / (1.0 - mBinaryEcc)) *
@@ -305,3 +413,58 @@ void Generator::CalculateVelocity() {
     mSinks[0]->SetV(Vec3(0.0, 0.0, 0.0));
   }
 }
+
+void Generator::CreateMassProfile() {
+  // Counts per spherical radius bin, filled on each thread and then summed
+  // so the profile is independent of the number of threads.
+  mProfileMax = 2.0 * mRout;
+  std::vector<std::vector<long>> counts(
+      mNumThreads, std::vector<long>(MASS_PROFILE_BINS, 0));
+
+  ParallelFor(mNumHydro, mNumThreads, [&](int start, int end, int task) {
+    Particle p;
+    for (int i = start; i < end; ++i) {
+      CreateDiscParticle(i, &p);
+      int bin = (p.GetX().Norm() / mProfileMax) * MASS_PROFILE_BINS;
+      counts[task][std::min(bin, MASS_PROFILE_BINS - 1)]++;
+    }
+  });
+
+  float m = mMDisc / mNumHydro;
+  long total = 0;
+  mEnclosedMass.assign(MASS_PROFILE_BINS + 1, 0.0);
+  for (int b = 0; b < MASS_PROFILE_BINS; ++b) {
+    for (int t = 0; t < mNumThreads; ++t)
+      total += counts[t][b];
+    mEnclosedMass[b + 1] = total * m;
+  }
+}
+
+float Generator::EnclosedMass(const float r) const {
+  float pos = (r / mProfileMax) * MASS_PROFILE_BINS;
+  if (pos >= MASS_PROFILE_BINS)
+    return mEnclosedMass[MASS_PROFILE_BINS];
+
+  int bin = pos;
+  float frac = pos - bin;
+  return mEnclosedMass[bin] +
+         frac * (mEnclosedMass[bin + 1] - mEnclosedMass[bin]);
+}
+
+void Generator::SetProfileVelocity(Particle *p) const {
+  // Spherically symmetric estimate, with the stars at the origin
+  Vec3 pos = p->GetX();
+  float x = pos.x;
+  float y = pos.y;
+  float R = pos.Norm2();
+  float r = pos.Norm();
+
+  float M = mMTotal + EnclosedMass(r);
+  float acc_R = (G_AU * M * R) / (r * r * r + 0.000001);
+
+  float v = sqrt(acc_R * R) * AU_TO_KM;
+  float vX = (-v * y) / (R + 0.000001);
+  float vY = (v * x) / (R + 0.000001);
+
+  p->SetV(Vec3(vX, vY, 0.0));
+}
@@ -0,0 +1,347 @@
+//===-- GravityTree.cpp ---------------------------------------------------===//
+//
+//                                  SPARGEL
+//                   Smoothed Particle Generator and Loader
+//
+// This file is distributed under the GNU General Public License. See LICENSE
+// for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// GravityTree.cpp
+///
+//===----------------------------------------------------------------------===//
+
+#include "GravityTree.h"
+
+GravityTree::GravityTree(const int leaf_size, const float theta)
+    : mLeafSize(std::max(1, leaf_size)), mTheta2(theta * theta) {}
+
+GravityTree::~GravityTree() {}
+
+void GravityTree::Build(const std::vector<Vec3> &pos,
+                        const std::vector<double> &mass,
+                        const std::vector<double> &soft, const int threads) {
+  mPos = pos;
+  mMass = mass;
+  mSoft = soft;
+  mNodes.clear();
+  mIndex.resize(mPos.size());
+  for (int i = 0; i < mIndex.size(); ++i) {
+    mIndex[i] = i;
+  }
+  if (mPos.size() == 0)
+    return;
+
+  // Root cell is the bounding cube of all points.
+  Vec3 lo = mPos[0], hi = mPos[0];
+  for (int i = 1; i < mPos.size(); ++i) {
+    for (int j = 0; j < 3; ++j) {
+      lo[j] = std::min(lo[j], mPos[i][j]);
+      hi[j] = std::max(hi[j], mPos[i][j]);
+    }
+  }
+  Vec3 centre = (lo + hi) * 0.5;
+  double half = 0.0;
+  for (int j = 0; j < 3; ++j) {
+    half = std::max(half, 0.5 * (hi[j] - lo[j]));
+  }
+  half = half * 1.001 + 1E-10;
+
+  mNodes.reserve(2 * mPos.size() / mLeafSize + 1);
+  BuildNode(mNodes, 0, mPos.size(), centre, half, 0, threads);
+}
+
+void GravityTree::BuildNode(std::vector<GravityNode> &nodes, const int first,
+                            const int count, const Vec3 &centre,
+                            const double half, const int depth,
+                            const int threads) {
+  int index = nodes.size();
+  nodes.push_back(GravityNode());
+  nodes[index].centre = centre;
+  nodes[index].half = half;
+  nodes[index].first = first;
+  nodes[index].count = count;
+
+  if (count <= mLeafSize || depth >= MAX_DEPTH) {
+    nodes[index].leaf = true;
+    LeafMoments(nodes[index]);
+    nodes[index].next = nodes.size();
+    return;
+  }
+
+  // Counting sort of the points into octants.
+  int octant_count[8] = {0};
+  std::vector<int> octant(count);
+  for (int i = 0; i < count; ++i) {
+    const Vec3 &p = mPos[mIndex[first + i]];
+    int oct = 0;
+    if (p.x >= centre.x)
+      oct |= 4;
+    if (p.y >= centre.y)
+      oct |= 2;
+    if (p.z >= centre.z)
+      oct |= 1;
+    octant[i] = oct;
+    octant_count[oct]++;
+  }
+  int octant_start[8] = {0};
+  for (int i = 1; i < 8; ++i) {
+    octant_start[i] = octant_start[i - 1] + octant_count[i - 1];
+  }
+  std::vector<int> sorted(count);
+  int fill[8];
+  std::copy(octant_start, octant_start + 8, fill);
+  for (int i = 0; i < count; ++i) {
+    sorted[fill[octant[i]]++] = mIndex[first + i];
+  }
+  std::copy(sorted.begin(), sorted.end(), mIndex.begin() + first);
+
+  nodes[index].leaf = false;
+  std::vector<int> children;
+  for (int i = 0; i < 8; ++i) {
+    if (octant_count[i] > 0)
+      children.push_back(i);
+  }
+
+  auto child_centre = [&](const int oct) {
+    Vec3 c = centre;
+    c.x += half * (oct & 4 ? 0.5 : -0.5);
+    c.y += half * (oct & 2 ? 0.5 : -0.5);
+    c.z += half * (oct & 1 ? 0.5 : -0.5);
+    return c;
+  };
+
+  if (threads <= 1) {
+    for (int i = 0; i < children.size(); ++i) {
+      int oct = children[i];
+      BuildNode(nodes, first + octant_start[oct], octant_count[oct],
+                child_centre(oct), half * 0.5, depth + 1, 1);
+    }
+  } else {
+    // Build each child subtree into its own array, then splice them back in
+    // octant order with their skip indices offset.
+    std::vector<std::vector<GravityNode>> subtrees(children.size());
+    int child_threads = std::max(1, threads / (int)children.size());
+    ParallelFor(children.size(), threads, [&](int start, int end, int task) {
+      for (int i = start; i < end; ++i) {
+        int oct = children[i];
+        BuildNode(subtrees[i], first + octant_start[oct], octant_count[oct],
+                  child_centre(oct), half * 0.5, depth + 1, child_threads);
+      }
+    });
+    for (int i = 0; i < subtrees.size(); ++i) {
+      int offset = nodes.size();
+      for (int j = 0; j < subtrees[i].size(); ++j) {
+        subtrees[i][j].next += offset;
+        nodes.push_back(subtrees[i][j]);
+      }
+    }
+  }
+  nodes[index].next = nodes.size();
+  CellMoments(nodes, index);
+}
+
+void GravityTree::LeafMoments(GravityNode &node) {
+  node.mass = 0.0;
+  node.com = Vec3(0.0, 0.0, 0.0);
+  node.soft = 0.0;
+  for (int i = 0; i < node.count; ++i) {
+    int j = mIndex[node.first + i];
+    node.mass += mMass[j];
+    node.com += mMass[j] * mPos[j];
+    node.soft = std::max(node.soft, mSoft[j]);
+  }
+  if (node.mass > 0.0) {
+    node.com /= node.mass;
+  } else {
+    node.com = node.centre;
+  }
+
+  for (int k = 0; k < 6; ++k)
+    node.quad[k] = 0.0;
+  for (int i = 0; i < node.count; ++i) {
+    int j = mIndex[node.first + i];
+    Vec3 d = mPos[j] - node.com;
+    double d2 = d.NormSquared();
+    double m = mMass[j];
+    node.quad[0] += m * (3.0 * d.x * d.x - d2);
+    node.quad[1] += m * (3.0 * d.x * d.y);
+    node.quad[2] += m * (3.0 * d.x * d.z);
+    node.quad[3] += m * (3.0 * d.y * d.y - d2);
+    node.quad[4] += m * (3.0 * d.y * d.z);
+    node.quad[5] += m * (3.0 * d.z * d.z - d2);
+  }
+}
+
+void GravityTree::CellMoments(std::vector<GravityNode> &nodes,
+                              const int index) {
+  GravityNode &node = nodes[index];
+  node.mass = 0.0;
+  node.com = Vec3(0.0, 0.0, 0.0);
+  node.soft = 0.0;
+  for (int c = index + 1; c < node.next; c = nodes[c].next) {
+    node.mass += nodes[c].mass;
+    node.com += nodes[c].mass * nodes[c].com;
+    node.soft = std::max(node.soft, nodes[c].soft);
+  }
+  if (node.mass > 0.0) {
+    node.com /= node.mass;
+  } else {
+    node.com = node.centre;
+  }
+
+  // Shift the child quadrupoles to the new centre of mass.
+  for (int k = 0; k < 6; ++k)
+    node.quad[k] = 0.0;
+  for (int c = index + 1; c < node.next; c = nodes[c].next) {
+    const GravityNode &child = nodes[c];
+    Vec3 d = child.com - node.com;
+    double d2 = d.NormSquared();
+    double m = child.mass;
+    node.quad[0] += child.quad[0] + m * (3.0 * d.x * d.x - d2);
+    node.quad[1] += child.quad[1] + m * (3.0 * d.x * d.y);
+    node.quad[2] += child.quad[2] + m * (3.0 * d.x * d.z);
+    node.quad[3] += child.quad[3] + m * (3.0 * d.y * d.y - d2);
+    node.quad[4] += child.quad[4] + m * (3.0 * d.y * d.z);
+    node.quad[5] += child.quad[5] + m * (3.0 * d.z * d.z - d2);
+  }
+}
+
+void GravityTree::Walk(const Vec3 *pos, const double *soft, const int n,
+                       Vec3 *acc, double *pot, const int threads) const {
+  ParallelFor(n, threads, [&](int start, int end, int task) {
+    for (int i = start; i < end; ++i) {
+      Acceleration(pos[i], soft[i], acc[i], pot[i]);
+    }
+  });
+}
+
+void GravityTree::Acceleration(const Vec3 &pos, const double h, Vec3 &acc,
+                               double &pot) const {
+  acc = Vec3(0.0, 0.0, 0.0);
+  pot = 0.0;
+
+  int i = 0;
+  while (i < mNodes.size()) {
+    const GravityNode &node = mNodes[i];
+    Vec3 dr = pos - node.com;
+    double r2 = dr.NormSquared();
+    double size = 2.0 * node.half;
+    double soft = std::max(h, node.soft);
+
+    bool inside = fabs(pos.x - node.centre.x) <= node.half &&
+                  fabs(pos.y - node.centre.y) <= node.half &&
+                  fabs(pos.z - node.centre.z) <= node.half;
+
+    // Far enough away to use the multipole expansion.
+    if (!inside && size * size < mTheta2 * r2 && r2 > 4.0 * soft * soft) {
+      double inv_r = 1.0 / sqrt(r2);
+      double inv_r2 = inv_r * inv_r;
+      double inv_r3 = inv_r * inv_r2;
+      double inv_r5 = inv_r3 * inv_r2;
+      const double *q = node.quad;
+      Vec3 qr = Vec3(q[0] * dr.x + q[1] * dr.y + q[2] * dr.z,
+                     q[1] * dr.x + q[3] * dr.y + q[4] * dr.z,
+                     q[2] * dr.x + q[4] * dr.y + q[5] * dr.z);
+      double rqr = dr.Dot(qr);
+
+      acc -= (G_AU * node.mass * inv_r3) * dr;
+      acc += G_AU * inv_r5 * (qr - (2.5 * rqr * inv_r2) * dr);
+      pot -= G_AU * (node.mass * inv_r + 0.5 * rqr * inv_r5);
+      i = node.next;
+    } else if (node.leaf) {
+      // Direct summation with Plummer softening. The point itself is skipped.
+      for (int k = 0; k < node.count; ++k) {
+        int j = mIndex[node.first + k];
+        Vec3 d = mPos[j] - pos;
+        double d2 = d.NormSquared();
+        if (d2 == 0.0)
+          continue;
+        double eps = std::max(h, mSoft[j]);
+        double inv = 1.0 / sqrt(d2 + eps * eps);
+        acc += (G_AU * mMass[j] * inv * inv * inv) * d;
+        pot -= G_AU * mMass[j] * inv;
+      }
+      i = node.next;
+    } else {
+      i = i + 1;
+    }
+  }
+}
+
+void DirectGravity(const std::vector<Vec3> &pos,
+                   const std::vector<double> &mass,
+                   const std::vector<double> &soft, const int num_targets,
+                   Vec3 *acc, double *pot, const int threads) {
+  // Structure of arrays so the inner loop can be done two pairs at a time.
+  int n = pos.size();
+  std::vector<double> x(n), y(n), z(n), m(n), s2(n);
+  for (int j = 0; j < n; ++j) {
+    x[j] = pos[j].x;
+    y[j] = pos[j].y;
+    z[j] = pos[j].z;
+    m[j] = mass[j];
+    s2[j] = soft[j] * soft[j];
+  }
+
+  ParallelFor(num_targets, threads, [&](int start, int end, int task) {
+    for (int i = start; i < end; ++i) {
+      double px = x[i], py = y[i], pz = z[i], h2 = s2[i];
+      double ax = 0.0, ay = 0.0, az = 0.0, phi = 0.0;
+      int j = 0;
+#ifdef __SSE2__
+      __m128d vpx = _mm_set1_pd(px);
+      __m128d vpy = _mm_set1_pd(py);
+      __m128d vpz = _mm_set1_pd(pz);
+      __m128d vh2 = _mm_set1_pd(h2);
+      __m128d one = _mm_set1_pd(1.0);
+      __m128d vax = _mm_setzero_pd(), vay = _mm_setzero_pd();
+      __m128d vaz = _mm_setzero_pd(), vphi = _mm_setzero_pd();
+      for (; j + 1 < n; j += 2) {
+        __m128d dx = _mm_sub_pd(_mm_loadu_pd(&x[j]), vpx);
+        __m128d dy = _mm_sub_pd(_mm_loadu_pd(&y[j]), vpy);
+        __m128d dz = _mm_sub_pd(_mm_loadu_pd(&z[j]), vpz);
+        __m128d r2 = _mm_add_pd(_mm_mul_pd(dx, dx),
+                                _mm_add_pd(_mm_mul_pd(dy, dy),
+                                           _mm_mul_pd(dz, dz)));
+        __m128d eps2 = _mm_max_pd(vh2, _mm_loadu_pd(&s2[j]));
+        __m128d inv = _mm_div_pd(one, _mm_sqrt_pd(_mm_add_pd(r2, eps2)));
+        __m128d minv = _mm_mul_pd(_mm_loadu_pd(&m[j]), inv);
+        __m128d minv3 = _mm_mul_pd(minv, _mm_mul_pd(inv, inv));
+        vax = _mm_add_pd(vax, _mm_mul_pd(minv3, dx));
+        vay = _mm_add_pd(vay, _mm_mul_pd(minv3, dy));
+        vaz = _mm_add_pd(vaz, _mm_mul_pd(minv3, dz));
+        vphi = _mm_sub_pd(vphi, minv);
+      }
+      double lane[2];
+      _mm_storeu_pd(lane, vax);
+      ax = lane[0] + lane[1];
+      _mm_storeu_pd(lane, vay);
+      ay = lane[0] + lane[1];
+      _mm_storeu_pd(lane, vaz);
+      az = lane[0] + lane[1];
+      _mm_storeu_pd(lane, vphi);
+      phi = lane[0] + lane[1];
+#endif
+      for (; j < n; ++j) {
+        double dx = x[j] - px, dy = y[j] - py, dz = z[j] - pz;
+        double r2 = dx * dx + dy * dy + dz * dz;
+        double inv = 1.0 / sqrt(r2 + std::max(h2, s2[j]));
+        double minv = m[j] * inv;
+        double minv3 = minv * inv * inv;
+        ax += minv3 * dx;
+        ay += minv3 * dy;
+        az += minv3 * dz;
+        phi -= minv;
+      }
+      // The self term adds nothing to the acceleration but does add to the
+      // potential, so remove it.
+      phi += m[i] / sqrt(h2);
+
+      acc[i] = Vec3(ax, ay, az) * G_AU;
+      pot[i] = phi * G_AU;
+    }
+  });
+}
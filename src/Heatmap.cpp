@@ -15,84 +15,195 @@
 
 #include "Heatmap.h"
 
-Heatmap::Heatmap(const int res) : mRes(res) {}
+Heatmap::Heatmap(const int res, const std::string &quantity, const int threads)
+    : mQuantity(quantity), mRes(res), mThreads(std::max(1, threads)) {
+  if (mQuantity != "sigma" && mQuantity != "temp" && mQuantity != "tau" &&
+      mQuantity != "Q") {
+    std::cout << "   Unrecognised heatmap quantity " << mQuantity
+              << ", using tau\n";
+    mQuantity = "tau";
+  }
+  CreateColumnTable();
+}
 
 Heatmap::~Heatmap() {}
 
 void Heatmap::Create(SnapshotFile *file) {
-  const std::vector<Particle *> part = file->GetParticles();
-  float rout = file->GetOuterRadius(1);
-  float grid_size = (2.0f * rout) / (float)mRes;
+  Begin(file);
+  Add(file->GetParticles());
+  End();
+}
 
-  std::cout << "   Heatmap: rout = " << rout << " with resolution " << mRes
-            << "\n";
+void Heatmap::Begin(SnapshotFile *file) {
+  mRout = file->GetOuterRadius(1);
+  mPix = (2.0 * mRout) / (double)mRes;
 
-  for (int i = 0; i < mRes; ++i) {
-    mGrid.push_back(std::vector<float>(mRes, 0.0f));
-    mGridNum.push_back(std::vector<int>(mRes, 0));
-  }
-
-  for (int i = 0; i < part.size(); ++i) {
-    if (part[i]->GetX().Norm() > rout) {
-      continue;
-    }
+  std::cout << "   Heatmap: rout = " << mRout << " with resolution " << mRes
+            << "\n";
 
-    float x = part[i]->GetX().x;
-    float y = part[i]->GetX().y;
+  mGrid.assign(mRes, std::vector<float>(mRes, 0.0f));
+  mWeighted.assign(mRes * mRes, 0.0);
+  mWeight.assign(mRes * mRes, 0.0);
 
-    int ind_x = Bin(rout * 2.0f, x);
-    int ind_y = Bin(rout * 2.0f, y);
+  NameData nd = file->GetNameData();
+  mFileName = nd.dir + "/SPARGEL." + nd.id + "." + nd.format + "." + nd.snap +
+              ".heatmap" + std::to_string(mRes);
+  if (mQuantity != "tau")
+    mFileName += "." + mQuantity;
+}
 
-    if (ind_x < 0 || ind_x > mRes || ind_y < 0 || ind_y > mRes) {
-      std::cout << "Error in assigning bins in heatmap!\n";
+void Heatmap::Add(const std::vector<Particle *> &part) {
+  // Without an outer radius, e.g. when the disc is not centred, there is no
+  // grid to project onto and the map is left empty.
+  if (mRout <= 0.0f)
+    return;
+
+  double rout = mRout;
+  double pix = mPix;
+  int num = part.size();
+
+  // Particles smaller than a pixel are spread over one so none are lost
+  std::vector<double> x(num), y(num), h(num), m(num), val(num);
+  ParallelFor(num, mThreads, [&](int start, int end, int task) {
+    for (int i = start; i < end; ++i) {
+      x[i] = part[i]->GetX().x + rout;
+      y[i] = part[i]->GetX().y + rout;
+      h[i] = std::max((double)part[i]->GetH(), 0.5 * pix);
+      m[i] = part[i]->GetM();
+      val[i] = Value(part[i]);
     }
+  });
+
+  // Each thread lists, per tile, the particles whose kernel reaches it. The
+  // threads cover contiguous index ranges, so reading the lists in thread
+  // order visits particles in index order.
+  int tiles = (mRes + TILE_SIZE - 1) / TILE_SIZE;
+  std::vector<std::vector<std::vector<int>>> lists(
+      mThreads, std::vector<std::vector<int>>(tiles * tiles));
+  ParallelFor(num, mThreads, [&](int start, int end, int task) {
+    for (int i = start; i < end; ++i) {
+      double reach = KERNEL_SUPPORT * h[i];
+      int x0 = std::max(0.0, floor((x[i] - reach) / pix));
+      int x1 = std::min(mRes - 1.0, floor((x[i] + reach) / pix));
+      int y0 = std::max(0.0, floor((y[i] - reach) / pix));
+      int y1 = std::min(mRes - 1.0, floor((y[i] + reach) / pix));
+      if (x0 > x1 || y0 > y1)
+        continue;
+
+      for (int tx = x0 / TILE_SIZE; tx <= x1 / TILE_SIZE; ++tx) {
+        for (int ty = y0 / TILE_SIZE; ty <= y1 / TILE_SIZE; ++ty) {
+          lists[task][tx * tiles + ty].push_back(i);
+        }
+      }
+    }
+  });
+
+  // Tiles cover disjoint cells, so each is summed by one thread
+  ParallelFor(tiles * tiles, mThreads, [&](int start, int end, int task) {
+    for (int t = start; t < end; ++t) {
+      int tx0 = (t / tiles) * TILE_SIZE;
+      int ty0 = (t % tiles) * TILE_SIZE;
+      int tx1 = std::min(mRes, tx0 + TILE_SIZE);
+      int ty1 = std::min(mRes, ty0 + TILE_SIZE);
+
+      for (int l = 0; l < mThreads; ++l) {
+        const std::vector<int> &list = lists[l][t];
+        for (int k = 0; k < list.size(); ++k) {
+          int i = list[k];
+          double reach = KERNEL_SUPPORT * h[i];
+          int x0 = std::max((double)tx0, floor((x[i] - reach) / pix));
+          int x1 = std::min(tx1 - 1.0, floor((x[i] + reach) / pix));
+          int y0 = std::max((double)ty0, floor((y[i] - reach) / pix));
+          int y1 = std::min(ty1 - 1.0, floor((y[i] + reach) / pix));
+
+          double inv_h = 1.0 / h[i];
+          double norm = m[i] * inv_h * inv_h;
+          for (int ix = x0; ix <= x1; ++ix) {
+            double dx = (ix + 0.5) * pix - x[i];
+            for (int iy = y0; iy <= y1; ++iy) {
+              double dy = (iy + 0.5) * pix - y[i];
+              double q = sqrt(dx * dx + dy * dy) * inv_h;
+              if (q >= KERNEL_SUPPORT)
+                continue;
+              double w = norm * ColumnKernel(q);
+              int cell = ix * mRes + iy;
+              mWeighted[cell] += w * val[i];
+              mWeight[cell] += w;
+            }
+          }
+        }
+      }
+    }
+  });
+}
 
-    mGrid[ind_x][ind_y] += part[i]->GetTau();
-    mGridNum[ind_x][ind_y]++;
+void Heatmap::End() {
+  bool surface = mQuantity == "sigma";
+  for (int ix = 0; ix < mRes; ++ix) {
+    for (int iy = 0; iy < mRes; ++iy) {
+      int cell = ix * mRes + iy;
+      if (surface) {
+        mGrid[ix][iy] = mWeight[cell] * MSOLPERAU2_TO_GPERCM2;
+      } else if (mWeight[cell] > 0.0) {
+        mGrid[ix][iy] = mWeighted[cell] / mWeight[cell];
+      }
+    }
   }
-
-  NameData nd = file->GetNameData();
-  mFileName = nd.dir + "/SPARGEL." + nd.id + "." + nd.format + "." + nd.snap +
-              ".heatmap" + std::to_string(mRes);
+  mWeighted.clear();
+  mWeight.clear();
 }
 
 void Heatmap::Output() {
   std::ofstream out;
   out.open(mFileName);
+  TextWriter text(out);
   for (int i = 0; i < mRes; ++i) {
     for (int j = 0; j < mRes; ++j) {
-      if (mGridNum[i][j] == 0) {
-        out << this->AverageNeighbours(i, j) << "\t";
-      } else {
-        out << mGrid[i][j] / mGridNum[i][j] << "\t";
-      }
+      // As the stream prints at its default precision
+      text.WriteFloat(mGrid[i][j], 0, 6);
+      text.Write('\t');
     }
-    out << "\n";
+    text.Write('\n');
   }
+  text.Flush();
   out.close();
 }
 
-int Heatmap::Bin(float d, float x) {
-  // Move to positive space.
-  x += d / 2.0f;
-
-  // Fraction along the axis.
-  float frac = x / d;
-
-  return frac * mRes;
-}
-
-float Heatmap::AverageNeighbours(const int x, const float y) {
-  if (x == 0 || y == 0 || x == mRes - 1 || y == mRes - 1) {
-    return 0.0f;
-  }
-
-  float total = 0.0f;
-  for (int i = -1; i < 1; ++i) {
-    for (int j = -1; j < 1; ++j) {
-      total += mGrid[x + j][y + i];
+void Heatmap::CreateColumnTable() {
+  // Y(q) = (1/PI) * integral of f(sqrt(q^2 + z^2)) dz, by Simpson's rule, so
+  // a particle adds m Y(R/h) / h^2 to the surface density.
+  const int steps = 64;
+  mColumnTable.resize(COLUMN_TABLE_SIZE + 1);
+  for (int i = 0; i <= COLUMN_TABLE_SIZE; ++i) {
+    double q = (KERNEL_SUPPORT * i) / COLUMN_TABLE_SIZE;
+    double z_max = sqrt(std::max(0.0, KERNEL_SUPPORT * KERNEL_SUPPORT - q * q));
+    double dz = z_max / steps;
+
+    double sum = 0.0;
+    for (int k = 0; k <= steps; ++k) {
+      double z = k * dz;
+      double coeff = (k == 0 || k == steps) ? 1.0 : ((k % 2) ? 4.0 : 2.0);
+      sum += coeff * KernelW(sqrt(q * q + z * z));
     }
+    mColumnTable[i] = 2.0 * (sum * dz / 3.0) / PI;
   }
+}
+
+double Heatmap::ColumnKernel(const double q) const {
+  double pos = (q / KERNEL_SUPPORT) * COLUMN_TABLE_SIZE;
+  int i = pos;
+  if (i >= COLUMN_TABLE_SIZE)
+    return 0.0;
+  double frac = pos - i;
+  return mColumnTable[i] + frac * (mColumnTable[i + 1] - mColumnTable[i]);
+}
 
-  return total / 8.0f;
-}
\ No newline at end of file
+float Heatmap::Value(Particle *p) const {
+  if (mQuantity == "temp")
+    return p->GetT();
+  if (mQuantity == "Q")
+    return p->GetQ();
+  if (mQuantity == "tau")
+    return p->GetTau();
+  return 1.0f;
+}
@@ -0,0 +1,272 @@
+//===-- IOBackend.cpp -----------------------------------------------------===//
+//
+//                                  SPARGEL
+//                   Smoothed Particle Generator and Loader
+//
+// This file is distributed under the GNU General Public License. See LICENSE
+// for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// IOBackend.cpp
+///
+//===----------------------------------------------------------------------===//
+
+#include "IOBackend.h"
+
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef SPARGEL_IO_URING
+#include <liburing.h>
+#endif
+
+const char *IOBackend::NAMES[NUM_BACKENDS] = {"stream", "pread", "mmap",
+                                              "uring",  "gzip",  "zstd"};
+std::atomic<long> IOBackend::sBytes[NUM_BACKENDS];
+std::atomic<long> IOBackend::sNanoseconds[NUM_BACKENDS];
+
+class StreamBackend : public IOBackend {
+public:
+  StreamBackend() : IOBackend("stream", 0) {}
+
+  bool Open(const std::string &fileName) {
+    mInStream.open(fileName, std::ios::binary);
+    return mInStream.is_open();
+  }
+
+  void Close() { mInStream.close(); }
+
+  long Size() {
+    mInStream.clear();
+    mInStream.seekg(0, std::ios::end);
+    return mInStream.tellg();
+  }
+
+protected:
+  long ReadAt(char *data, const long bytes, const long offset) {
+    mInStream.clear();
+    mInStream.seekg(offset);
+    mInStream.read(data, bytes);
+    return mInStream.gcount();
+  }
+
+private:
+  std::ifstream mInStream;
+};
+
+class PreadBackend : public IOBackend {
+public:
+  PreadBackend() : IOBackend("pread", 1) {}
+  ~PreadBackend() { Close(); }
+
+  bool Open(const std::string &fileName) {
+    mFile = open(fileName.c_str(), O_RDONLY);
+    if (mFile < 0)
+      return false;
+    // Columns are mostly read front to back, so ask for a larger readahead
+    posix_fadvise(mFile, 0, 0, POSIX_FADV_SEQUENTIAL);
+    return true;
+  }
+
+  void Close() {
+    if (mFile >= 0)
+      close(mFile);
+    mFile = -1;
+  }
+
+  long Size() {
+    struct stat info;
+    return (fstat(mFile, &info) == 0) ? info.st_size : 0;
+  }
+
+protected:
+  int mFile = -1;
+
+  PreadBackend(const std::string &name, const int index)
+      : IOBackend(name, index) {}
+
+  long ReadAt(char *data, const long bytes, const long offset) {
+    long done = 0;
+    while (done < bytes) {
+      ssize_t n = pread(mFile, data + done, bytes - done, offset + done);
+      if (n <= 0)
+        break;
+      done += n;
+    }
+    return done;
+  }
+};
+
+class MmapBackend : public IOBackend {
+public:
+  MmapBackend() : IOBackend("mmap", 2) {}
+  ~MmapBackend() { Close(); }
+
+  bool Open(const std::string &fileName) {
+    int file = open(fileName.c_str(), O_RDONLY);
+    if (file < 0)
+      return false;
+    struct stat info;
+    if (fstat(file, &info) != 0) {
+      close(file);
+      return false;
+    }
+    mSize = info.st_size;
+    if (mSize > 0) {
+      void *map = mmap(NULL, mSize, PROT_READ, MAP_PRIVATE, file, 0);
+      if (map == MAP_FAILED) {
+        close(file);
+        return false;
+      }
+      mData = (char *)map;
+      madvise(mData, mSize, MADV_SEQUENTIAL);
+    }
+    close(file);
+    return true;
+  }
+
+  void Close() {
+    if (mData != NULL)
+      munmap(mData, mSize);
+    mData = NULL;
+    mSize = 0;
+  }
+
+  long Size() { return mSize; }
+
+protected:
+  long ReadAt(char *data, const long bytes, const long offset) {
+    if (offset >= mSize)
+      return 0;
+    long n = std::min(bytes, mSize - offset);
+    memcpy(data, mData + offset, n);
+    return n;
+  }
+
+private:
+  char *mData = NULL;
+  long mSize = 0;
+};
+
+#ifdef SPARGEL_IO_URING
+/// Single reads are positional, as for pread. Batches are queued on the ring
+/// together so the device sees every column at once.
+class UringBackend : public PreadBackend {
+public:
+  UringBackend() : PreadBackend("uring", 3) {}
+
+protected:
+  static const int QUEUE_DEPTH = 32;
+
+  void ReadRequests(std::vector<IORequest> &requests) {
+    struct io_uring ring;
+    if (io_uring_queue_init(QUEUE_DEPTH, &ring, 0) < 0) {
+      PreadBackend::ReadRequests(requests);
+      return;
+    }
+
+    int next = 0, pending = 0;
+    while (next < requests.size() || pending > 0) {
+      while (next < requests.size() && pending < QUEUE_DEPTH) {
+        struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+        if (sqe == NULL)
+          break;
+        IORequest &request = requests[next++];
+        io_uring_prep_read(sqe, mFile, request.data, request.bytes,
+                           request.offset);
+        io_uring_sqe_set_data(sqe, &request);
+        ++pending;
+      }
+      io_uring_submit(&ring);
+
+      struct io_uring_cqe *cqe = NULL;
+      if (io_uring_wait_cqe(&ring, &cqe) < 0) {
+        // Start again without the ring, rather than track what completed
+        io_uring_queue_exit(&ring);
+        PreadBackend::ReadRequests(requests);
+        return;
+      }
+      IORequest *request = (IORequest *)io_uring_cqe_get_data(cqe);
+      long done = std::max(0, cqe->res);
+      io_uring_cqe_seen(&ring, cqe);
+      --pending;
+
+      // Short reads are finished off directly
+      if (done < request->bytes) {
+        ReadAt(request->data + done, request->bytes - done,
+               request->offset + done);
+      }
+    }
+    io_uring_queue_exit(&ring);
+  }
+};
+#endif
+
+IOBackend *IOBackend::Create(const std::string &name) {
+  if (name == "pread")
+    return new PreadBackend();
+  if (name == "mmap")
+    return new MmapBackend();
+#ifdef SPARGEL_IO_URING
+  if (name == "uring")
+    return new UringBackend();
+#endif
+  if (name != "stream") {
+    static std::atomic<bool> warned(false);
+    if (!warned.exchange(true)) {
+      std::cout << "   I/O backend " << name
+                << " not available, using stream\n";
+    }
+  }
+  return new StreamBackend();
+}
+
+void IOBackend::Report() {
+  for (int i = 0; i < NUM_BACKENDS; ++i) {
+    if (sBytes[i] == 0)
+      continue;
+    double mb = sBytes[i] / 1048576.0;
+    double seconds = sNanoseconds[i] * 1E-9;
+    std::cout << "   I/O " << std::left << std::setw(12) << NAMES[i]
+              << std::right << " : " << mb << " MB in " << seconds << " s";
+    if (seconds > 0.0)
+      std::cout << ", " << mb / seconds << " MB/s";
+    std::cout << "\n";
+  }
+}
+
+long IOBackend::Read(char *data, const long bytes, const long offset) {
+  auto start = std::chrono::steady_clock::now();
+  long n = ReadAt(data, bytes, offset);
+  auto end = std::chrono::steady_clock::now();
+  Count(n, std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+               .count());
+  return n;
+}
+
+void IOBackend::ReadBatch(std::vector<IORequest> &requests) {
+  auto start = std::chrono::steady_clock::now();
+  ReadRequests(requests);
+  auto end = std::chrono::steady_clock::now();
+  long bytes = 0;
+  for (int i = 0; i < requests.size(); ++i)
+    bytes += requests[i].bytes;
+  Count(bytes, std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+                   .count());
+}
+
+void IOBackend::ReadRequests(std::vector<IORequest> &requests) {
+  for (int i = 0; i < requests.size(); ++i)
+    ReadAt(requests[i].data, requests[i].bytes, requests[i].offset);
+}
+
+void IOBackend::Count(const long bytes, const long nanoseconds) {
+  sBytes[mIndex] += bytes;
+  sNanoseconds[mIndex] += nanoseconds;
+}
@@ -15,16 +15,19 @@
 
 #include "MassAnalyser.h"
 
-MassAnalyser::MassAnalyser() {}
+MassAnalyser::MassAnalyser(const int threads) : mShards(threads) {}
 
 MassAnalyser::~MassAnalyser() {}
 
-void MassAnalyser::ExtractValues(SnapshotFile *file) {
-  std::vector<Particle *> part = file->GetParticles();
-  std::vector<Sink *> sinks = file->GetSinks();
-  MassComponent mc = {};
-  mc.time = file->GetTime();
+void MassAnalyser::ExtractValues(SnapshotFile *file, const int task) {
+  MassTally tally = {};
+  Tally(tally, file->GetParticles(), file->GetSinks());
+  Report(file, tally, task);
+}
 
+void MassAnalyser::Tally(MassTally &tally, const std::vector<Particle *> &part,
+                         const std::vector<Sink *> &sinks) const {
+  MassComponent &mc = tally.mc;
   for (int i = 0; i < part.size(); ++i) {
     Particle *p = part[i];
     if (p->GetType() == GAS_TYPE) {
@@ -36,56 +39,68 @@ void MassAnalyser::ExtractValues(SnapshotFile *file) {
     }
     mc.tot_mass += p->GetM();
   }
+  tally.num += part.size();
 
   // Find maximum density position of that of a formed companion if it exists.
-  if (sinks.size() == 1) {
-    float max_dens = 0.0f;
+  if (sinks.size() <= 1) {
     for (int i = 0; i < part.size(); ++i) {
       Particle *p = part[i];
-      if (p->GetD() > max_dens) {
-        max_dens = p->GetD();
+      if (p->GetD() > tally.max_dens) {
+        tally.max_dens = p->GetD();
         mc.rdens = p->GetR();
       }
     }
-  } else {
-    mc.rdens = sinks[1]->GetR();
   }
 
-  for (int i = 0; i < sinks.size(); ++i) {
-    mc.tot_mass += sinks[i]->GetM();
-    mc.sink_mass += sinks[i]->GetM();
-    mc.unique_sink_mass[i] = sinks[i]->GetM();
-    mc.sink_num++;
-  }
-
-  mMasses.push_back(mc);
-
-  // Mass and N within 1 AU of companion. Hill radius calculation.
-  float sink_mass[3] = {0.0, 0.0, 0.0};
-  float sink_n[3] = {0.0, 0.0, 0.0};
-  float hill_radius = 0.0;
-  if (sinks.size() > 0) {
+  // Mass and N within 1 AU of companion.
+  if (sinks.size() > 1) {
     Vec3 sink_pos = sinks[1]->GetX();
     for (int i = 0; i < part.size(); ++i) {
       float dx = (part[i]->GetX() - sink_pos).Norm();
 
       if (dx < 0.25) {
-        sink_mass[0] += part[i]->GetM() * MSUN_TO_MJUP;
-        sink_n[0]++;
+        tally.sink_mass[0] += part[i]->GetM() * MSUN_TO_MJUP;
+        tally.sink_n[0]++;
       }
       if (dx < 0.5) {
-        sink_mass[1] += part[i]->GetM() * MSUN_TO_MJUP;
-        sink_n[1]++;
+        tally.sink_mass[1] += part[i]->GetM() * MSUN_TO_MJUP;
+        tally.sink_n[1]++;
       }
       if (dx < 1.0) {
-        sink_mass[2] += part[i]->GetM() * MSUN_TO_MJUP;
-        sink_n[2]++;
+        tally.sink_mass[2] += part[i]->GetM() * MSUN_TO_MJUP;
+        tally.sink_n[2]++;
       }
     }
+  }
+}
+
+void MassAnalyser::Report(SnapshotFile *file, MassTally &tally,
+                          const int task) {
+  std::vector<Sink *> sinks = file->GetSinks();
+  MassComponent &mc = tally.mc;
+  mc.time = file->GetTime();
+
+  if (sinks.size() > 1) {
+    mc.rdens = sinks[1]->GetR();
+  }
+
+  for (int i = 0; i < sinks.size(); ++i) {
+    mc.tot_mass += sinks[i]->GetM();
+    mc.sink_mass += sinks[i]->GetM();
+    mc.unique_sink_mass[i] = sinks[i]->GetM();
+    mc.sink_num++;
+  }
+
+  mShards.Add(task, mc);
+
+  // Hill radius calculation.
+  float *sink_mass = tally.sink_mass;
+  float *sink_n = tally.sink_n;
+  float hill_radius = 0.0;
+  if (sinks.size() > 1) {
     for (int i = 0; i < 3; ++i) {
-      sink_n[i] /= part.size();
+      sink_n[i] /= tally.num;
     }
-    // Hill radius
     hill_radius =
         sinks[1]->GetR() *
         pow(sink_mass[2] / (3 * sinks[0]->GetM() * MSUN_TO_MJUP), 0.33f);
@@ -129,10 +144,12 @@ void MassAnalyser::ExtractValues(SnapshotFile *file) {
             << " Mjup\n";
 }
 
-void MassAnalyser::CalculateAccretionRate() {
-  std::sort(mMasses.begin(), mMasses.end(),
-            [](MassComponent a, MassComponent b) { return b.time > a.time; });
+void MassAnalyser::Merge() {
+  mMasses = mShards.Merge(
+      [](MassComponent a, MassComponent b) { return b.time > a.time; });
+}
 
+void MassAnalyser::CalculateAccretionRate() {
   for (int i = 1; i < mMasses.size(); ++i) {
     float dt = mMasses[i - 1].time - mMasses[i].time;
     float dM = mMasses[i - 1].tot_mass - mMasses[i].tot_mass;
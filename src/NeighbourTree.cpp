@@ -0,0 +1,116 @@
+//===-- NeighbourTree.cpp -------------------------------------------------===//
+//
+//                                  SPARGEL
+//                   Smoothed Particle Generator and Loader
+//
+// This file is distributed under the GNU General Public License. See LICENSE
+// for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// NeighbourTree.cpp
+///
+//===----------------------------------------------------------------------===//
+
+#include "NeighbourTree.h"
+
+NeighbourTree::NeighbourTree(const int leaf_size)
+    : mLeafSize(std::max(1, leaf_size)) {}
+
+NeighbourTree::~NeighbourTree() {}
+
+void NeighbourTree::Build(const std::vector<Vec3> &pos) {
+  mPos = pos;
+  mNodes.clear();
+  mIndex.resize(mPos.size());
+  for (int i = 0; i < mIndex.size(); ++i) {
+    mIndex[i] = i;
+  }
+  if (mPos.size() == 0)
+    return;
+
+  mNodes.reserve(2 * mPos.size() / mLeafSize + 1);
+  BuildNode(0, mPos.size(), 0);
+}
+
+int NeighbourTree::BuildNode(const int first, const int count,
+                             const int depth) {
+  int index = mNodes.size();
+  mNodes.push_back(NeighbourNode());
+
+  Vec3 lo = mPos[mIndex[first]], hi = mPos[mIndex[first]];
+  for (int i = first + 1; i < first + count; ++i) {
+    const Vec3 &p = mPos[mIndex[i]];
+    for (int j = 0; j < 3; ++j) {
+      lo[j] = std::min(lo[j], p[j]);
+      hi[j] = std::max(hi[j], p[j]);
+    }
+  }
+  mNodes[index].min = lo;
+  mNodes[index].max = hi;
+  mNodes[index].first = first;
+  mNodes[index].count = count;
+
+  if (count <= mLeafSize || depth >= MAX_DEPTH)
+    return index;
+
+  int axis = 0;
+  for (int j = 1; j < 3; ++j) {
+    if (hi[j] - lo[j] > hi[axis] - lo[axis])
+      axis = j;
+  }
+
+  // Median split, so the tree stays balanced for clustered discs
+  int half = count / 2;
+  std::nth_element(mIndex.begin() + first, mIndex.begin() + first + half,
+                   mIndex.begin() + first + count, [&](int a, int b) {
+                     return mPos[a][axis] < mPos[b][axis];
+                   });
+
+  int left = BuildNode(first, half, depth + 1);
+  int right = BuildNode(first + half, count - half, depth + 1);
+  mNodes[index].left = left;
+  mNodes[index].right = right;
+
+  return index;
+}
+
+void NeighbourTree::FindNeighbours(const Vec3 &pos, const double radius,
+                                   std::vector<int> &neighbours) const {
+  neighbours.clear();
+  if (mNodes.empty())
+    return;
+
+  double radius2 = radius * radius;
+  int stack[MAX_DEPTH + 2];
+  int top = 0;
+  stack[top++] = 0;
+
+  while (top > 0) {
+    const NeighbourNode &node = mNodes[stack[--top]];
+
+    // Distance from the point to the bounding box
+    double d2 = 0.0;
+    for (int j = 0; j < 3; ++j) {
+      double d = 0.0;
+      if (pos[j] < node.min[j])
+        d = node.min[j] - pos[j];
+      else if (pos[j] > node.max[j])
+        d = pos[j] - node.max[j];
+      d2 += d * d;
+    }
+    if (d2 > radius2)
+      continue;
+
+    if (node.left < 0) {
+      for (int i = node.first; i < node.first + node.count; ++i) {
+        if ((mPos[mIndex[i]] - pos).NormSquared() <= radius2)
+          neighbours.push_back(mIndex[i]);
+      }
+    } else {
+      stack[top++] = node.right;
+      stack[top++] = node.left;
+    }
+  }
+}
@@ -125,6 +125,26 @@ void Parameters::SetDefaultParameters() {
   mIntParams["EXTRA_QUANTITIES"] = 0;
   mIntParams["RESET_TIME"] = 0;
   mIntParams["REDUCE_PARTICLES"] = 0;
+  mIntParams["SPH_DENSITY"] = 0;
+  mIntParams["PARTICLE_THREADS"] = 1;
+  mIntParams["READ_FILTER"] = 0;
+  mIntParams["READ_TYPE"] = 0;
+  mFloatParams["READ_DENSITY"] = 0.0;
+  mIntParams["CATALOGUE"] = 0;
+  mFloatParams["TIME_MIN"] = 0.0;
+  mFloatParams["TIME_MAX"] = 0.0;
+  mIntParams["SNAP_STRIDE"] = 1;
+  mIntParams["STREAM_ANALYSIS"] = 0;
+  mIntParams["CHUNK_SIZE"] = 1000000;
+  mIntParams["TRANSCODE"] = 1;
+  mStringParams["IO_BACKEND"] = "stream";
+  mStringParams["COMPRESSION"] = "none";
+  mIntParams["SPAR_CHUNK_SIZE"] = 8192;
+  mIntParams["DERIVED_CACHE"] = 0;
+
+  mIntParams["GRAVITY"] = 0;
+  mIntParams["GRAVITY_LEAF"] = 8;
+  mFloatParams["GRAVITY_THETA"] = 0.5;
 
   mIntParams["CLOUD_ANALYSIS"] = 0;
   mIntParams["CLOUD_CENTER"] = 0;
@@ -135,6 +155,7 @@ void Parameters::SetDefaultParameters() {
   mIntParams["DISC_ANALYSIS"] = 0;
   mIntParams["RADIAL_ANALYSIS"] = 0;
   mIntParams["VERTICAL_ANALYSIS"] = 0;
+  mStringParams["RADIAL_OUTPUT"] = "text";
   mIntParams["EVOLUTION_ANALYSIS"] = 0;
   mIntParams["CLUMP_ANALYSIS"] = 0;
   mIntParams["DISC_CENTER"] = 0;
@@ -159,6 +180,7 @@ void Parameters::SetDefaultParameters() {
 
   mIntParams["HEATMAP"] = 0;
   mIntParams["HEATMAP_RES"] = 64;
+  mStringParams["HEATMAP_QUANTITY"] = "tau";
 
   mIntParams["COOLING_MAP"] = 0;
   mStringParams["COOLING_MAP_NAME"] = "cooling_map";
@@ -170,10 +192,13 @@ void Parameters::SetDefaultParameters() {
   mIntParams["TEMP_BINS"] = 0;
 
   mIntParams["GENERATE"] = 0;
+  mIntParams["GENERATE_STREAM"] = 0;
+  mIntParams["GENERATE_CHUNK"] = 1000000;
   mStringParams["IC_TYPE"] = "disc";
   mIntParams["SEED"] = 0;
   mIntParams["N_HYDRO"] = 4096;
   mIntParams["DIMENSIONS"] = 3;
+  mIntParams["DIRECT_GRAVITY"] = 0;
 
   mFloatParams["M_STAR"] = 0.5;
   mFloatParams["M_DISC"] = 0.01;
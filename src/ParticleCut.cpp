@@ -0,0 +1,127 @@
+//===-- ParticleCut.cpp ---------------------------------------------------===//
+//
+//                                  SPARGEL
+//                   Smoothed Particle Generator and Loader
+//
+// This file is distributed under the GNU General Public License. See LICENSE
+// for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// ParticleCut.cpp
+///
+//===----------------------------------------------------------------------===//
+
+#include "ParticleCut.h"
+
+ParticleCut::ParticleCut(const int threads) : mThreads(std::max(1, threads)) {}
+
+ParticleCut::~ParticleCut() {}
+
+void ParticleCut::SetRadial(const float dist, const int dim) {
+  mRadial = true;
+  mRadialDist = dist;
+  mRadialDim = dim;
+}
+
+void ParticleCut::SetHill(const Vec3 &centre, const float radius) {
+  mHill = true;
+  mHillCentre = centre;
+  mHillRadius = radius;
+}
+
+void ParticleCut::SetMidplane(const float height) {
+  mMidplane = true;
+  mMidplaneHeight = height;
+}
+
+bool ParticleCut::PassRadial(const Vec3 &x) const {
+  float r = 0.0f;
+  if (mRadialDim == 2) {
+    r = x.Norm2();
+  } else if (mRadialDim == 3) {
+    r = x.Norm();
+  }
+  return r < mRadialDist;
+}
+
+void ParticleCut::Apply(std::vector<Particle *> &part) {
+  int n = part.size();
+  std::vector<int> start(mThreads, 0);
+  std::vector<int> kept(mThreads, 0);
+  std::vector<long> rejected(3 * mThreads, 0);
+  std::vector<long> radial(mThreads, 0);
+  std::vector<double> best_dens(mThreads, 0.0);
+  std::vector<Vec3> best_vel(mThreads, Vec3(0.0, 0.0, 0.0));
+
+  // Test each particle against every cut, compacting survivors to the front
+  // of the thread's own batch.
+  ParallelFor(n, mThreads, [&](int s, int e, int task) {
+    start[task] = s;
+    int out = s;
+    bool found = false;
+    for (int i = s; i < e; ++i) {
+      Particle *p = part[i];
+      Vec3 x = p->GetX();
+      int fail = -1;
+      if (mRadial && !PassRadial(x)) {
+        fail = CUT_RADIAL;
+      } else {
+        if (mRadial) {
+          radial[task]++;
+          if (!found || p->GetD() > best_dens[task]) {
+            found = true;
+            best_dens[task] = p->GetD();
+            best_vel[task] = p->GetV();
+          }
+        }
+        if (mHill && (x - mHillCentre).Norm() <= mHillRadius) {
+          fail = CUT_HILL;
+        } else if (mMidplane && fabs(x.z) > mMidplaneHeight) {
+          fail = CUT_MIDPLANE;
+        }
+      }
+
+      if (fail >= 0) {
+        rejected[3 * task + fail]++;
+        delete p;
+      } else {
+        part[out++] = p;
+      }
+    }
+    kept[task] = out - s;
+  });
+
+  // Join the batches in order. Each moves towards the front, so a forward
+  // copy never overwrites a batch which has not yet been moved.
+  int pos = 0;
+  bool found = false;
+  double dens = 0.0;
+  mRadialCount = 0;
+  for (int t = 0; t < mThreads; ++t) {
+    std::copy(part.begin() + start[t], part.begin() + start[t] + kept[t],
+              part.begin() + pos);
+    pos += kept[t];
+    for (int c = 0; c < 3; ++c)
+      mRejected[c] += rejected[3 * t + c];
+    // The first densest particle in index order
+    if (radial[t] > 0 && (!found || best_dens[t] > dens)) {
+      found = true;
+      dens = best_dens[t];
+      mFrameVelocity = best_vel[t];
+    }
+    mRadialCount += radial[t];
+  }
+  part.resize(pos);
+
+  // Move the survivors into the frame of the densest particle
+  if (mRadial && found) {
+    Vec3 vel = mFrameVelocity;
+    ParallelFor(part.size(), mThreads, [&](int s, int e, int task) {
+      for (int i = s; i < e; ++i) {
+        part[i]->SetV(part[i]->GetV() - vel);
+      }
+    });
+  }
+}
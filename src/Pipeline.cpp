@@ -0,0 +1,178 @@
+//===-- Pipeline.cpp ------------------------------------------------------===//
+//
+//                                  SPARGEL
+//                   Smoothed Particle Generator and Loader
+//
+// This file is distributed under the GNU General Public License. See LICENSE
+// for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Pipeline.cpp
+///
+//===----------------------------------------------------------------------===//
+
+#include "Pipeline.h"
+
+#include "DerivedCache.h"
+
+// Derived quantities which are no longer valid after the given writes.
+static int Invalidated(const int writes) {
+  int lost = 0;
+  if (writes & STAGE_DENSITY)
+    lost |= DERIVED_ALL;
+  if (writes & (STAGE_POSITION | STAGE_PARTICLES | STAGE_SINKS))
+    lost |= DERIVED_MOVED;
+  if (writes & DERIVED_THERMO)
+    lost |= DERIVED_MOVED;
+  if (writes & DERIVED_TOOMRE)
+    lost |= DERIVED_BETA;
+  return lost & ~(writes & DERIVED_ALL);
+}
+
+// Reordering the particles does not change any quantity, but does change the
+// particle set seen by other stages.
+static int Touched(const int writes) {
+  return (writes & STAGE_ORDER) ? (writes | STAGE_PARTICLES) : writes;
+}
+
+static bool Conflicts(const Stage &a, const Stage &b) {
+  int a_writes = Touched(a.writes), b_writes = Touched(b.writes);
+  return (a_writes & (b.reads | b_writes)) || (b_writes & a.reads);
+}
+
+Pipeline::Pipeline(std::function<std::vector<Stage>(int, int)> provider,
+                   const int threads)
+    : mProvider(provider), mThreads(std::max(1, threads)) {}
+
+Pipeline::~Pipeline() {}
+
+void Pipeline::Add(Stage stage) {
+  int needed = stage.reads & DERIVED_ALL;
+  if (needed & ~mValid) {
+    std::vector<Stage> providers = mProvider(needed, mValid);
+    for (int i = 0; i < providers.size(); ++i)
+      Append(providers[i]);
+  }
+  Append(stage);
+}
+
+void Pipeline::Append(const Stage &stage) {
+  mStages.push_back(stage);
+  mValid &= ~Invalidated(stage.writes);
+  mValid |= stage.writes & DERIVED_ALL;
+}
+
+void Pipeline::Build() {
+  // Fuse runs of per-particle kernels into single passes
+  std::vector<Stage> fused;
+  std::vector<Stage> kernels;
+  for (int i = 0; i < mStages.size(); ++i) {
+    if (mStages[i].kernel && !mStages[i].run) {
+      kernels.push_back(mStages[i]);
+      continue;
+    }
+    if (kernels.size() > 0) {
+      fused.push_back(Fuse(kernels));
+      kernels.clear();
+    }
+    fused.push_back(mStages[i]);
+  }
+  if (kernels.size() > 0)
+    fused.push_back(Fuse(kernels));
+
+  // A stage joins the current wave if it conflicts with nothing in it, so
+  // conflicting stages always run in their declared order.
+  mWaves.clear();
+  for (int i = 0; i < fused.size(); ++i) {
+    bool conflict = mWaves.empty();
+    if (!conflict) {
+      for (int j = 0; j < mWaves.back().size(); ++j) {
+        if (Conflicts(fused[i], mWaves.back()[j])) {
+          conflict = true;
+          break;
+        }
+      }
+    }
+    if (conflict)
+      mWaves.push_back(std::vector<Stage>());
+    mWaves.back().push_back(fused[i]);
+  }
+}
+
+Stage Pipeline::Fuse(const std::vector<Stage> &kernels) const {
+  // The pass walks the particle set, so it reads it whatever the kernels do
+  Stage fused;
+  fused.reads = STAGE_PARTICLES;
+  fused.cached = true;
+  std::vector<std::function<void(Particle *)>> funcs;
+  for (int i = 0; i < kernels.size(); ++i) {
+    fused.name += ((i > 0) ? " + " : "") + kernels[i].name;
+    fused.reads |= kernels[i].reads;
+    fused.writes |= kernels[i].writes;
+    fused.provides |= kernels[i].provides;
+    fused.cached = fused.cached && kernels[i].cached;
+    funcs.push_back(kernels[i].kernel);
+  }
+
+  int threads = mThreads;
+  fused.run = [funcs, threads](SnapshotFile *file, int task) {
+    std::vector<Particle *> part = file->GetParticles();
+    ParallelFor(part.size(), threads, [&](int start, int end, int t) {
+      for (int i = start; i < end; ++i) {
+        for (int k = 0; k < funcs.size(); ++k)
+          funcs[k](part[i]);
+      }
+    });
+  };
+  return fused;
+}
+
+void Pipeline::Run(SnapshotFile *file, const int task, DerivedCache *cache) {
+  for (int w = 0; w < mWaves.size(); ++w) {
+    // Providers whose quantities are already valid are skipped
+    std::vector<const Stage *> active;
+    for (int i = 0; i < mWaves[w].size(); ++i) {
+      const Stage &s = mWaves[w][i];
+      if (s.provides && (file->GetDerived() & s.provides) == s.provides)
+        continue;
+      active.push_back(&s);
+    }
+
+    auto run = [=](const Stage *s) {
+      if (cache != NULL && s->cached) {
+        cache->Run(*s, file, task);
+      } else {
+        s->run(file, task);
+      }
+    };
+    std::vector<std::thread> pool;
+    for (int i = 1; i < active.size(); ++i) {
+      pool.push_back(std::thread(run, active[i]));
+    }
+    if (active.size() > 0)
+      run(active[0]);
+    for (int i = 0; i < pool.size(); ++i) {
+      pool[i].join();
+    }
+
+    // Validity is updated once the wave has joined
+    for (int i = 0; i < active.size(); ++i) {
+      file->InvalidateDerived(Invalidated(active[i]->writes));
+      file->SetDerived(active[i]->writes & DERIVED_ALL);
+    }
+  }
+}
+
+std::string Pipeline::Describe() const {
+  std::string desc = "";
+  for (int w = 0; w < mWaves.size(); ++w) {
+    if (w > 0)
+      desc += " | ";
+    for (int i = 0; i < mWaves[w].size(); ++i) {
+      desc += ((i > 0) ? " & " : "") + mWaves[w][i].name;
+    }
+  }
+  return desc;
+}
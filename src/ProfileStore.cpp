@@ -0,0 +1,148 @@
+//===-- ProfileStore.cpp --------------------------------------------------===//
+//
+//                                  SPARGEL
+//                   Smoothed Particle Generator and Loader
+//
+// This file is distributed under the GNU General Public License. See LICENSE
+// for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// ProfileStore.cpp
+///
+//===----------------------------------------------------------------------===//
+
+#include "ProfileStore.h"
+
+ProfileStore::ProfileStore(NameData nd, const int bins, const float in,
+                           const float width, const int log, const int threads)
+    : mNameData(nd), mBins(bins), mIn(in), mWidth(width), mLog(log) {
+  if (mNameData.dir == "")
+    mNameData.dir = ".";
+  mFileName = mNameData.dir + "/SPARGEL." + mNameData.id + ".profiles";
+  mSegments.assign(threads, NULL);
+  mEntries.resize(threads);
+}
+
+ProfileStore::~ProfileStore() {
+  for (int i = 0; i < mSegments.size(); ++i) {
+    delete mSegments[i];
+  }
+}
+
+void ProfileStore::Append(const int task, SnapshotFile *file,
+                          const RadialProfile &profile) {
+  if (mSegments[task] == NULL) {
+    mSegments[task] = new std::ofstream(SegmentName(task), std::ios::binary);
+    if (!mSegments[task]->is_open()) {
+      std::cout << "   Could not open profile segment " << SegmentName(task)
+                << " for writing!\n";
+    }
+  }
+
+  // Record: particle counts then averages, both bin-major
+  std::ofstream &out = *mSegments[task];
+  for (int r = 0; r < mBins; ++r) {
+    long num = profile.GetNumParticles(r);
+    out.write((char *)&num, sizeof(num));
+  }
+  for (int r = 0; r < mBins; ++r) {
+    for (int q = 0; q < TOT_RAD_QUAN; ++q) {
+      float value = profile.GetAverage(r, q);
+      out.write((char *)&value, sizeof(value));
+    }
+  }
+
+  NameData nd = file->GetNameData();
+  Entry entry;
+  entry.time = file->GetTime();
+  entry.snap = nd.snap;
+  entry.task = task;
+  entry.index = mEntries[task].size();
+  mEntries[task].push_back(entry);
+}
+
+bool ProfileStore::Write() {
+  std::vector<Entry> entries;
+  for (int t = 0; t < mEntries.size(); ++t) {
+    entries.insert(entries.end(), mEntries[t].begin(), mEntries[t].end());
+    if (mSegments[t] != NULL)
+      mSegments[t]->close();
+  }
+  std::stable_sort(entries.begin(), entries.end(), [](Entry a, Entry b) {
+    return (a.time != b.time) ? a.time < b.time : a.snap < b.snap;
+  });
+
+  std::ofstream out(mFileName, std::ios::binary);
+  if (!out.is_open()) {
+    std::cout << "   Could not open file " << mFileName << " for writing!\n";
+    return false;
+  }
+  std::cout << "   File output      : " << mFileName << "\n";
+
+  int records = entries.size();
+  long counts_bytes = mBins * sizeof(long);
+  long cube_bytes = mBins * TOT_RAD_QUAN * sizeof(float);
+  long sections[3];
+  sections[0] = STRING_LENGTH + 4 * sizeof(int) + 2 * sizeof(float) +
+                sizeof(sections) + mBins * sizeof(double);
+  sections[1] = sections[0] + records * (sizeof(double) + STRING_LENGTH);
+  sections[2] = sections[1] + records * counts_bytes;
+
+  char magic[STRING_LENGTH] = {};
+  FORMAT.copy(magic, STRING_LENGTH);
+  int header[4] = {mBins, TOT_RAD_QUAN, records, mLog};
+  float layout[2] = {mIn, mWidth};
+  out.write(magic, STRING_LENGTH);
+  out.write((char *)header, sizeof(header));
+  out.write((char *)layout, sizeof(layout));
+  out.write((char *)sections, sizeof(sections));
+  for (int r = 0; r < mBins; ++r) {
+    double radius = mIn + (r + 0.5) * mWidth;
+    if (mLog)
+      radius = pow(10.0, radius);
+    out.write((char *)&radius, sizeof(radius));
+  }
+
+  for (int i = 0; i < records; ++i) {
+    char snap[STRING_LENGTH] = {};
+    entries[i].snap.copy(snap, STRING_LENGTH);
+    out.write((char *)&entries[i].time, sizeof(double));
+    out.write(snap, STRING_LENGTH);
+  }
+
+  // Copy each record from its segment into the count and cube sections
+  std::vector<std::ifstream *> segments(mSegments.size(), NULL);
+  std::vector<char> counts(counts_bytes), cube(cube_bytes);
+  for (int i = 0; i < records; ++i) {
+    int t = entries[i].task;
+    if (segments[t] == NULL)
+      segments[t] = new std::ifstream(SegmentName(t), std::ios::binary);
+    segments[t]->seekg((long)entries[i].index * RecordSize());
+    segments[t]->read(counts.data(), counts_bytes);
+    segments[t]->read(cube.data(), cube_bytes);
+
+    out.seekp(sections[1] + i * counts_bytes);
+    out.write(counts.data(), counts_bytes);
+    out.seekp(sections[2] + i * cube_bytes);
+    out.write(cube.data(), cube_bytes);
+  }
+  out.close();
+
+  for (int t = 0; t < segments.size(); ++t) {
+    delete segments[t];
+    if (mSegments[t] != NULL)
+      std::remove(SegmentName(t).c_str());
+  }
+
+  return true;
+}
+
+std::string ProfileStore::SegmentName(const int task) {
+  return mFileName + ".segment" + std::to_string(task);
+}
+
+long ProfileStore::RecordSize() {
+  return mBins * (sizeof(long) + TOT_RAD_QUAN * sizeof(float));
+}
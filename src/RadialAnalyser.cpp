@@ -23,73 +23,76 @@ RadialAnalyser::RadialAnalyser(Parameters *params) : mParams(params) {
   mLog = mParams->GetInt("RADIAL_LOG");
   mVert = mParams->GetInt("VERTICAL_ANALYSIS");
   mWidth = (mOut - mIn) / mBins;
+  mThreads = std::max(1, mParams->GetInt("PARTICLE_THREADS"));
+  mBinaryOutput = mParams->GetString("RADIAL_OUTPUT") == "binary";
+  mStoreOutput = mParams->GetString("RADIAL_OUTPUT") == "store";
 }
 
-RadialAnalyser::~RadialAnalyser() {
-  for (int i = 0; i < mRadialBins.size(); ++i) {
-    delete mRadialBins[i];
-  }
-  mRadialBins.clear();
-}
+RadialAnalyser::~RadialAnalyser() {}
 
-void RadialAnalyser::Run(SnapshotFile *file) {
-  // Create the bins.
-  float cur_inner = mIn;
-  float cur_outer = mOut;
-  for (int i = 0; i < mBins; ++i) {
-    mRadialBins.push_back(new RadialBin(mParams, cur_inner, cur_outer, mWidth));
-    cur_outer = cur_inner;
-    cur_inner += mWidth;
-  }
+void RadialAnalyser::Run(SnapshotFile *file, ProfileStore *store,
+                         const int task) {
+  RadialProfile profile = CreateProfile();
+  Accumulate(profile, file->GetParticles());
+  Output(file, profile, store, task);
+}
 
-  // Allocate particles to bins
-  std::vector<Particle *> part = file->GetParticles();
-  std::vector<Sink *> sink = file->GetSinks();
-  for (int i = 0; i < part.size(); ++i) {
-    float r = 0.0;
-    if (mSpherical) {
-      r = part[i]->GetX().Norm();
-    } else {
-      r = part[i]->GetX().Norm2();
-    }
+RadialProfile RadialAnalyser::CreateProfile() const {
+  // Vertical bins are only accumulated when they are output
+  int vert_bins = (mVert) ? mParams->GetInt("VERTICAL_BINS") : 0;
+  float height_lo = mParams->GetFloat("HEIGHT_LO");
+  float height_hi = mParams->GetFloat("HEIGHT_HI");
+  float bin_height =
+      (height_hi - height_lo) / std::max(1, mParams->GetInt("VERTICAL_BINS"));
+  return RadialProfile(mBins, mIn, mWidth, vert_bins, height_lo, bin_height);
+}
 
-    if (mLog) {
-      r = log10(r);
-    }
+void RadialAnalyser::Accumulate(RadialProfile &profile,
+                                const std::vector<Particle *> &part) const {
+  // Accumulate each thread's particles into its own profile
+  int threads = std::max(1, std::min(mThreads, (int)part.size()));
+  std::vector<RadialProfile> profiles(threads, CreateProfile());
+  ParallelFor(part.size(), threads, [&](int start, int end, int task) {
+    for (int i = start; i < end; ++i) {
+      float r = 0.0;
+      if (mSpherical) {
+        r = part[i]->GetX().Norm();
+      } else {
+        r = part[i]->GetX().Norm2();
+      }
 
-    int binID = GetBinID(r - mIn);
+      if (mLog) {
+        r = log10(r);
+      }
 
-    if (binID < mRadialBins.size() && binID >= 0) {
-      mRadialBins.at(binID)->AddParticle(part[i]);
+      profiles[task].Add(part[i], r);
     }
-  }
+  });
 
-  // Calculate radial averages
-  for (int i = 0; i < mRadialBins.size(); ++i) {
-    mRadialBins[i]->CalculateValues();
+  for (int t = 0; t < threads; ++t) {
+    profile.Merge(profiles[t]);
   }
+}
 
-  // Find the cumulative mass and energy of the bins.
-  double total_mass = 0.0f, energy[4] = {0.0, 0.0, 0.0, 0.0};
-  for (int i = 0; i < mRadialBins.size(); ++i) {
-    total_mass += mRadialBins[i]->GetAverage(11);
-    mRadialBins[i]->SetAverage(total_mass, 11);
+void RadialAnalyser::Output(SnapshotFile *file, RadialProfile &profile,
+                            ProfileStore *store, const int task) {
+  profile.Finalise();
 
-    for (int e = 0; e < 4; ++e) {
-      energy[e] += mRadialBins[i]->GetAverage(16 + e);
-      mRadialBins[i]->SetAverage(energy[e], 16 + e);
-    }
+  if (store != NULL) {
+    store->Append(task, file, profile);
+    if (mStoreOutput)
+      return;
   }
 
   // Output number of particles within a radius.
   float interior = 1.0f;
   int total_part = 0;
-  for (int i = 0; i < mRadialBins.size(); ++i) {
-    if (mRadialBins[i]->GetMid() >= log10(interior)) {
+  for (int i = 0; i < mBins; ++i) {
+    if (profile.GetMid(i) >= log10(interior)) {
       break;
     }
 
-    total_part += mRadialBins[i]->GetNumParticles();
+    total_part += profile.GetNumParticles(i);
   }
   std::cout << "   Total particles within " << interior << " AU is "
             << total_part << "\n";
@@ -107,65 +110,152 @@ void RadialAnalyser::Run(SnapshotFile *file) {
     outputName = nd.dir + "/SPARGEL." + nd.id + "." + nd.format + "." +
                  nd.snap + nd.append + ".radial";
   }
+  if (mBinaryOutput) {
+    OutputBinary(profile, outputName + ".profile", file->GetTime());
+    return;
+  }
   std::cout << "File output      :" << outputName << "\n";
 
+  // Numbers print as the stream would at its default precision
+  const int P = 6;
   std::ofstream out;
   out.open(outputName);
-  for (int i = 0; i < mRadialBins.size(); ++i) {
-    RadialBin *b = mRadialBins[i];
-    if (b->GetNumParticles() <= 10) {
+  TextWriter text(out);
+  for (int i = 0; i < mBins; ++i) {
+    if (profile.GetNumParticles(i) <= 10) {
       continue;
     }
 
     if (mLog) {
-      out << pow(10.0, b->GetMid()) << "\t";
+      text.WriteFloat(pow(10.0, profile.GetMid(i)), 0, P);
     } else {
-      out << b->GetMid() << "\t";
+      text.WriteFloat(profile.GetMid(i), 0, P);
     }
+    text.Write('\t');
 
-    for (int j = 0; j < 32; ++j) {
-      out << b->GetAverage(j) << "\t";
+    // Columns past the last quantity are kept, zeroed, for existing readers
+    for (int j = 0; j < RADIAL_COLUMNS; ++j) {
+      text.WriteFloat((j < TOT_RAD_QUAN) ? profile.GetAverage(i, j) : 0.0, 0,
+                      P);
+      text.Write('\t');
     }
-    out << "\t" << b->GetNumParticles() << "\n";
+    text.Write('\t');
+    text.WriteInt(profile.GetNumParticles(i), 0);
+    text.Write('\n');
   }
+  text.Flush();
   out.close();
 
   // Output vertical bins
   if (mVert) {
-    for (int r = 0; r < mRadialBins.size(); ++r) {
-      RadialBin *b = mRadialBins[r];
-      if (b->GetNumParticles() <= 0)
+    for (int r = 0; r < mBins; ++r) {
+      if (profile.GetNumParticles(r) <= 0)
         continue;
 
-      if (nd.dir == "")
-        nd.dir = ".";
       outputName = nd.dir + "/SPARGEL." + nd.id + "." + nd.format + "." +
                    nd.snap + nd.append + ".vertical." + std::to_string(r);
       out.open(outputName);
-      for (int i = 0; i < b->GetVerticalBins().size(); ++i) {
-        VerticalBin *v = b->GetVerticalBins()[i];
-        if (v->GetNumParticles() <= 0)
+      for (int z = 0; z < profile.GetNumVerticalBins(); ++z) {
+        if (profile.GetNumParticles(r, z) <= 0)
           continue;
 
-        out << v->GetMid() << "\t";
+        text.WriteFloat(profile.GetVerticalMid(z), 0, P);
+        text.Write('\t');
         for (int j = 0; j < TOT_RAD_QUAN; ++j) {
-          out << v->GetAverage(j) << "\t";
+          text.WriteFloat((float)profile.GetAverage(r, z, j), 0, P);
+          text.Write('\t');
         }
-        out << "\n";
+        text.Write('\n');
       }
+      text.Flush();
       out.close();
     }
   }
 }
 
-int RadialAnalyser::GetBinID(float r) {
-  int intRadius = r * 1E10;
-  int intWidth = mWidth * 1E10;
+void RadialAnalyser::OutputBinary(const RadialProfile &profile,
+                                  const std::string &outputName,
+                                  const double time) {
+  std::cout << "File output      :" << outputName << "\n";
+
+  int bins = profile.GetNumBins();
+  int vert_bins = profile.GetNumVerticalBins();
+
+  // Section sizes are known up front, so the header and index are written
+  // first and the whole file goes out in one sequential write.
+  const int num_sections = 5;
+  const char *names[num_sections] = {"radius", "radial_num", "radial",
+                                     "vertical_num", "vertical"};
+  long sizes[num_sections] = {
+      (long)(bins * sizeof(double)), (long)(bins * sizeof(long)),
+      (long)(bins * TOT_RAD_QUAN * sizeof(double)),
+      (long)(bins * vert_bins * sizeof(long)),
+      (long)(bins * vert_bins * TOT_RAD_QUAN * sizeof(double))};
+
+  std::string buffer;
+  auto append = [&buffer](const void *data, const size_t bytes) {
+    buffer.append((const char *)data, bytes);
+  };
+
+  char magic[PROFILE_STRING_LENGTH] = {};
+  PROFILE_FORMAT.copy(magic, PROFILE_STRING_LENGTH);
+  append(magic, PROFILE_STRING_LENGTH);
 
-  int diff = intRadius % intWidth;
-  float floatDiff = diff / 1E10;
+  int header[6] = {bins, vert_bins, TOT_RAD_QUAN, mSpherical, mLog,
+                   num_sections};
+  float layout[4] = {mIn, mWidth, profile.GetVerticalMid(0),
+                     profile.GetVerticalMid(1) - profile.GetVerticalMid(0)};
+  append(header, sizeof(header));
+  append(layout, sizeof(layout));
+  append(&time, sizeof(time));
 
-  float rounded = r - floatDiff;
+  long offset = buffer.size() +
+                num_sections * (PROFILE_STRING_LENGTH + 2 * sizeof(long));
+  for (int i = 0; i < num_sections; ++i) {
+    char name[PROFILE_STRING_LENGTH] = {};
+    std::string(names[i]).copy(name, PROFILE_STRING_LENGTH);
+    append(name, PROFILE_STRING_LENGTH);
+    append(&offset, sizeof(offset));
+    append(&sizes[i], sizeof(sizes[i]));
+    offset += sizes[i];
+  }
+
+  buffer.reserve(offset);
+  for (int r = 0; r < bins; ++r) {
+    double radius = (mLog) ? pow(10.0, profile.GetMid(r)) : profile.GetMid(r);
+    append(&radius, sizeof(radius));
+  }
+  for (int r = 0; r < bins; ++r) {
+    long num = profile.GetNumParticles(r);
+    append(&num, sizeof(num));
+  }
+  for (int r = 0; r < bins; ++r) {
+    for (int q = 0; q < TOT_RAD_QUAN; ++q) {
+      double value = profile.GetAverage(r, q);
+      append(&value, sizeof(value));
+    }
+  }
+  for (int r = 0; r < bins; ++r) {
+    for (int z = 0; z < vert_bins; ++z) {
+      long num = profile.GetNumParticles(r, z);
+      append(&num, sizeof(num));
+    }
+  }
+  for (int r = 0; r < bins; ++r) {
+    for (int z = 0; z < vert_bins; ++z) {
+      for (int q = 0; q < TOT_RAD_QUAN; ++q) {
+        double value = profile.GetAverage(r, z, q);
+        append(&value, sizeof(value));
+      }
+    }
+  }
 
-  return (rounded / mWidth);
+  std::ofstream out(outputName, std::ios::binary);
+  if (!out.is_open()) {
+    std::cout << "   Could not open profile file " << outputName
+              << " for writing!\n";
+    return;
+  }
+  out.write(buffer.data(), buffer.size());
+  out.close();
 }
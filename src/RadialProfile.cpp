@@ -0,0 +1,136 @@
+//===-- RadialProfile.cpp -------------------------------------------------===//
+//
+//                                  SPARGEL
+//                   Smoothed Particle Generator and Loader
+//
+// This file is distributed under the GNU General Public License. See LICENSE
+// for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// RadialProfile.cpp
+///
+//===----------------------------------------------------------------------===//
+
+#include "RadialProfile.h"
+
+RadialProfile::RadialProfile(const int bins, const float in, const float width,
+                             const int vert_bins, const float height_lo,
+                             const float height_width)
+    : mBins(bins), mIn(in), mWidth(width), mVertBins(vert_bins),
+      mHeightLo(height_lo), mHeightWidth(height_width) {
+  mNum.assign(mBins, 0);
+  mSum.assign(mBins * TOT_RAD_QUAN, 0.0);
+  mVertNum.assign(mBins * mVertBins, 0);
+  mVertSum.assign(mBins * mVertBins * TOT_RAD_QUAN, 0.0);
+}
+
+RadialProfile::~RadialProfile() {}
+
+void RadialProfile::Add(Particle *p, float r) {
+  int bin = floor((r - mIn) / mWidth);
+  if (bin < 0 || bin >= mBins)
+    return;
+
+  double *q = &mSum[bin * TOT_RAD_QUAN];
+  q[0] += p->GetD();
+  q[1] += p->GetT();
+  q[2] += p->GetH();
+  q[3] += p->GetV().Norm();
+  q[4] += p->GetQ();
+  q[5] += p->GetP();
+  q[6] += p->GetTau();
+  q[7] += std::max(p->GetSigma(), p->GetD() * p->GetH() * AU_TO_CM);
+  q[8] += p->GetDUDT();
+  q[9] += p->GetCS();
+  q[10] += p->GetOmega();
+  q[11] += p->GetM();
+  q[12] += p->GetBeta();
+  q[13] += p->GetU();
+  q[14] += p->GetX().Dot(p->GetV()) / p->GetX().Norm();
+  q[15] += p->GetV().Norm2();
+  q[16] += p->GetEnergy(0);
+  q[17] += p->GetEnergy(1);
+  q[18] += p->GetEnergy(2);
+  q[19] += p->GetEnergy(3);
+  for (int j = 0; j < EXTRA_DATA; ++j) {
+    q[RADIAL_QUAN + j] += p->GetExtra(j);
+  }
+  mNum[bin]++;
+
+  // Vertical bins are open below and closed above
+  if (mVertBins <= 0)
+    return;
+  float z = fabs(p->GetX().z);
+  int vert = ceil((z - mHeightLo) / mHeightWidth) - 1;
+  if (vert < 0 || vert >= mVertBins)
+    return;
+
+  double *v = &mVertSum[(bin * mVertBins + vert) * TOT_RAD_QUAN];
+  v[0] += p->GetD();
+  v[1] += p->GetT();
+  v[2] += p->GetV().Norm();
+  v[3] += p->GetQ();
+  v[4] += p->GetP();
+  v[5] += p->GetTau();
+  v[7] += p->GetSigma();
+  v[9] += p->GetDUDT();
+  v[11] += p->GetCS();
+  v[12] += p->GetOmega();
+  v[13] += p->GetM();
+  v[14] += p->GetBeta();
+  v[15] += p->GetU();
+  mVertNum[bin * mVertBins + vert]++;
+}
+
+void RadialProfile::Merge(const RadialProfile &other) {
+  for (int i = 0; i < mNum.size(); ++i)
+    mNum[i] += other.mNum[i];
+  for (int i = 0; i < mSum.size(); ++i)
+    mSum[i] += other.mSum[i];
+  for (int i = 0; i < mVertNum.size(); ++i)
+    mVertNum[i] += other.mVertNum[i];
+  for (int i = 0; i < mVertSum.size(); ++i)
+    mVertSum[i] += other.mVertSum[i];
+}
+
+void RadialProfile::Finalise() {
+  for (int r = 0; r < mBins; ++r) {
+    if (mNum[r] <= 0)
+      continue;
+
+    double *q = &mSum[r * TOT_RAD_QUAN];
+    q[4] = (q[9] * q[10]) / (PI * G * (q[7] * GPERCM2_TO_KGPERM2));
+
+    for (int i = 0; i < TOT_RAD_QUAN; ++i) {
+      // Ignore mass and energy averaging.
+      if (i <= 15 && i != 11) {
+        q[i] /= mNum[r];
+      }
+    }
+
+    for (int z = 0; z < mVertBins; ++z) {
+      long num = mVertNum[r * mVertBins + z];
+      if (num <= 0)
+        continue;
+      double *v = &mVertSum[(r * mVertBins + z) * TOT_RAD_QUAN];
+      for (int i = 0; i < TOT_RAD_QUAN; ++i) {
+        v[i] /= num;
+      }
+    }
+  }
+
+  // Find the cumulative mass and energy of the bins.
+  double total_mass = 0.0, energy[4] = {0.0, 0.0, 0.0, 0.0};
+  for (int r = 0; r < mBins; ++r) {
+    double *q = &mSum[r * TOT_RAD_QUAN];
+    total_mass += q[11];
+    q[11] = total_mass;
+
+    for (int e = 0; e < 4; ++e) {
+      energy[e] += q[16 + e];
+      q[16 + e] = energy[e];
+    }
+  }
+}
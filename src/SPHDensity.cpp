@@ -0,0 +1,120 @@
+//===-- SPHDensity.cpp ----------------------------------------------------===//
+//
+//                                  SPARGEL
+//                   Smoothed Particle Generator and Loader
+//
+// This file is distributed under the GNU General Public License. See LICENSE
+// for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// SPHDensity.cpp
+///
+//===----------------------------------------------------------------------===//
+
+#include "SPHDensity.h"
+
+static const int MAX_ITERATIONS = 100;
+static const double TOLERANCE = 1E-4;
+
+// Summed density and its derivative with respect to h, in Msun/AU^3.
+static void KernelSum(const NeighbourTree &tree,
+                      const std::vector<double> &mass,
+                      const std::vector<int> &neighbours, const Vec3 &pos,
+                      const double h, double &rho, double &drho_dh) {
+  double inv_h = 1.0 / h;
+  double norm = inv_h * inv_h * inv_h / PI;
+  rho = 0.0;
+  drho_dh = 0.0;
+  for (int k = 0; k < neighbours.size(); ++k) {
+    int j = neighbours[k];
+    double q = (tree.GetPosition(j) - pos).Norm() * inv_h;
+    if (q >= KERNEL_SUPPORT)
+      continue;
+    double w = KernelW(q);
+    rho += mass[j] * w;
+    drho_dh -= mass[j] * (3.0 * w + q * KernelDW(q));
+  }
+  rho *= norm;
+  drho_dh *= norm * inv_h;
+}
+
+void FindSPHDensity(std::vector<Particle *> &part, const int num_neigh,
+                    const int threads) {
+  int n = part.size();
+  if (n == 0)
+    return;
+
+  std::vector<Vec3> pos(n);
+  std::vector<double> mass(n);
+  std::vector<double> guess(n);
+  double total_mass = 0.0;
+  Vec3 lo = part[0]->GetX(), hi = part[0]->GetX();
+  for (int i = 0; i < n; ++i) {
+    pos[i] = part[i]->GetX();
+    mass[i] = part[i]->GetM();
+    guess[i] = part[i]->GetH();
+    total_mass += mass[i];
+    for (int j = 0; j < 3; ++j) {
+      lo[j] = std::min(lo[j], pos[i][j]);
+      hi[j] = std::max(hi[j], pos[i][j]);
+    }
+  }
+
+  // Mean density of the bounding box, for particles without a smoothing length
+  double volume = 1.0;
+  for (int j = 0; j < 3; ++j)
+    volume *= std::max(hi[j] - lo[j], 1E-10);
+  double mean_rho = total_mass / volume;
+
+  NeighbourTree tree;
+  tree.Build(pos);
+
+  ParallelFor(n, threads, [&](int start, int end, int task) {
+    std::vector<int> neighbours;
+    for (int i = start; i < end; ++i) {
+      double target = (3.0 * num_neigh * mass[i]) / (32.0 * PI);
+      double h = guess[i];
+      if (h <= 0.0)
+        h = KernelH(mass[i], mean_rho, num_neigh);
+      double h_lo = 0.0, h_hi = 0.0;
+      double radius = 0.0;
+      double rho = 0.0, drho_dh = 0.0;
+
+      for (int it = 0; it < MAX_ITERATIONS; ++it) {
+        // Gather with some slack so small changes in h reuse the list
+        if (KERNEL_SUPPORT * h > radius) {
+          radius = 1.25 * KERNEL_SUPPORT * h;
+          tree.FindNeighbours(pos[i], radius, neighbours);
+        }
+        KernelSum(tree, mass, neighbours, pos[i], h, rho, drho_dh);
+
+        // f(h) rises through zero at the solution
+        double rho_target = target / (h * h * h);
+        double f = rho - rho_target;
+        double df = drho_dh + 3.0 * rho_target / h;
+        if (f < 0.0)
+          h_lo = h;
+        else
+          h_hi = h;
+
+        double h_new = (df > 0.0) ? h - f / df : 2.0 * h;
+        h_new = std::max(0.5 * h, std::min(2.0 * h, h_new));
+        if (h_hi > 0.0 && (h_new <= h_lo || h_new >= h_hi))
+          h_new = 0.5 * (h_lo + h_hi);
+
+        bool converged = fabs(h_new - h) < TOLERANCE * h;
+        h = h_new;
+        if (converged)
+          break;
+      }
+      if (KERNEL_SUPPORT * h > radius)
+        tree.FindNeighbours(pos[i], KERNEL_SUPPORT * h, neighbours);
+      KernelSum(tree, mass, neighbours, pos[i], h, rho, drho_dh);
+
+      part[i]->SetH(h);
+      part[i]->SetD(rho * MSOLPERAU3_TO_GPERCM3);
+    }
+  });
+}
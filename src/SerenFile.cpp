@@ -34,9 +34,9 @@ SerenFile::~SerenFile() {
 }
 
 bool SerenFile::Read() {
-  mInStream.open(mNameData.name,
-                 (mFormatted) ? std::ios::in : std::ios::binary);
-  if (!mInStream.is_open()) {
+  if (mFormatted)
+    mInStream.open(mNameData.name, std::ios::in);
+  if (mFormatted ? !mInStream.is_open() : !OpenReader()) {
     std::cout << "   Could not open SEREN file " << mNameData.name
               << " for reading!\n\n";
     return false;
@@ -50,21 +50,165 @@ bool SerenFile::Read() {
     AllocateMemory();
     ReadParticleForm();
     ReadSinkForm();
+    mInStream.close();
   } else {
-    mBR = new BinaryReader(mInStream);
     if (!ReadHeaderUnform()) {
       std::cout << "   Error reading SEREN header format!\n\n";
+      CloseReader();
       return false;
     }
     AllocateMemory();
     ReadParticleUnform();
     ReadSinkUnform();
-    delete mBR;
+    CloseReader();
   }
 
-  mInStream.close();
+  UnpackSinkData();
 
-  // Set sink data
+  return true;
+}
+
+bool SerenFile::OpenChunks() {
+  if (mFormatted) {
+    std::cout << "   Chunked reading requires an unformatted SEREN file!\n\n";
+    return false;
+  }
+  if (!OpenReader()) {
+    std::cout << "   Could not open SEREN file " << mNameData.name
+              << " for reading!\n\n";
+    return false;
+  }
+
+  if (!ReadHeaderUnform()) {
+    std::cout << "   Error reading SEREN header format!\n\n";
+    CloseReader();
+    return false;
+  }
+  AllocateMemory();
+  mStreamStart = mBR->Tell();
+
+  // Sinks follow the particle columns and are read up front
+  mBR->Seek(StreamColumnOffset(7 + mExtraData, 0));
+  ReadSinkUnform();
+  UnpackSinkData();
+
+  return true;
+}
+
+void SerenFile::ReadChunk(std::vector<Particle *> &chunk, const int first,
+                          const int count, const bool all_columns) {
+  for (int i = 0; i < chunk.size(); ++i)
+    delete chunk[i];
+  chunk.resize(count);
+  for (int i = 0; i < count; ++i) {
+    chunk[i] = new Particle();
+    chunk[i]->SetType((first + i < mNumGas) ? GAS_TYPE : DUST_TYPE);
+  }
+  if (count == 0)
+    return;
+
+  std::vector<double> column;
+  ReadColumn(1, first, count, column);
+  for (int i = 0; i < count; ++i) {
+    chunk[i]->SetX(
+        Vec3(column[3 * i], column[3 * i + 1], column[3 * i + 2]));
+  }
+
+  ReadColumn(2, first, count, column);
+  for (int i = 0; i < count; ++i)
+    chunk[i]->SetM(column[i]);
+
+  if (!all_columns)
+    return;
+
+  std::vector<int> ids;
+  ReadIDs(first, count, ids);
+  for (int i = 0; i < count; ++i)
+    chunk[i]->SetID(ids[i]);
+
+  // The remaining columns are requested together
+  std::vector<int> columns;
+  for (int c = 3; c <= 6 + mExtraData; ++c)
+    columns.push_back(c);
+  std::vector<std::vector<double>> values;
+  ReadColumns(columns, first, count, values);
+
+  for (int i = 0; i < count; ++i) {
+    chunk[i]->SetH(values[0][i]);
+    chunk[i]->SetV(Vec3(values[1][3 * i], values[1][3 * i + 1],
+                        values[1][3 * i + 2]));
+    chunk[i]->SetD(values[2][i]);
+    chunk[i]->SetU(values[3][i]);
+    for (int e = 0; e < mExtraData; ++e)
+      chunk[i]->SetExtra(e, values[4 + e][i]);
+  }
+}
+
+// Spreads values read with dim components each out to stride components,
+// working from the back so none is overwritten.
+static void SpreadComponents(std::vector<double> &values, const int count,
+                             const int dim, const int stride) {
+  if (dim >= stride)
+    return;
+  for (int i = count - 1; i >= 0; --i) {
+    for (int j = stride - 1; j >= 0; --j)
+      values[i * stride + j] = (j < dim) ? values[i * dim + j] : 0.0;
+  }
+}
+
+void SerenFile::ReadColumn(const int column, const int first, const int count,
+                           std::vector<double> &values) {
+  int dim = (column == 1) ? mPosDim : ((column == 4) ? mVelDim : 1);
+  int stride = (column == 1 || column == 4) ? 3 : 1;
+  values.resize((long)count * stride);
+  if (count == 0)
+    return;
+
+  mBR->Seek(StreamColumnOffset(column, first));
+  mBR->ReadArray(&values[0], (long)count * dim);
+  SpreadComponents(values, count, dim, stride);
+}
+
+void SerenFile::ReadColumns(const std::vector<int> &columns, const int first,
+                            const int count,
+                            std::vector<std::vector<double>> &values) {
+  values.resize(columns.size());
+  std::vector<IORequest> requests;
+  for (int c = 0; c < columns.size(); ++c) {
+    int dim = (columns[c] == 1) ? mPosDim : ((columns[c] == 4) ? mVelDim : 1);
+    int stride = (columns[c] == 1 || columns[c] == 4) ? 3 : 1;
+    values[c].resize((long)count * stride);
+    if (count == 0)
+      continue;
+    IORequest request;
+    request.data = (char *)&values[c][0];
+    request.bytes = (long)count * dim * sizeof(double);
+    request.offset = StreamColumnOffset(columns[c], first);
+    requests.push_back(request);
+  }
+  if (requests.empty())
+    return;
+
+  mBR->ReadBatch(requests);
+  for (int c = 0; c < columns.size(); ++c) {
+    int dim = (columns[c] == 1) ? mPosDim : ((columns[c] == 4) ? mVelDim : 1);
+    int stride = (columns[c] == 1 || columns[c] == 4) ? 3 : 1;
+    SpreadComponents(values[c], count, dim, stride);
+  }
+}
+
+void SerenFile::ReadIDs(const int first, const int count,
+                        std::vector<int> &ids) {
+  ids.resize(count);
+  if (count == 0)
+    return;
+  mBR->Seek(StreamColumnOffset(0, first));
+  mBR->ReadArray(&ids[0], count);
+}
+
+void SerenFile::CloseChunks() { CloseReader(); }
+
+void SerenFile::UnpackSinkData() {
   for (int i = 0; i < mSinks.size(); ++i) {
     float *curData = mSinks[i]->GetAllData();
     mSinks[i]->SetX(Vec3(curData[1], curData[2], curData[3]));
@@ -73,8 +217,6 @@ bool SerenFile::Read() {
     mSinks[i]->SetH(curData[8]);
     mSinks[i]->SetType(-1);
   }
-
-  return true;
 }
 
 bool SerenFile::Write(std::string fileName, bool formatted) {
@@ -87,18 +229,7 @@ bool SerenFile::Write(std::string fileName, bool formatted) {
   std::cout << "   File output      : " << fileName << "\n";
 
   CreateHeader();
-
-  // Get sink data, pertinent information starts at index 1
-  for (int i = 0; i < mNumSink; ++i) {
-    mSinks[i]->SetData(0 + 1, mSinks[i]->GetX().x);
-    mSinks[i]->SetData(1 + 1, mSinks[i]->GetX().y);
-    mSinks[i]->SetData(2 + 1, mSinks[i]->GetX().z);
-    mSinks[i]->SetData(3 + 1, mSinks[i]->GetV().x);
-    mSinks[i]->SetData(4 + 1, mSinks[i]->GetV().y);
-    mSinks[i]->SetData(5 + 1, mSinks[i]->GetV().z);
-    mSinks[i]->SetData(6 + 1, mSinks[i]->GetM());
-    mSinks[i]->SetData(7 + 1, mSinks[i]->GetH());
-  }
+  PackSinkData();
 
   if (formatted) {
     Formatter formatStream(mOutStream, 18, 2, 10);
@@ -118,7 +249,155 @@ bool SerenFile::Write(std::string fileName, bool formatted) {
   return true;
 }
 
-void SerenFile::AllocateMemory() {
+bool SerenFile::BeginStream(std::string fileName, const int num_gas,
+                            const double hydro_mass, const bool formatted,
+                            const bool in_order) {
+  mOutStream.open(fileName, (formatted) ? std::ios::out : std::ios::binary,
+                  formatted || in_order);
+  if (!mOutStream.is_open()) {
+    std::cout << "   Could not open SEREN file " << fileName
+              << " for writing!\n";
+    return false;
+  }
+  std::cout << "   File output      : " << fileName << "\n";
+
+  mStreaming = true;
+  mFormatted = formatted;
+  mNumGas = num_gas;
+  mStreamMass = hydro_mass;
+
+  CreateHeader();
+  PackSinkData();
+
+  if (mFormatted) {
+    WriteHeaderForm(Formatter(mOutStream, 18, 2, 10));
+    mStreamStart = mOutStream.tellp();
+  } else {
+    mBW = new BinaryWriter(mOutStream);
+    WriteHeaderUnform();
+    mStreamStart = mBW->Tell();
+  }
+
+  return true;
+}
+
+void SerenFile::WriteStreamChunk(const std::vector<Particle *> &chunk,
+                                 const int first) {
+  std::vector<int> ids;
+  PackIDs(chunk, ids);
+  mBW->Seek(StreamColumnOffset(0, first));
+  mBW->WriteArray(ids);
+
+  std::vector<double> column;
+  for (int c = 1; c <= 6; ++c) {
+    PackColumn(chunk, c, column);
+    mBW->Seek(StreamColumnOffset(c, first));
+    mBW->WriteArray(column);
+  }
+}
+
+void SerenFile::AppendStreamIDs(const std::vector<int> &ids) {
+  if (mFormatted) {
+    Formatter formatStream(mOutStream, 18, 2, 10);
+    ParallelFormat(formatStream, ids.size(), mThreads,
+                   [&](Formatter &f, int s, int e) {
+                     for (int i = s; i < e; ++i)
+                       f << ids[i] << "\n";
+                   });
+  } else {
+    mBW->WriteArray(ids);
+  }
+}
+
+void SerenFile::AppendStreamColumn(const std::vector<double> &values,
+                                   const int dim) {
+  if (mFormatted) {
+    Formatter formatStream(mOutStream, 18, 2, 10);
+    ParallelFormat(formatStream, values.size() / dim, mThreads,
+                   [&](Formatter &f, int s, int e) {
+                     for (int i = s; i < e; ++i) {
+                       if (dim == 1) {
+                         f << values[i] << "\n";
+                         continue;
+                       }
+                       for (int j = 0; j < dim; ++j)
+                         f << values[i * dim + j] << "\t";
+                       f << "\n";
+                     }
+                   });
+  } else {
+    mBW->WriteArray(values);
+  }
+}
+
+void SerenFile::EndStream() {
+  if (mFormatted) {
+    WriteSinkForm(Formatter(mOutStream, 18, 2, 10));
+  } else {
+    mBW->Seek(StreamColumnOffset(7, 0));
+    WriteSinkUnform();
+    delete mBW;
+    mBW = NULL;
+  }
+
+  mOutStream.close();
+  mStreaming = false;
+}
+
+std::streampos SerenFile::StreamColumnOffset(const int column,
+                                             const int first) {
+  // Bytes per particle of porig, r, m, h, v, rho and u, in file order. Any
+  // extra data columns follow.
+  const int D = sizeof(double);
+  int widths[7] = {(int)sizeof(int), mPosDim * D, D, D, mVelDim * D, D, D};
+  long n = mNumGas + mNumDust;
+
+  std::streamoff offset = 0;
+  for (int i = 0; i < column; ++i)
+    offset += (std::streamoff)((i < 7) ? widths[i] : D) * n;
+  offset += (std::streamoff)((column < 7) ? widths[column] : D) * first;
+
+  return mStreamStart + offset;
+}
+
+void SerenFile::PackSinkData() {
+  // Get sink data, pertinent information starts at index 1
+  for (int i = 0; i < mNumSink; ++i) {
+    mSinks[i]->SetData(0 + 1, mSinks[i]->GetX().x);
+    mSinks[i]->SetData(1 + 1, mSinks[i]->GetX().y);
+    mSinks[i]->SetData(2 + 1, mSinks[i]->GetX().z);
+    mSinks[i]->SetData(3 + 1, mSinks[i]->GetV().x);
+    mSinks[i]->SetData(4 + 1, mSinks[i]->GetV().y);
+    mSinks[i]->SetData(5 + 1, mSinks[i]->GetV().z);
+    mSinks[i]->SetData(6 + 1, mSinks[i]->GetM());
+    mSinks[i]->SetData(7 + 1, mSinks[i]->GetH());
+  }
+}
+
+bool SerenFile::ReadHeader() {
+  if (mFormatted)
+    mInStream.open(mNameData.name, std::ios::in);
+  if (mFormatted ? !mInStream.is_open() : !OpenReader())
+    return false;
+
+  bool read = (mFormatted) ? ReadHeaderForm() : ReadHeaderUnform();
+  if (read) {
+    UnpackHeader();
+    RecordOffsets();
+  }
+  if (mFormatted)
+    mInStream.close();
+  else
+    CloseReader();
+
+  // The full read parses the header again
+  mUnitData.clear();
+  mDataID.clear();
+
+  return read;
+}
+
+void SerenFile::UnpackHeader() {
   mPrecision = mHeader[0];
   mPosDim = mHeader[1];
   mVelDim = mHeader[2];
@@ -132,12 +411,12 @@ void SerenFile::AllocateMemory() {
   mTime = mDoubleData[0];
 
   mSinkDataLength = 12 + 2 * mPosDim;
+}
 
-  for (int i = 0; i < mNumGas; ++i) {
-    Particle *p = new Particle();
-    mParticles.push_back(p);
-  }
+void SerenFile::AllocateMemory() {
+  UnpackHeader();
 
+  // Particles are created as they pass the read filter
   for (int i = 0; i < mNumSink; ++i) {
     Sink *s = new Sink();
     mSinks.push_back(s);
@@ -145,7 +424,9 @@ void SerenFile::AllocateMemory() {
 }
 
 void SerenFile::CreateHeader() {
-  mNumGas = mParticles.size();
+  // A streamed file is given its particle count up front
+  if (!mStreaming)
+    mNumGas = mParticles.size();
   mNumSink = mSinks.size();
 
   mHeader[0] = mPrecision;
@@ -263,7 +544,8 @@ void SerenFile::CreateHeader() {
   mFloatData[1] = 0.0;
   mDoubleData[0] = mTime;                 // time
   mDoubleData[1] = 0.0;                   // time lastsnap
-  mDoubleData[2] = mParticles[0]->GetM(); // avg. hydro mass
+  mDoubleData[2] = (mStreaming) ? mStreamMass
+                                 : mParticles[0]->GetM(); // avg. hydro mass
   mDoubleData[10] = 0.0;                  // tlite lastsnap
 
   mSinkDataLength = 12 + 2 * mPosDim;
@@ -310,61 +592,75 @@ bool SerenFile::ReadHeaderForm() {
 }
 
 void SerenFile::ReadParticleForm() {
+  int n = mNumGas + mNumDust;
   double temp[3] = {0.0};
 
-  for (int i = 0; i < mNumGas + mNumDust; ++i) {
-    mInStream >> temp[0];
-    mParticles[i]->SetID(temp[0]);
+  std::vector<double> ids(n);
+  for (int i = 0; i < n; ++i) {
+    mInStream >> ids[i];
   }
 
-  for (int i = 0; i < mNumGas + mNumDust; ++i) {
+  std::vector<Vec3> pos(n);
+  for (int i = 0; i < n; ++i) {
     if (mPosDim == 1)
       mInStream >> temp[0];
     if (mPosDim == 2)
       mInStream >> temp[0] >> temp[1];
     if (mPosDim == 3)
       mInStream >> temp[0] >> temp[1] >> temp[2];
-
-    mParticles[i]->SetX(Vec3(temp[0], temp[1], temp[2]));
+    pos[i] = Vec3(temp[0], temp[1], temp[2]);
+  }
+  std::vector<int> slot = SelectParticles(pos, mNumGas);
+  pos.clear();
+  pos.shrink_to_fit();
+  for (int i = 0; i < n; ++i) {
+    if (slot[i] >= 0)
+      mParticles[slot[i]]->SetID(ids[i]);
   }
 
-  for (int i = 0; i < mNumGas + mNumDust; ++i) {
+  for (int i = 0; i < n; ++i) {
     mInStream >> temp[0];
-    mParticles[i]->SetM(temp[0]);
+    if (slot[i] >= 0)
+      mParticles[slot[i]]->SetM(temp[0]);
   }
 
-  for (int i = 0; i < mNumGas + mNumDust; ++i) {
+  for (int i = 0; i < n; ++i) {
     mInStream >> temp[0];
-    mParticles[i]->SetH(temp[0]);
+    if (slot[i] >= 0)
+      mParticles[slot[i]]->SetH(temp[0]);
   }
 
-  for (int i = 0; i < mNumGas + mNumDust; ++i) {
+  for (int i = 0; i < n; ++i) {
     if (mVelDim == 1)
       mInStream >> temp[0];
     if (mVelDim == 2)
       mInStream >> temp[0] >> temp[1];
     if (mVelDim == 3)
       mInStream >> temp[0] >> temp[1] >> temp[2];
-
-    mParticles[i]->SetV(Vec3(temp[0], temp[1], temp[2]));
+    if (slot[i] >= 0)
+      mParticles[slot[i]]->SetV(Vec3(temp[0], temp[1], temp[2]));
   }
 
-  for (int i = 0; i < mNumGas + mNumDust; ++i) {
+  for (int i = 0; i < n; ++i) {
     mInStream >> temp[0];
-    mParticles[i]->SetD(temp[0]);
+    if (slot[i] >= 0)
+      mParticles[slot[i]]->SetD(temp[0]);
   }
 
-  for (int i = 0; i < mNumGas + mNumDust; ++i) {
+  for (int i = 0; i < n; ++i) {
     mInStream >> temp[0];
-    mParticles[i]->SetU(temp[0]);
+    if (slot[i] >= 0)
+      mParticles[slot[i]]->SetU(temp[0]);
   }
 
-  for (int n = 0; n < mExtraData; ++n) {
-    for (int i = 0; i < mNumGas + mNumDust; ++i) {
+  for (int e = 0; e < mExtraData; ++e) {
+    for (int i = 0; i < n; ++i) {
       mInStream >> temp[0];
-      mParticles[i]->SetExtra(n, temp[0]);
+      if (slot[i] >= 0)
+        mParticles[slot[i]]->SetExtra(e, temp[0]);
     }
   }
+  CountSelected(slot);
 }
 
 void SerenFile::ReadSinkForm() {
@@ -388,7 +684,7 @@ void SerenFile::ReadSinkForm() {
 
 bool SerenFile::ReadHeaderUnform() {
   std::vector<char> fileTag(STRING_LENGTH);
-  mInStream.read(&fileTag[0], STRING_LENGTH);
+  mBR->ReadBytes(&fileTag[0], STRING_LENGTH);
   std::string concatString(fileTag.begin(), fileTag.end());
   mFormatID = TrimWhiteSpace(concatString);
   if (mFormatID.compare("SERENBINARYDUMPV3"))
@@ -410,13 +706,13 @@ bool SerenFile::ReadHeaderUnform() {
 
   for (int i = 0; i < mNumUnit; ++i) {
     char buffer[STRING_LENGTH];
-    mInStream.read(buffer, STRING_LENGTH);
+    mBR->ReadBytes(buffer, STRING_LENGTH);
     mUnitData.push_back(TrimWhiteSpace(std::string(buffer, STRING_LENGTH)));
   }
 
   for (int i = 0; i < mNumData; ++i) {
     char buffer[STRING_LENGTH];
-    mInStream.read(buffer, STRING_LENGTH);
+    mBR->ReadBytes(buffer, STRING_LENGTH);
     mDataID.push_back(std::string(buffer, STRING_LENGTH));
   }
 
@@ -430,52 +726,94 @@ bool SerenFile::ReadHeaderUnform() {
 }
 
 void SerenFile::ReadParticleUnform() {
-  int intTemp = 0;
-  double temp[3] = {0.0, 0.0, 0.0};
-
-  for (int i = 0; i < mNumGas + mNumDust; ++i) {
-    mBR->ReadValue(intTemp);
-    mParticles[i]->SetID(intTemp);
+  long n = mNumGas + mNumDust;
+  if (n == 0)
+    return;
+  long start = mBR->Tell();
+
+  // Positions are read first, skipping the IDs, so the filter can decide
+  // which particles to create.
+  std::vector<double> column(n * std::max(mPosDim, mVelDim));
+  mBR->Seek(start + n * sizeof(int));
+  mBR->ReadArray(&column[0], n * mPosDim);
+  std::vector<Vec3> pos(n);
+  for (int i = 0; i < n; ++i) {
+    double x[3] = {0.0, 0.0, 0.0};
+    for (int j = 0; j < mPosDim; ++j)
+      x[j] = column[i * mPosDim + j];
+    pos[i] = Vec3(x[0], x[1], x[2]);
   }
-
-  for (int i = 0; i < mNumGas + mNumDust; ++i) {
-    for (int i = 0; i < mPosDim; ++i)
-      mBR->ReadValue(temp[i]);
-    mParticles[i]->SetX(Vec3(temp[0], temp[1], temp[2]));
+  std::vector<int> slot = SelectParticles(pos, mNumGas);
+  pos.clear();
+  pos.shrink_to_fit();
+  long end_pos = mBR->Tell();
+
+  mBR->Seek(start);
+  std::vector<int> ids(n);
+  mBR->ReadArray(&ids[0], n);
+  for (int i = 0; i < n; ++i) {
+    if (slot[i] >= 0)
+      mParticles[slot[i]]->SetID(ids[i]);
   }
+  mBR->Seek(end_pos);
 
-  for (int i = 0; i < mNumGas + mNumDust; ++i) {
-    mBR->ReadValue(temp[0]);
-    mParticles[i]->SetM(temp[0]);
+  mBR->ReadArray(&column[0], n);
+  for (int i = 0; i < n; ++i) {
+    if (slot[i] >= 0)
+      mParticles[slot[i]]->SetM(column[i]);
   }
 
-  for (int i = 0; i < mNumGas + mNumDust; ++i) {
-    mBR->ReadValue(temp[0]);
-    mParticles[i]->SetH(temp[0]);
+  mBR->ReadArray(&column[0], n);
+  for (int i = 0; i < n; ++i) {
+    if (slot[i] >= 0)
+      mParticles[slot[i]]->SetH(column[i]);
   }
 
-  for (int i = 0; i < mNumGas + mNumDust; ++i) {
-    for (int i = 0; i < mVelDim; ++i)
-      mBR->ReadValue(temp[i]);
-    mParticles[i]->SetV(Vec3(temp[0], temp[1], temp[2]));
+  mBR->ReadArray(&column[0], n * mVelDim);
+  for (int i = 0; i < n; ++i) {
+    if (slot[i] < 0)
+      continue;
+    double v[3] = {0.0, 0.0, 0.0};
+    for (int j = 0; j < mVelDim; ++j)
+      v[j] = column[i * mVelDim + j];
+    mParticles[slot[i]]->SetV(Vec3(v[0], v[1], v[2]));
   }
 
-  for (int i = 0; i < mNumGas + mNumDust; ++i) {
-    mBR->ReadValue(temp[0]);
-    mParticles[i]->SetD(temp[0]);
+  mBR->ReadArray(&column[0], n);
+  for (int i = 0; i < n; ++i) {
+    if (slot[i] >= 0)
+      mParticles[slot[i]]->SetD(column[i]);
   }
 
-  for (int i = 0; i < mNumGas + mNumDust; ++i) {
-    mBR->ReadValue(temp[0]);
-    mParticles[i]->SetU(temp[0]);
+  mBR->ReadArray(&column[0], n);
+  for (int i = 0; i < n; ++i) {
+    if (slot[i] >= 0)
+      mParticles[slot[i]]->SetU(column[i]);
   }
 
-  for (int n = 0; n < mExtraData; ++n) {
-    for (int i = 0; i < mNumGas + mNumDust; ++i) {
-      mBR->ReadValue(temp[0]);
-      mParticles[i]->SetExtra(n, temp[0]);
+  for (int e = 0; e < mExtraData; ++e) {
+    mBR->ReadArray(&column[0], n);
+    for (int i = 0; i < n; ++i) {
+      if (slot[i] >= 0)
+        mParticles[slot[i]]->SetExtra(e, column[i]);
     }
   }
+  CountSelected(slot);
+}
+
+void SerenFile::CountSelected(const std::vector<int> &slot) {
+  int gas = 0, dust = 0;
+  for (int i = 0; i < slot.size(); ++i) {
+    if (slot[i] < 0)
+      continue;
+    if (i < mNumGas)
+      ++gas;
+    else
+      ++dust;
+  }
+  mNumGas = gas;
+  mNumDust = dust;
+  mNumTot = mNumGas + mNumSink;
 }
 
 void SerenFile::ReadSinkUnform() {
@@ -500,7 +838,7 @@ void SerenFile::ReadSinkUnform() {
 }
 
 void SerenFile::WriteHeaderForm(Formatter formatStream) {
-  mOutStream << ASCII_FORMAT << "\n";
+  formatStream << ASCII_FORMAT << "\n";
   for (int i = 0; i < 4; ++i)
     formatStream << mHeader[i] << "\n";
   formatStream.SetWidthInteger(10);
@@ -536,32 +874,49 @@ void SerenFile::WriteHeaderForm(Formatter formatStream) {
 }
 
 void SerenFile::WriteParticleForm(Formatter formatStream) {
-  for (int i = 0; i < mNumGas + mNumDust; ++i)
-    formatStream << mParticles[i]->GetID() << "\n";
-
-  for (int i = 0; i < mNumGas + mNumDust; ++i) {
-    for (int j = 0; j < mPosDim; ++j)
-      formatStream << mParticles[i]->GetX()[j] << "\t";
-    formatStream << "\n";
-  }
-
-  for (int i = 0; i < mNumGas + mNumDust; ++i)
-    formatStream << mParticles[i]->GetM() << "\n";
-
-  for (int i = 0; i < mNumGas + mNumDust; ++i)
-    formatStream << mParticles[i]->GetH() << "\n";
-
-  for (int i = 0; i < mNumGas + mNumDust; ++i) {
-    for (int j = 0; j < mVelDim; ++j)
-      formatStream << mParticles[i]->GetV()[j] << "\t";
-    formatStream << "\n";
-  }
+  int n = mNumGas + mNumDust;
+  std::vector<Particle *> &part = mParticles;
+
+  ParallelFormat(formatStream, n, mThreads, [&](Formatter &f, int s, int e) {
+    for (int i = s; i < e; ++i)
+      f << part[i]->GetID() << "\n";
+  });
+
+  ParallelFormat(formatStream, n, mThreads, [&](Formatter &f, int s, int e) {
+    for (int i = s; i < e; ++i) {
+      for (int j = 0; j < mPosDim; ++j)
+        f << part[i]->GetX()[j] << "\t";
+      f << "\n";
+    }
+  });
+
+  ParallelFormat(formatStream, n, mThreads, [&](Formatter &f, int s, int e) {
+    for (int i = s; i < e; ++i)
+      f << part[i]->GetM() << "\n";
+  });
+
+  ParallelFormat(formatStream, n, mThreads, [&](Formatter &f, int s, int e) {
+    for (int i = s; i < e; ++i)
+      f << part[i]->GetH() << "\n";
+  });
+
+  ParallelFormat(formatStream, n, mThreads, [&](Formatter &f, int s, int e) {
+    for (int i = s; i < e; ++i) {
+      for (int j = 0; j < mVelDim; ++j)
+        f << part[i]->GetV()[j] << "\t";
+      f << "\n";
+    }
+  });
 
-  for (int i = 0; i < mNumGas + mNumDust; ++i)
-    formatStream << mParticles[i]->GetD() << "\n";
+  ParallelFormat(formatStream, n, mThreads, [&](Formatter &f, int s, int e) {
+    for (int i = s; i < e; ++i)
+      f << part[i]->GetD() << "\n";
+  });
 
-  for (int i = 0; i < mNumGas + mNumDust; ++i)
-    formatStream << mParticles[i]->GetU() << "\n";
+  ParallelFormat(formatStream, n, mThreads, [&](Formatter &f, int s, int e) {
+    for (int i = s; i < e; ++i)
+      f << part[i]->GetU() << "\n";
+  });
 }
 
 void SerenFile::WriteSinkForm(Formatter formatStream) {
@@ -603,13 +958,13 @@ void SerenFile::WriteHeaderUnform() {
     std::ostringstream stream;
     stream << std::left << std::setw(STRING_LENGTH) << std::setfill(' ')
            << mUnitData[i];
-    mOutStream << stream.str();
+    mBW->WriteValue(stream.str());
   }
   for (int i = 0; i < mNumData; ++i) {
     std::ostringstream stream;
     stream << std::left << std::setw(STRING_LENGTH) << std::setfill(' ')
            << mDataID[i];
-    mOutStream << stream.str();
+    mBW->WriteValue(stream.str());
   }
 
   for (int i = 0; i < mNumData; ++i) {
@@ -619,48 +974,78 @@ void SerenFile::WriteHeaderUnform() {
 }
 
 void SerenFile::WriteParticleUnform() {
-  for (int i = 0; i < mNumGas + mNumDust; ++i)
-    mBW->WriteValue(mParticles[i]->GetID());
-
-  for (int i = 0; i < mNumGas + mNumDust; ++i) {
-    for (int j = 0; j < mPosDim; ++j) {
-      mBW->WriteValue((double)mParticles[i]->GetX()[j]);
-    }
+  int n = std::min((int)mParticles.size(), mNumGas + mNumDust);
+  std::vector<Particle *> part(mParticles.begin(), mParticles.begin() + n);
+
+  // Each column is gathered into one buffer and written in one call
+  std::vector<int> ids;
+  PackIDs(part, ids);
+  mBW->WriteArray(ids);
+  ids.clear();
+  ids.shrink_to_fit();
+
+  std::vector<double> column;
+  for (int c = 1; c <= 6; ++c) {
+    PackColumn(part, c, column);
+    mBW->WriteArray(column);
   }
+}
 
-  for (int i = 0; i < mNumGas + mNumDust; ++i)
-    mBW->WriteValue((double)mParticles[i]->GetM());
-
-  for (int i = 0; i < mNumGas + mNumDust; ++i)
-    mBW->WriteValue((double)mParticles[i]->GetH());
+void SerenFile::PackIDs(const std::vector<Particle *> &part,
+                        std::vector<int> &ids) {
+  ids.resize(part.size());
+  ParallelFor(part.size(), mThreads, [&](int start, int end, int task) {
+    for (int i = start; i < end; ++i)
+      ids[i] = part[i]->GetID();
+  });
+}
 
-  for (int i = 0; i < mNumGas + mNumDust; ++i) {
-    for (int j = 0; j < mVelDim; ++j) {
-      mBW->WriteValue((double)mParticles[i]->GetV()[j]);
+void SerenFile::PackColumn(const std::vector<Particle *> &part,
+                           const int column, std::vector<double> &values) {
+  int dim = (column == 1) ? mPosDim : ((column == 4) ? mVelDim : 1);
+  values.resize(part.size() * dim);
+  ParallelFor(part.size(), mThreads, [&](int start, int end, int task) {
+    for (int i = start; i < end; ++i) {
+      Particle *p = part[i];
+      switch (column) {
+      case 1:
+        for (int j = 0; j < dim; ++j)
+          values[i * dim + j] = p->GetX()[j];
+        break;
+      case 2:
+        values[i] = p->GetM();
+        break;
+      case 3:
+        values[i] = p->GetH();
+        break;
+      case 4:
+        for (int j = 0; j < dim; ++j)
+          values[i * dim + j] = p->GetV()[j];
+        break;
+      case 5:
+        values[i] = p->GetD();
+        break;
+      default:
+        values[i] = p->GetU();
+        break;
+      }
     }
-  }
-
-  for (int i = 0; i < mNumGas + mNumDust; ++i)
-    mBW->WriteValue((double)mParticles[i]->GetD());
-
-  for (int i = 0; i < mNumGas + mNumDust; ++i)
-    mBW->WriteValue((double)mParticles[i]->GetU());
+  });
 }
 
 void SerenFile::WriteSinkUnform() {
   int sinkValues[6] = {2, 2, 0, mSinkDataLength, 0, 0};
-  for (int i = 0; i < 6; ++i) {
-    mBW->WriteValue(sinkValues[i]);
-  }
+  mBW->WriteArray(sinkValues, 6);
 
+  std::vector<double> data(mSinkDataLength);
   for (int i = 0; i < mNumSink; ++i) {
     mBW->WriteValue(true);
     mBW->WriteValue(true);
     mBW->WriteValue(i + 1);
     mBW->WriteValue(0);
 
-    for (int j = 0; j < mSinkDataLength; ++j) {
-      mBW->WriteValue((double)mSinks[i]->GetData(j));
-    }
+    for (int j = 0; j < mSinkDataLength; ++j)
+      data[j] = mSinks[i]->GetData(j);
+    mBW->WriteArray(data);
   }
 }
@@ -0,0 +1,422 @@
+//===-- SparFile.cpp ------------------------------------------------------===//
+//
+//                                  SPARGEL
+//                   Smoothed Particle Generator and Loader
+//
+// This file is distributed under the GNU General Public License. See LICENSE
+// for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// SparFile.cpp
+///
+//===----------------------------------------------------------------------===//
+
+#include "SparFile.h"
+
+// Leading and trailing marks of the file
+static const std::string SPAR_MAGIC = "SPARGELC";
+static const int SPAR_VERSION = 1;
+static const int INDEX_MAGIC = 0x58444E49; // "INDX"
+static const int TRAILER_BYTES = sizeof(long) + 2 * sizeof(int);
+
+// Bits per axis of the Morton key
+static const int MORTON_BITS = 21;
+
+// Spreads the low 21 bits of v out to every third bit.
+static unsigned long SpreadBits(unsigned long v) {
+  v &= 0x1fffff;
+  v = (v | v << 32) & 0x1f00000000ffff;
+  v = (v | v << 16) & 0x1f0000ff0000ff;
+  v = (v | v << 8) & 0x100f00f00f00f00f;
+  v = (v | v << 4) & 0x10c30c30c30c30c3;
+  v = (v | v << 2) & 0x1249249249249249;
+  return v;
+}
+
+SparFile::SparFile(NameData nd, int extra_data, int chunk_size) {
+  mNameData = nd;
+  mFormatted = false;
+  mExtraData = extra_data;
+  mChunkSize = std::max(1, chunk_size);
+}
+
+SparFile::~SparFile() {
+  for (int i = 0; i < mParticles.size(); ++i) {
+    delete mParticles[i];
+  }
+  mParticles.clear();
+
+  for (int i = 0; i < mSinks.size(); ++i) {
+    delete mSinks[i];
+  }
+  mSinks.clear();
+}
+
+bool SparFile::Read() {
+  if (!OpenReader()) {
+    std::cout << "   Could not open SPAR file " << mNameData.name
+              << " for reading!\n\n";
+    return false;
+  }
+  if (!ReadHeaderUnform() || !ReadIndex()) {
+    std::cout << "   Error reading SPAR file " << mNameData.name << "!\n\n";
+    CloseReader();
+    return false;
+  }
+  ReadSinkUnform();
+
+  mChunksRead = 0;
+  std::vector<char> buffer;
+  for (int c = 0; c < mChunks.size(); ++c) {
+    if (!PassChunk(mChunks[c]))
+      continue;
+    ReadChunk(mChunks[c], buffer);
+    ++mChunksRead;
+  }
+  CloseReader();
+  if (mFilter.Active()) {
+    std::cout << "   Chunks read      : " << mChunksRead << " of "
+              << mChunks.size() << "\n";
+  }
+
+  mNumGas = 0;
+  for (int i = 0; i < mParticles.size(); ++i) {
+    if (mParticles[i]->GetType() == GAS_TYPE)
+      ++mNumGas;
+  }
+  mNumDust = mParticles.size() - mNumGas;
+  mNumTot = mNumGas + mNumSink;
+
+  return true;
+}
+
+bool SparFile::ReadHeader() {
+  if (!OpenReader())
+    return false;
+
+  bool read = ReadHeaderUnform();
+  if (read) {
+    mBR->Seek(mBR->Tell() + (long)mNumSink * SINK_BYTES);
+    RecordOffsets();
+  }
+  CloseReader();
+
+  return read;
+}
+
+bool SparFile::Write(std::string fileName, bool formatted) {
+  mOutStream.open(fileName, std::ios::binary);
+  if (!mOutStream.is_open()) {
+    std::cout << "   Could not open SPAR file " << fileName
+              << " for writing!\n";
+    return false;
+  }
+  std::cout << "   File output      : " << fileName << "\n";
+
+  std::vector<int> order = SortParticles();
+  mNumGas = 0;
+  for (int i = 0; i < mParticles.size(); ++i) {
+    if (mParticles[i]->GetType() == GAS_TYPE)
+      ++mNumGas;
+  }
+  mNumDust = mParticles.size() - mNumGas;
+  mNumSink = mSinks.size();
+
+  mBW = new BinaryWriter(mOutStream);
+  WriteHeaderUnform();
+  WriteSinkUnform();
+  mChunks.clear();
+  for (int first = 0; first < order.size(); first += mChunkSize) {
+    SparChunk chunk;
+    WriteChunk(order, first, std::min(mChunkSize, (int)order.size() - first),
+               chunk);
+    mChunks.push_back(chunk);
+  }
+  WriteIndex();
+  delete mBW;
+  mBW = NULL;
+
+  mOutStream.close();
+
+  return true;
+}
+
+bool SparFile::ReadHeaderUnform() {
+  std::vector<char> magic(SPAR_MAGIC.size());
+  mBR->ReadBytes(&magic[0], magic.size());
+  if (std::string(magic.begin(), magic.end()) != SPAR_MAGIC)
+    return false;
+
+  int version = 0;
+  mBR->ReadValue(version);
+  if (version != SPAR_VERSION)
+    return false;
+  mBR->ReadValue(mNumGas);
+  mBR->ReadValue(mNumDust);
+  mBR->ReadValue(mNumSink);
+  mBR->ReadValue(mExtraData);
+  mBR->ReadValue(mChunkSize);
+  mBR->ReadValue(mTime);
+  mNumTot = mNumGas + mNumSink;
+
+  return mNumGas >= 0 && mNumDust >= 0 && mNumSink >= 0 && mExtraData >= 0 &&
+         mExtraData <= EXTRA_DATA;
+}
+
+void SparFile::ReadSinkUnform() {
+  for (int i = 0; i < mNumSink; ++i) {
+    double x[3], v[3];
+    float m = 0.0f, h = 0.0f;
+    mBR->ReadArray(x, 3);
+    mBR->ReadArray(v, 3);
+    mBR->ReadValue(m);
+    mBR->ReadValue(h);
+
+    Sink *s = new Sink();
+    s->SetX(Vec3(x[0], x[1], x[2]));
+    s->SetV(Vec3(v[0], v[1], v[2]));
+    s->SetM(m);
+    s->SetH(h);
+    s->SetType(-1);
+    mSinks.push_back(s);
+  }
+}
+
+bool SparFile::ReadIndex() {
+  // The trailer at the end gives the position of the index
+  long data_start = mBR->Tell();
+  long size = mBR->Size();
+  if (size < data_start + TRAILER_BYTES)
+    return false;
+  long index_offset = 0;
+  int num_chunks = 0, magic = 0;
+  mBR->Seek(size - TRAILER_BYTES);
+  mBR->ReadValue(index_offset);
+  mBR->ReadValue(num_chunks);
+  mBR->ReadValue(magic);
+  if (magic != INDEX_MAGIC || num_chunks < 0 || index_offset < data_start)
+    return false;
+
+  int fields = SCALAR_FIELDS + mExtraData;
+  mChunks.assign(num_chunks, SparChunk());
+  mBR->Seek(index_offset);
+  for (int c = 0; c < num_chunks; ++c) {
+    SparChunk &chunk = mChunks[c];
+    mBR->ReadValue(chunk.offset);
+    mBR->ReadValue(chunk.count);
+    mBR->ReadValue(chunk.type_min);
+    mBR->ReadValue(chunk.type_max);
+    mBR->ReadArray(chunk.box_min, 3);
+    mBR->ReadArray(chunk.box_max, 3);
+    chunk.field_min.resize(fields);
+    chunk.field_max.resize(fields);
+    mBR->ReadArray(&chunk.field_min[0], fields);
+    mBR->ReadArray(&chunk.field_max[0], fields);
+  }
+  mBR->Seek(data_start);
+
+  return true;
+}
+
+bool SparFile::PassChunk(const SparChunk &chunk) {
+  if (chunk.count == 0)
+    return false;
+  if (mFilter.type != 0 &&
+      (mFilter.type < chunk.type_min || mFilter.type > chunk.type_max))
+    return false;
+  if (mFilter.density > 0.0f && chunk.field_max[2] < mFilter.density)
+    return false;
+  if (mFilter.height > 0.0f && (chunk.box_min[2] > mFilter.height ||
+                                chunk.box_max[2] < -mFilter.height))
+    return false;
+
+  if (mFilter.radius > 0.0f) {
+    // Distance to the nearest point of the box, with a margin for rounding
+    double nearest = 0.0;
+    for (int j = 0; j < mFilter.radial_dim; ++j) {
+      double d = std::max(chunk.box_min[j], std::min(0.0, chunk.box_max[j]));
+      nearest += d * d;
+    }
+    if (sqrt(nearest) > mFilter.radius * (1.0 + 1E-6))
+      return false;
+  }
+  return true;
+}
+
+void SparFile::ReadChunk(const SparChunk &chunk, std::vector<char> &buffer) {
+  // The whole chunk is read at once, then only the particles which pass the
+  // filter are created
+  long n = chunk.count;
+  int fields = SCALAR_FIELDS + mExtraData;
+  buffer.resize(n * (2 * sizeof(int) + 6 * sizeof(double) +
+                     fields * sizeof(float)));
+  mBR->Seek(chunk.offset);
+  mBR->ReadBytes(&buffer[0], buffer.size());
+
+  const int *id = (const int *)&buffer[0];
+  const int *type = id + n;
+  const double *x = (const double *)(type + n);
+  const double *v = x + 3 * n;
+  const float *field = (const float *)(v + 3 * n);
+  for (long i = 0; i < n; ++i) {
+    Vec3 pos(x[3 * i], x[3 * i + 1], x[3 * i + 2]);
+    if (!mFilter.PassType(type[i]) || !mFilter.Pass(pos) ||
+        !mFilter.PassDensity(field[2 * n + i]))
+      continue;
+
+    Particle *p = new Particle();
+    p->SetID(id[i]);
+    p->SetType(type[i]);
+    p->SetX(pos);
+    p->SetV(Vec3(v[3 * i], v[3 * i + 1], v[3 * i + 2]));
+    p->SetM(field[i]);
+    p->SetH(field[n + i]);
+    p->SetD(field[2 * n + i]);
+    p->SetU(field[3 * n + i]);
+    for (int e = 0; e < mExtraData; ++e)
+      p->SetExtra(e, field[(SCALAR_FIELDS + e) * n + i]);
+    mParticles.push_back(p);
+  }
+}
+
+void SparFile::WriteHeaderUnform() {
+  mBW->WriteValue(SPAR_MAGIC);
+  mBW->WriteValue(SPAR_VERSION);
+  mBW->WriteValue(mNumGas);
+  mBW->WriteValue(mNumDust);
+  mBW->WriteValue(mNumSink);
+  mBW->WriteValue(mExtraData);
+  mBW->WriteValue(mChunkSize);
+  mBW->WriteValue(mTime);
+}
+
+void SparFile::WriteSinkUnform() {
+  for (int i = 0; i < mNumSink; ++i) {
+    Vec3 x = mSinks[i]->GetX();
+    Vec3 v = mSinks[i]->GetV();
+    mBW->WriteArray(x.D, 3);
+    mBW->WriteArray(v.D, 3);
+    mBW->WriteValue(mSinks[i]->GetM());
+    mBW->WriteValue(mSinks[i]->GetH());
+  }
+}
+
+void SparFile::WriteChunk(const std::vector<int> &order, const int first,
+                          const int count, SparChunk &chunk) {
+  int fields = SCALAR_FIELDS + mExtraData;
+  std::vector<int> id(count), type(count);
+  std::vector<double> x(3 * count), v(3 * count);
+  std::vector<float> field((long)fields * count);
+  for (int i = 0; i < count; ++i) {
+    Particle *p = mParticles[order[first + i]];
+    id[i] = p->GetID();
+    type[i] = p->GetType();
+    Vec3 pos = p->GetX();
+    Vec3 vel = p->GetV();
+    for (int j = 0; j < 3; ++j) {
+      x[3 * i + j] = pos[j];
+      v[3 * i + j] = vel[j];
+    }
+    field[i] = p->GetM();
+    field[count + i] = p->GetH();
+    field[2 * count + i] = p->GetD();
+    field[3 * count + i] = p->GetU();
+    for (int e = 0; e < mExtraData; ++e)
+      field[(SCALAR_FIELDS + e) * count + i] = p->GetExtra(e);
+  }
+
+  chunk.offset = mBW->Tell();
+  chunk.count = count;
+  chunk.type_min = *std::min_element(type.begin(), type.end());
+  chunk.type_max = *std::max_element(type.begin(), type.end());
+  for (int j = 0; j < 3; ++j) {
+    chunk.box_min[j] = chunk.box_max[j] = x[j];
+    for (int i = 1; i < count; ++i) {
+      chunk.box_min[j] = std::min(chunk.box_min[j], x[3 * i + j]);
+      chunk.box_max[j] = std::max(chunk.box_max[j], x[3 * i + j]);
+    }
+  }
+  chunk.field_min.resize(fields);
+  chunk.field_max.resize(fields);
+  for (int f = 0; f < fields; ++f) {
+    const float *begin = &field[(long)f * count];
+    chunk.field_min[f] = *std::min_element(begin, begin + count);
+    chunk.field_max[f] = *std::max_element(begin, begin + count);
+  }
+
+  mBW->WriteArray(id);
+  mBW->WriteArray(type);
+  mBW->WriteArray(x);
+  mBW->WriteArray(v);
+  mBW->WriteArray(field);
+}
+
+void SparFile::WriteIndex() {
+  long index_offset = mBW->Tell();
+  for (int c = 0; c < mChunks.size(); ++c) {
+    const SparChunk &chunk = mChunks[c];
+    mBW->WriteValue(chunk.offset);
+    mBW->WriteValue(chunk.count);
+    mBW->WriteValue(chunk.type_min);
+    mBW->WriteValue(chunk.type_max);
+    mBW->WriteArray(chunk.box_min, 3);
+    mBW->WriteArray(chunk.box_max, 3);
+    mBW->WriteArray(chunk.field_min);
+    mBW->WriteArray(chunk.field_max);
+  }
+  mBW->WriteValue(index_offset);
+  mBW->WriteValue((int)mChunks.size());
+  mBW->WriteValue(INDEX_MAGIC);
+}
+
+std::vector<int> SparFile::SortParticles() {
+  int n = mParticles.size();
+  std::vector<int> order(n);
+  for (int i = 0; i < n; ++i)
+    order[i] = i;
+  if (n == 0)
+    return order;
+
+  Vec3 lo = mParticles[0]->GetX(), hi = lo;
+  for (int i = 1; i < n; ++i) {
+    Vec3 x = mParticles[i]->GetX();
+    for (int j = 0; j < 3; ++j) {
+      lo[j] = std::min(lo[j], x[j]);
+      hi[j] = std::max(hi[j], x[j]);
+    }
+  }
+
+  // Positions scaled to integers over the bounding cube, so cells stay cubic
+  // for thin discs, and interleaved
+  double extent = std::max(hi.x - lo.x, std::max(hi.y - lo.y, hi.z - lo.z));
+  const double cells = (1 << MORTON_BITS) - 1;
+  const double scale = (extent > 0.0) ? cells / extent : 0.0;
+  std::vector<unsigned long> key(n);
+  std::vector<int> type(n);
+  ParallelFor(n, mThreads, [&](int start, int end, int task) {
+    for (int i = start; i < end; ++i) {
+      Vec3 x = mParticles[i]->GetX();
+      unsigned long k = 0;
+      for (int j = 0; j < 3; ++j) {
+        unsigned long cell = (x[j] - lo[j]) * scale;
+        k |= SpreadBits(std::min(cell, (unsigned long)cells)) << j;
+      }
+      key[i] = k;
+      type[i] = mParticles[i]->GetType();
+    }
+  });
+
+  std::sort(order.begin(), order.end(), [&](int a, int b) {
+    bool gas_a = type[a] == GAS_TYPE, gas_b = type[b] == GAS_TYPE;
+    if (gas_a != gas_b)
+      return gas_a;
+    if (type[a] != type[b])
+      return type[a] < type[b];
+    if (key[a] != key[b])
+      return key[a] < key[b];
+    return a < b;
+  });
+  return order;
+}
@@ -0,0 +1,207 @@
+//===-- TextWriter.cpp ----------------------------------------------------===//
+//
+//                                  SPARGEL
+//                   Smoothed Particle Generator and Loader
+//
+// This file is distributed under the GNU General Public License. See LICENSE
+// for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// TextWriter.cpp
+///
+//===----------------------------------------------------------------------===//
+
+#include "TextWriter.h"
+
+#include <cstdio>
+#include <cstring>
+
+TextWriter::TextWriter(std::ostream &outStream, const int capacity)
+    : mOutStream(&outStream), mBuffer(std::max(64, capacity)) {}
+
+TextWriter::TextWriter(const int capacity)
+    : mBuffer(std::max(64, capacity)) {}
+
+TextWriter::~TextWriter() { Flush(); }
+
+void TextWriter::Write(const char *text, const int length) {
+  if (mOutStream && length > mBuffer.size()) {
+    Flush();
+    mOutStream->write(text, length);
+    return;
+  }
+  Reserve(length);
+  memcpy(&mBuffer[mSize], text, length);
+  mSize += length;
+}
+
+void TextWriter::Write(const char c) {
+  Reserve(1);
+  mBuffer[mSize++] = c;
+}
+
+void TextWriter::WriteInt(const long value, const int width) {
+  char text[24];
+  int length = 0;
+  unsigned long magnitude = (value < 0) ? -(unsigned long)value : value;
+  do {
+    text[length++] = '0' + magnitude % 10;
+    magnitude /= 10;
+  } while (magnitude > 0);
+  if (value < 0)
+    text[length++] = '-';
+
+  Pad(length, width);
+  Reserve(length);
+  for (int i = length - 1; i >= 0; --i)
+    mBuffer[mSize++] = text[i];
+}
+
+void TextWriter::WriteFloat(const double value, const int width,
+                            const int precision) {
+  char text[32];
+  int length = FormatGeneral(value, precision, text);
+  Pad(length, width);
+  Write(text, length);
+}
+
+void TextWriter::Append(TextWriter &part) {
+  if (part.mSize > 0)
+    Write(&part.mBuffer[0], part.mSize);
+  part.mSize = 0;
+}
+
+void TextWriter::Flush() {
+  if (mOutStream == NULL)
+    return;
+  if (mSize > 0)
+    mOutStream->write(&mBuffer[0], mSize);
+  mSize = 0;
+}
+
+void TextWriter::Reserve(const int length) {
+  if (mSize + length <= mBuffer.size())
+    return;
+  if (mOutStream)
+    Flush();
+  else
+    mBuffer.resize(std::max(2 * mBuffer.size(), (size_t)(mSize + length)));
+}
+
+void TextWriter::Pad(const int length, const int width) {
+  for (int i = length; i < width; ++i)
+    Write(' ');
+}
+
+// Powers of ten exact in long double
+static const int EXACT_POWERS = 28;
+
+static long double PowerOfTen(const int power) {
+  static const std::vector<long double> table = [] {
+    std::vector<long double> powers(EXACT_POWERS, 1.0L);
+    for (int i = 1; i < EXACT_POWERS; ++i)
+      powers[i] = powers[i - 1] * 10.0L;
+    return powers;
+  }();
+  return (power < EXACT_POWERS) ? table[power] : powl(10.0L, power);
+}
+
+int TextWriter::FormatGeneral(const double value, int precision, char *text) {
+  if (precision <= 0)
+    precision = 1;
+  if (!std::isfinite(value) || precision > MAX_FAST_PRECISION)
+    return snprintf(text, 32, "%.*g", std::min(precision, 17), value);
+
+  int length = 0;
+  if (std::signbit(value))
+    text[length++] = '-';
+  double magnitude = fabs(value);
+  if (magnitude == 0.0) {
+    text[length++] = '0';
+    return length;
+  }
+
+  // Scale to an integer of precision digits. The decimal exponent estimated
+  // from the binary one may be one out, which shows in the number of digits.
+  unsigned long lower = 1;
+  for (int i = 1; i < precision; ++i)
+    lower *= 10;
+  unsigned long upper = lower * 10;
+  int binary = 0;
+  frexp(magnitude, &binary);
+  int exponent = floor((binary - 1) * 0.30102999566398120);
+  unsigned long digits = 0;
+  for (int attempt = 0; attempt < 4; ++attempt) {
+    int shift = precision - 1 - exponent;
+    long double scaled = (shift >= 0) ? magnitude * PowerOfTen(shift)
+                                      : magnitude / PowerOfTen(-shift);
+    if (scaled >= upper) {
+      ++exponent;
+      continue;
+    }
+    if (scaled < lower) {
+      --exponent;
+      continue;
+    }
+
+    // A value too close to halfway to round safely is left to printf
+    digits = (unsigned long)scaled;
+    long double fraction = scaled - digits;
+    if (fabsl(fraction - 0.5L) < 1E-5L)
+      return snprintf(text, 32, "%.*g", precision, value);
+    if (fraction > 0.5L)
+      ++digits;
+    if (digits == upper) {
+      digits = lower;
+      ++exponent;
+    }
+    break;
+  }
+  if (digits == 0)
+    return snprintf(text, 32, "%.*g", precision, value);
+
+  char mantissa[24];
+  for (int i = precision - 1; i >= 0; --i) {
+    mantissa[i] = '0' + digits % 10;
+    digits /= 10;
+  }
+  // Trailing zeros are dropped, except from the integer part of a fixed
+  // number
+  int used = precision;
+  while (used > 1 && mantissa[used - 1] == '0')
+    --used;
+
+  if (exponent < -4 || exponent >= precision) {
+    text[length++] = mantissa[0];
+    if (used > 1) {
+      text[length++] = '.';
+      for (int i = 1; i < used; ++i)
+        text[length++] = mantissa[i];
+    }
+    text[length++] = 'e';
+    text[length++] = (exponent < 0) ? '-' : '+';
+    int power = abs(exponent);
+    if (power >= 100)
+      text[length++] = '0' + power / 100;
+    text[length++] = '0' + (power / 10) % 10;
+    text[length++] = '0' + power % 10;
+  } else if (exponent >= 0) {
+    for (int i = 0; i <= exponent; ++i)
+      text[length++] = mantissa[i];
+    if (used > exponent + 1) {
+      text[length++] = '.';
+      for (int i = exponent + 1; i < used; ++i)
+        text[length++] = mantissa[i];
+    }
+  } else {
+    text[length++] = '0';
+    text[length++] = '.';
+    for (int i = 1; i < -exponent; ++i)
+      text[length++] = '0';
+    for (int i = 0; i < used; ++i)
+      text[length++] = mantissa[i];
+  }
+  return length;
+}
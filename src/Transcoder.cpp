@@ -0,0 +1,180 @@
+//===-- Transcoder.cpp ----------------------------------------------------===//
+//
+//                                  SPARGEL
+//                   Smoothed Particle Generator and Loader
+//
+// This file is distributed under the GNU General Public License. See LICENSE
+// for details.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// Transcoder.cpp
+///
+//===----------------------------------------------------------------------===//
+
+#include "Transcoder.h"
+
+Transcoder::Transcoder(OpacityTable *opacity, const Cooling cooling,
+                       const float mu_bar, const float gamma,
+                       const int chunk_size, const int threads)
+    : mOpacity(opacity), mCooling(cooling), mMuBar(mu_bar), mGamma(gamma),
+      mChunkSize(std::max(1, chunk_size)), mThreads(std::max(1, threads)) {}
+
+Transcoder::~Transcoder() {}
+
+bool Transcoder::Supports(const std::string &format) {
+  return format == "su" || format == "sf" || format == "df" ||
+         format == "column";
+}
+
+bool Transcoder::Run(SerenFile *source, const NameData &nd) {
+  if (nd.format == "su")
+    return ToSeren(source, nd, false);
+  if (nd.format == "sf")
+    return ToSeren(source, nd, true);
+  if (nd.format == "df")
+    return ToDragon(source, nd);
+  if (nd.format == "column")
+    return ToColumn(source, nd);
+
+  std::cout << "   Cannot transcode to format " << nd.format << "\n";
+  return false;
+}
+
+bool Transcoder::ToSeren(SerenFile *source, const NameData &nd,
+                         const bool formatted) {
+  int num = source->GetNumGas() + source->GetNumDust();
+  std::vector<double> column;
+  source->ReadColumn(2, 0, std::min(1, num), column);
+  double hydro_mass = (num > 0) ? column[0] : 0.0;
+
+  SerenFile *writer = new SerenFile(nd, formatted, 0);
+  writer->SetSinks(source->GetSinks());
+  writer->SetTime(source->GetTime());
+  writer->SetThreads(mThreads);
+  if (!writer->BeginStream(nd.name, num, hydro_mass, formatted, true)) {
+    writer->ClearSinks();
+    delete writer;
+    return false;
+  }
+
+  // Both files hold whole columns in the same order, so each is copied in
+  // turn and the source and destination are both read and written in order.
+  std::vector<int> ids;
+  for (int first = 0; first < num; first += mChunkSize) {
+    source->ReadIDs(first, std::min(mChunkSize, num - first), ids);
+    writer->AppendStreamIDs(ids);
+  }
+  for (int c = 1; c <= 6; ++c) {
+    int dim = (c == 1 || c == 4) ? 3 : 1;
+    for (int first = 0; first < num; first += mChunkSize) {
+      source->ReadColumn(c, first, std::min(mChunkSize, num - first), column);
+      writer->AppendStreamColumn(column, dim);
+    }
+  }
+
+  writer->EndStream();
+  writer->ClearSinks();
+  delete writer;
+
+  return true;
+}
+
+bool Transcoder::ToDragon(SerenFile *source, const NameData &nd) {
+  int num = source->GetNumGas() + source->GetNumDust();
+  int num_gas = source->GetNumGas();
+
+  DragonFile *writer = new DragonFile(nd, true, 0);
+  writer->SetSinks(source->GetSinks());
+  writer->SetTime(source->GetTime());
+  writer->SetThreads(mThreads);
+  if (!writer->BeginStream(nd.name, num)) {
+    writer->ClearSinks();
+    delete writer;
+    return false;
+  }
+
+  // SEREN column and unit of each DRAGON column. Temperatures, types and ids
+  // are handled separately.
+  const int seren[8] = {1, 4, -1, 3, 5, 2, -1, -1};
+  const double unit[8] = {PC_TO_AU, 1.0, 1.0, PC_TO_AU, 1.0, 1.0, 1.0, 1.0};
+
+  std::vector<double> column, rho, u;
+  std::vector<int> ints;
+  for (int c = 0; c < 8; ++c) {
+    for (int first = 0; first < num; first += mChunkSize) {
+      int count = std::min(mChunkSize, num - first);
+      if (c == 2) {
+        source->ReadColumn(5, first, count, rho);
+        source->ReadColumn(6, first, count, u);
+        FindTemperatures(rho, u, column);
+        writer->AppendStreamColumn(column, 1);
+      } else if (c == 6) {
+        ints.resize(count);
+        for (int i = 0; i < count; ++i)
+          ints[i] = (first + i < num_gas) ? GAS_TYPE : DUST_TYPE;
+        writer->AppendStreamColumn(ints);
+      } else if (c == 7) {
+        source->ReadIDs(first, count, ints);
+        writer->AppendStreamColumn(ints);
+      } else {
+        source->ReadColumn(seren[c], first, count, column);
+        if (unit[c] != 1.0) {
+          for (int i = 0; i < column.size(); ++i)
+            column[i] /= unit[c];
+        }
+        writer->AppendStreamColumn(column, (c < 2) ? 3 : 1);
+      }
+    }
+    writer->WriteStreamSinks(c);
+  }
+
+  writer->EndStream();
+  writer->ClearSinks();
+  delete writer;
+
+  return true;
+}
+
+bool Transcoder::ToColumn(SerenFile *source, const NameData &nd) {
+  int num = source->GetNumGas() + source->GetNumDust();
+
+  ColumnFile *writer = new ColumnFile(nd);
+  writer->SetSinks(source->GetSinks());
+  writer->SetTime(source->GetTime());
+  writer->SetThreads(mThreads);
+  if (!writer->BeginStream(nd.name, num)) {
+    writer->ClearSinks();
+    delete writer;
+    return false;
+  }
+
+  // Rows hold every column, so each chunk requests all of them together
+  const std::vector<int> columns = {1, 2, 3, 4, 5, 6};
+  std::vector<std::vector<double>> values;
+  for (int first = 0; first < num; first += mChunkSize) {
+    int count = std::min(mChunkSize, num - first);
+    source->ReadColumns(columns, first, count, values);
+    writer->AppendStreamRows(values[0], values[3], values[1], values[2],
+                             values[4], values[5]);
+  }
+
+  writer->EndStream();
+  writer->ClearSinks();
+  delete writer;
+
+  return true;
+}
+
+void Transcoder::FindTemperatures(const std::vector<double> &rho,
+                                  const std::vector<double> &u,
+                                  std::vector<double> &temp) {
+  temp.resize(rho.size());
+  ParallelFor(rho.size(), mThreads, [&](int start, int end, int task) {
+    for (int i = start; i < end; ++i) {
+      temp[i] = ThermoTemperature(mCooling, mOpacity, rho[i], u[i], mMuBar,
+                                  mGamma);
+    }
+  });
+}